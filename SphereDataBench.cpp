@@ -0,0 +1,680 @@
+// SphereDataBench.cpp : Micro-benchmarks of the vector math, the shading,
+// the lights, the sphere raster kernels, the depth sort and the clear.
+// Prints a table and writes JSON of a stable layout to diff builds and
+// machines.
+
+// fopen() is portable, skip MSVC's *_s() advice
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Timer.h"
+#include "Vec3.h"
+#include "Vec3SIMD.h"
+#include "Test/FrameBuffer.h"
+#include "Test/FrameTrace.h"
+#include "Test/RasterKernel.h"
+#include "Test/SphereData.h"
+#include "Test/TaskScheduler.h"
+#include "Test/Upscale.h"
+
+
+static const int FRAME_SIZE = 1024;
+//! Vectors per run of the math benchmarks, they stay in L1.
+static const std::size_t NUM_VECTORS = 1024;
+//! Spheres per run of the RenderSpheres() benchmarks.
+static const std::size_t NUM_SPHERES = 4096;
+static const double DEFAULT_MIN_MS = 20;
+static const int DEFAULT_REPEATS = 5;
+
+
+//////////////////////////////////////////////////////////////////////////////////
+struct SOptions
+{
+	//! Benchmarks with the substring in the name only.
+	const char* szFilter = nullptr;
+	const char* szJson = nullptr;
+	//! A measured batch of runs is not shorter, ms.
+	double fMinMs = DEFAULT_MIN_MS;
+	int nRepeats = DEFAULT_REPEATS;
+	bool bList = false;
+};
+
+
+//! A run does `items` units of work: vectors, pixels, spheres, keys.
+struct SBenchmark
+{
+	std::string name;
+	std::size_t items;
+	std::function<void()> run;
+};
+
+
+struct SBenchResult
+{
+	std::string name;
+	std::size_t items;
+	//! Runs per measured batch.
+	std::size_t runs;
+	//! Time per item over the batches, ns.
+	double nsMin;
+	double nsMedian;
+};
+
+
+//! Results go here, so the compiler keeps the work.
+static volatile float g_fSink = 0;
+
+
+//////////////////////////////////////////////////////////////////////////////////
+static void PrintUsage(const char* szExe)
+{
+	printf(
+		"Usage: %s [options]\n"
+		"  --filter TEXT   run the benchmarks with TEXT in the name\n"
+		"  --list          print the names and exit\n"
+		"  --json FILE     save the results as JSON\n"
+		"  --min-ms T      shortest measured batch, ms (default %.0f)\n"
+		"  --repeats N     measured batches per benchmark (default %d)\n"
+		"  --threads N     threads of the task scheduler, 0 is one per core\n",
+		szExe, DEFAULT_MIN_MS, DEFAULT_REPEATS);
+}
+
+
+static bool ParseOptions(int argc, char* argv[], SOptions& opt)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool hasValue = (i + 1 < argc);
+		if (!strcmp(arg, "--filter") && hasValue) {
+			opt.szFilter = argv[++i];
+		}
+		else if (!strcmp(arg, "--list")) {
+			opt.bList = true;
+		}
+		else if (!strcmp(arg, "--json") && hasValue) {
+			opt.szJson = argv[++i];
+		}
+		else if (!strcmp(arg, "--min-ms") && hasValue) {
+			opt.fMinMs = atof(argv[++i]);
+		}
+		else if (!strcmp(arg, "--repeats") && hasValue) {
+			opt.nRepeats = std::max(atoi(argv[++i]), 1);
+		}
+		else if (!strcmp(arg, "--threads") && hasValue) {
+			CTaskScheduler::Get().SetThreadCount(atoi(argv[++i]));
+		}
+		else {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Vector math
+
+template <class V>
+static std::vector<V> MakeVectors()
+{
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> d(-1, 1);
+	std::vector<V> v;
+	for (std::size_t i = 0; i < NUM_VECTORS; ++i) {
+		v.push_back(V{ d(rng), d(rng), d(rng) + 2 });
+	}
+	return v;
+}
+
+
+template <class V>
+static void AddVectorBenchmarks(const char* szType, std::vector<SBenchmark>& list)
+{
+	auto a = std::make_shared< std::vector<V> >(MakeVectors<V>());
+	const std::string prefix = std::string("vec/") + szType;
+
+	list.push_back({ prefix + "/dot", NUM_VECTORS, [a]() {
+		const V light = V{ 1.f, -0.5f, 0.7f }.normalizeCopy();
+		float sum = 0;
+		for (const V& v : *a) {
+			sum += light.dot(v);
+		}
+		g_fSink = g_fSink + sum;
+	} });
+	list.push_back({ prefix + "/length", NUM_VECTORS, [a]() {
+		float sum = 0;
+		for (const V& v : *a) {
+			sum += v.length();
+		}
+		g_fSink = g_fSink + sum;
+	} });
+	list.push_back({ prefix + "/normalize", NUM_VECTORS, [a]() {
+		float sum = 0;
+		for (const V& v : *a) {
+			sum += v.normalizeCopy().x;
+		}
+		g_fSink = g_fSink + sum;
+	} });
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Shading per pixel
+
+//! Per-pixel Phong of the former virtual PhongShading over the vector
+//! type, the reference for the batches of the shading models.
+template <class V>
+static unsigned int PhongPixel(
+	const V& light, int x, int y, float frameRadius, unsigned int argb)
+{
+	V normal = {
+		(float)x,
+		(float)y,
+		sqrtf(frameRadius * frameRadius - (x * x + y * y)) };
+	normal.normalize();
+
+	const float NdotL = light.dot(normal);
+	if (!(NdotL > 0)) {
+		return 0;
+	}
+	const V half = V{ light.x + 0.1f, light.y + 0.1f, light.z + 1.f }.normalizeCopy();
+	const float specular = powf(half.dot(normal), 12);
+	const float alpha = std::min(NdotL + specular, 1.0f);
+	const float r = std::min(((argb >> 16) & 0xFF) * alpha, 255.f);
+	const float g = std::min(((argb >> 8) & 0xFF) * alpha, 255.f);
+	const float b = std::min((argb & 0xFF) * alpha, 255.f);
+	return ((unsigned int)r << 16) | ((unsigned int)g << 8) | (unsigned int)b;
+}
+
+
+//! Pixels of a circle, the shading of a sphere of the radius.
+static std::size_t CirclePixels(int radius)
+{
+	std::size_t n = 0;
+	for (int y = -radius; y <= radius; ++y) {
+		for (int x = -radius; x <= radius; ++x) {
+			n += (x * x + y * y <= radius * radius);
+		}
+	}
+	return n;
+}
+
+
+template <class S>
+static void ShadeCircle(const S& shading, int radius)
+{
+	unsigned int sum = 0;
+	for (int y = -radius; y <= radius; ++y)
+	{
+		for (int x = -radius; x <= radius; ++x)
+		{
+			if (x * x + y * y <= radius * radius) {
+				sum += shading(x, y);
+			}
+		}
+	}
+	g_fSink = g_fSink + (float)sum;
+}
+
+
+//! The rows of a circle by the span kernel, the pixels of CirclePixels().
+static void ShadeSpans(spanKernel_t kernel, const SSphereSetup& setup, int radius,
+	float* z, unsigned int* color)
+{
+	SSpanResult result = { 0, 0, 1.f };
+	for (int dy = -radius; dy <= radius; ++dy)
+	{
+		int dx = 0;
+		while ((dx + 1) * (dx + 1) + dy * dy <= radius * radius) {
+			++dx;
+		}
+		kernel(setup, -dx, dy, 2 * dx + 1, false, { nullptr, nullptr }, z, color, result);
+	}
+	g_fSink = g_fSink + (float)result.written;
+}
+
+
+static void AddShadingBenchmarks(std::vector<SBenchmark>& list)
+{
+	static const int RADIUS = 32;
+	const std::size_t pixels = CirclePixels(RADIUS);
+	const FrameRenderElement fre = { 0.1f, 0.1f, 0.5f, RADIUS / (FRAME_SIZE / 2.f), 0x00C08040 };
+
+	// the models in batches: the rows of the circle by the span kernel
+	float lightX, lightY, lightZ;
+	CFrameBuffer::GetLight(lightX, lightY, lightZ);
+	const Vec3 half = Vec3{ lightX + fre.screenX, lightY + fre.screenY, lightZ + 1 }.normalizeCopy();
+	const SSphereSetup setup = {
+		fre.screenZ, FRAME_SIZE / 2.f, (float)(RADIUS * RADIUS), 1.f / RADIUS,
+		lightX, lightY, lightZ, half.x, half.y, half.z, 192, 128, 64, nullptr };
+	for (EShadingModel model : { EShadingModel::Direct, EShadingModel::Lambert,
+		EShadingModel::Phong, EShadingModel::BlinnPhong })
+	{
+		const spanKernel_t kernel = GetSpanKernel(GetBestKernelISA(), model);
+		auto z = std::make_shared< std::vector<float> >(2 * RADIUS + 1);
+		auto color = std::make_shared< std::vector<unsigned int> >(2 * RADIUS + 1);
+		list.push_back({ std::string("shade/") + GetShadingModelName(model), pixels,
+			[kernel, setup, z, color]() {
+				ShadeSpans(kernel, setup, RADIUS, std::data(*z), std::data(*color));
+			} });
+	}
+	list.push_back({ "shade/phong/vec3", pixels, []() {
+		const Vec3 light = Vec3{ 1.f, -0.5f, 0.7f }.normalizeCopy();
+		ShadeCircle([&](int x, int y) {
+			return PhongPixel(light, x, y, (float)RADIUS, 0x00C08040);
+		}, RADIUS);
+	} });
+	list.push_back({ "shade/phong/vec3simd", pixels, []() {
+		const Vec3SIMD light = Vec3SIMD{ 1.f, -0.5f, 0.7f }.normalizeCopy();
+		ShadeCircle([&](int x, int y) {
+			return PhongPixel(light, x, y, (float)RADIUS, 0x00C08040);
+		}, RADIUS);
+	} });
+}
+
+
+
+//! \brief The lights model by the span kernel per power and light count.
+//! An item is a pixel lit by one light, so ns/item is also ms per light
+//! per megapixel.
+static void AddLightingBenchmarks(std::vector<SBenchmark>& list)
+{
+	static const int RADIUS = 128;
+	const std::size_t pixels = CirclePixels(RADIUS);
+
+	float lightX, lightY, lightZ;
+	CFrameBuffer::GetLight(lightX, lightY, lightZ);
+	for (ESpecularPow pow : { ESpecularPow::Exact, ESpecularPow::Fast, ESpecularPow::Table })
+	{
+		const spanKernel_t kernel =
+			GetSpanKernel(GetBestKernelISA(), EShadingModel::Lights, pow);
+		for (int nLights : { 1, 2, 4, 8 })
+		{
+			auto lighting = std::make_shared<CLighting>(CLighting::MakeRig(nLights));
+			lighting->SetSpecularPow(pow);
+			const SSphereSetup setup = {
+				0.5f, FRAME_SIZE / 2.f, (float)(RADIUS * RADIUS), 1.f / RADIUS,
+				lightX, lightY, lightZ, 0, 0, 0, 192, 128, 64, &lighting->GetLightSet() };
+			auto z = std::make_shared< std::vector<float> >(2 * RADIUS + 1);
+			auto color = std::make_shared< std::vector<unsigned int> >(2 * RADIUS + 1);
+			list.push_back({ std::string("light/") + CLighting::GetSpecularPowName(pow) +
+				"/" + std::to_string(nLights), pixels * nLights,
+				[kernel, setup, lighting, z, color]() {
+					ShadeSpans(kernel, setup, RADIUS, std::data(*z), std::data(*color));
+				} });
+		}
+	}
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Sphere raster
+
+//! The frame buffer shared by the raster benchmarks.
+static CFrameBuffer& GetFrameBuffer()
+{
+	static CFrameBuffer fb(FRAME_SIZE, FRAME_SIZE);
+	return fb;
+}
+
+
+//! Spans of the middle row of a sphere, the depth goes nearer every
+//! run, so all the pixels pass the depth test and are written.
+static void AddSpanBenchmarks(std::vector<SBenchmark>& list)
+{
+	float lightX, lightY, lightZ;
+	CFrameBuffer::GetLight(lightX, lightY, lightZ);
+	const float halfLength = sqrtf(lightX * lightX + lightY * lightY + (lightZ + 1) * (lightZ + 1));
+
+	for (EKernelISA isa : { EKernelISA::Scalar, EKernelISA::SSE41, EKernelISA::AVX2 })
+	{
+		const spanKernel_t kernel = GetSpanKernel(isa);
+		if (!kernel) {
+			continue;
+		}
+		for (int radius : { 4, 16, 64 })
+		{
+			const int count = 2 * radius + 1;
+			auto z = std::make_shared< std::vector<float> >(count, 1.f);
+			auto color = std::make_shared< std::vector<unsigned int> >(count, 0);
+			auto setup = std::make_shared<SSphereSetup>();
+			*setup = {
+				0.5f, FRAME_SIZE / 2.f, (float)(radius * radius), 1.f / radius,
+				lightX, lightY, lightZ,
+				lightX / halfLength, lightY / halfLength, (lightZ + 1) / halfLength,
+				192, 128, 64, nullptr };
+			list.push_back({
+				std::string("span/") + GetKernelISAName(isa) + "/r" + std::to_string(radius),
+				(std::size_t)count,
+				[kernel, radius, count, z, color, setup]() {
+					setup->screenZ = (setup->screenZ > 0.1f) ? setup->screenZ - 1e-6f : 0.5f;
+					if (setup->screenZ == 0.5f) {
+						std::fill(z->begin(), z->end(), 1.f);
+					}
+					SSpanResult result = { 0, 0, 1.f };
+					kernel(*setup, -radius, 0, count, true, { nullptr, nullptr },
+						std::data(*z), std::data(*color), result);
+					g_fSink = g_fSink + result.zMin;
+				} });
+		}
+	}
+}
+
+
+//! One sphere in the middle by the old single-threaded paths.
+static void AddSphereBenchmarks(std::vector<SBenchmark>& list)
+{
+	for (int radius : { 4, 16, 64 })
+	{
+		const std::size_t pixels = CirclePixels(radius);
+		const std::string suffix = "/r" + std::to_string(radius);
+		auto z = std::make_shared<float>(0.5f);
+		const auto Sphere = [radius, z]() {
+			// nearer every run, drawn fully
+			*z = (*z > 0.1f) ? *z - 1e-6f : 0.5f;
+			if (*z == 0.5f) {
+				GetFrameBuffer().Clear();
+			}
+			return FrameRenderElement{
+				0.01f, 0.01f, *z, radius / (FRAME_SIZE / 2.f), 0x00C08040 };
+		};
+		list.push_back({ "sphere/RenderSphere" + suffix, pixels, [Sphere]() {
+			GetFrameBuffer().RenderSphere(Sphere());
+		} });
+		list.push_back({ "sphere/RenderSphere2" + suffix, pixels, [Sphere]() {
+			GetFrameBuffer().RenderSphere2(Sphere());
+		} });
+	}
+}
+
+
+//! A cleared frame and a list of spheres of one screen radius.
+static void AddRasterBenchmarks(std::vector<SBenchmark>& list)
+{
+	for (float radius : { 0.75f, 4.f, 16.f, 64.f })
+	{
+		auto spheres = std::make_shared< std::vector<FrameRenderElement> >();
+		std::mt19937 rng(2);
+		std::uniform_real_distribution<float> d(-1, 1);
+		for (std::size_t i = 0; i < NUM_SPHERES; ++i)
+		{
+			spheres->push_back({ d(rng), d(rng), 1 + d(rng) * 0.5f,
+				radius / (FRAME_SIZE / 2.f), (unsigned int)rng() & 0xFFFFFF });
+		}
+		// front to back as CSphereData::Sort()
+		std::sort(spheres->begin(), spheres->end(),
+			[](const FrameRenderElement& a, const FrameRenderElement& b) {
+				return a.screenZ < b.screenZ;
+			});
+
+		char szName[64];
+		sprintf(szName, "raster/RenderSpheres/r%g", radius);
+		list.push_back({ szName, NUM_SPHERES, [spheres]() {
+			CFrameBuffer& fb = GetFrameBuffer();
+			fb.Clear();
+			fb.PrebuildImpostors(0, 64 / (FRAME_SIZE / 2.f));
+			fb.RenderSpheres(*spheres);
+		} });
+	}
+}
+
+
+//! A frame of every level of CQualityController scaled up to the full
+//! size, all the rows drawn.
+static void AddUpscaleBenchmarks(std::vector<SBenchmark>& list)
+{
+	const std::size_t pixels = (std::size_t)FRAME_SIZE * FRAME_SIZE;
+	auto dst = std::make_shared< std::vector<CFrameBuffer::color_t> >(pixels);
+	for (float scale : { 0.875f, 0.75f, 0.625f, 0.5f })
+	{
+		const int size = (int)(FRAME_SIZE * scale + 0.5f);
+		auto src = std::make_shared< std::vector<CFrameBuffer::color_t> >((std::size_t)size * size);
+		std::mt19937 rng(4);
+		for (CFrameBuffer::color_t& c : *src) {
+			c = (CFrameBuffer::color_t)rng() & 0xFFFFFF;
+		}
+
+		char szName[64];
+		sprintf(szName, "upscale/%g", scale);
+		list.push_back({ szName, pixels, [src, dst, size]() {
+			int y0, y1;
+			UpscaleFrame(std::data(*src), size, size, 0, size,
+				std::data(*dst), FRAME_SIZE, FRAME_SIZE, y0, y1);
+			g_fSink = g_fSink + (float)dst->front();
+		} });
+	}
+}
+
+
+//! Clear() after a frame which touched every tile or one tile.
+static void AddClearBenchmarks(std::vector<SBenchmark>& list)
+{
+	const std::size_t pixels = (std::size_t)FRAME_SIZE * FRAME_SIZE;
+	const FrameRenderElement dot = { 0, 0, 0.5f, 0.5f / (FRAME_SIZE / 2.f), 0x00FFFFFF };
+	// RenderSphere2() marks every tile
+	list.push_back({ "clear/full", pixels, [dot]() {
+		CFrameBuffer& fb = GetFrameBuffer();
+		fb.RenderSphere2(dot);
+		fb.Clear();
+	} });
+	list.push_back({ "clear/tile", (std::size_t)CFrameBuffer::DEFAULT_TILE_SIZE *
+		CFrameBuffer::DEFAULT_TILE_SIZE, [dot]() {
+		CFrameBuffer& fb = GetFrameBuffer();
+		fb.RenderSphere(dot);
+		fb.Clear();
+	} });
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////////
+// Depth sort
+
+static void AddSortBenchmarks(std::vector<SBenchmark>& list)
+{
+	for (std::size_t n : { 1000, 10000, 100000, 1000000, 10000000 })
+	{
+		auto keys = std::make_shared< std::vector<SDepthKey> >(n);
+		auto sorted = std::make_shared< std::vector<SDepthKey> >(n);
+		std::mt19937 rng(3);
+		std::uniform_real_distribution<float> d(-1, 1);
+		for (std::size_t i = 0; i < n; ++i) {
+			(*keys)[i] = { d(rng), (unsigned int)i };
+		}
+		const auto Less = [](const SDepthKey& a, const SDepthKey& b) {
+			return a.screenZ < b.screenZ || (a.screenZ == b.screenZ && a.index < b.index);
+		};
+
+		const std::string suffix = "/" + std::to_string(n);
+		// a second a run
+		if (n < 10000000)
+		{
+			list.push_back({ "sort/std" + suffix, n, [keys, sorted, Less]() {
+				*sorted = *keys;
+				std::sort(sorted->begin(), sorted->end(), Less);
+				g_fSink = g_fSink + sorted->front().screenZ;
+			} });
+		}
+		list.push_back({ "sort/parallel" + suffix, n, [keys, sorted, Less]() {
+			*sorted = *keys;
+			CTaskScheduler::Get().ParallelSort(
+				std::data(*sorted), std::data(*sorted) + sorted->size(), Less);
+			g_fSink = g_fSink + sorted->front().screenZ;
+		} });
+		auto temp = std::make_shared< std::vector<SDepthKey> >(n);
+		list.push_back({ "sort/radix" + suffix, n, [keys, sorted, temp]() {
+			*sorted = *keys;
+			CSphereData::RadixSort(std::data(*sorted), sorted->size(), std::data(*temp));
+			g_fSink = g_fSink + sorted->front().screenZ;
+		} });
+		list.push_back({ "sort/bucket" + suffix, n, [keys, sorted, temp]() {
+			*sorted = *keys;
+			CSphereData::BucketSort(std::data(*sorted), sorted->size(), std::data(*temp));
+			g_fSink = g_fSink + sorted->front().screenZ;
+		} });
+	}
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////////
+//! Batches of runs not shorter than minMs, the best and the median.
+static SBenchResult Measure(const SBenchmark& bench, double fMinMs, int nRepeats)
+{
+	const auto Batch = [&bench](std::size_t runs) {
+		const double t0 = Timer::GetMillisFloat();
+		for (std::size_t k = 0; k < runs; ++k) {
+			bench.run();
+		}
+		return Timer::GetMillisFloat() - t0;
+	};
+
+	// warm the caches, then double the runs up to the batch time
+	std::size_t runs = 1;
+	Batch(runs);
+	while (Batch(runs) < fMinMs && runs < (std::size_t(1) << 30)) {
+		runs *= 2;
+	}
+
+	std::vector<double> ns;
+	for (int k = 0; k < nRepeats; ++k) {
+		ns.push_back(Batch(runs) * 1e6 / ((double)runs * bench.items));
+	}
+	std::sort(ns.begin(), ns.end());
+	return { bench.name, bench.items, runs, ns.front(), ns[ns.size() / 2] };
+}
+
+
+static const char* GetCompilerName()
+{
+#if defined(__clang__)
+	return "clang " __clang_version__;
+#elif defined(__GNUC__)
+	return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+	return "msvc";
+#else
+	return "unknown";
+#endif
+}
+
+
+static bool WriteJson(
+	const char* szFilename, const SOptions& opt, const std::vector<SBenchResult>& results)
+{
+	FILE* f = fopen(szFilename, "w");
+	if (!f) {
+		return false;
+	}
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"context\": {\n");
+	fprintf(f, "    \"compiler\": \"%s\",\n", GetCompilerName());
+	fprintf(f, "    \"kernel_isa\": \"%s\",\n", GetKernelISAName(GetBestKernelISA()));
+	fprintf(f, "    \"threads\": %d,\n", CTaskScheduler::Get().GetThreadCount());
+	fprintf(f, "    \"trace_zones\": %d,\n", SPHEREDATA_TRACE);
+	fprintf(f, "    \"min_batch_ms\": %g,\n", opt.fMinMs);
+	fprintf(f, "    \"repeats\": %d\n", opt.nRepeats);
+	fprintf(f, "  },\n");
+	// max error of the specular power of the light/* benchmarks
+	CLighting lighting;
+	fprintf(f, "  \"specular_error\": {\"shininess\": %g", lighting.GetShininess());
+	for (ESpecularPow pow : { ESpecularPow::Exact, ESpecularPow::Fast, ESpecularPow::Table })
+	{
+		lighting.SetSpecularPow(pow);
+		fprintf(f, ", \"%s\": %.3e",
+			CLighting::GetSpecularPowName(pow), lighting.MeasureSpecularError());
+	}
+	fprintf(f, "},\n");
+	fprintf(f, "  \"benchmarks\": [");
+	for (std::size_t k = 0; k < results.size(); ++k)
+	{
+		const SBenchResult& r = results[k];
+		fprintf(f, "%s\n    {\"name\": \"%s\", \"items\": %zu, \"runs\": %zu, "
+			"\"ns_per_item_min\": %.4f, \"ns_per_item_median\": %.4f, "
+			"\"items_per_second\": %.0f}",
+			k ? "," : "", r.name.c_str(), r.items, r.runs,
+			r.nsMin, r.nsMedian, 1e9 / r.nsMin);
+	}
+	fprintf(f, "\n  ]\n}\n");
+
+	const bool ok = !ferror(f);
+	return (fclose(f) == 0) && ok;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+	SOptions opt;
+	if (!ParseOptions(argc, argv, opt))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	Timer::Init();
+
+	std::vector<SBenchmark> list;
+	AddVectorBenchmarks<Vec3>("vec3", list);
+	AddVectorBenchmarks<Vec3SIMD>("vec3simd", list);
+	AddShadingBenchmarks(list);
+	AddLightingBenchmarks(list);
+	AddSpanBenchmarks(list);
+	AddSphereBenchmarks(list);
+	AddRasterBenchmarks(list);
+	AddClearBenchmarks(list);
+	AddUpscaleBenchmarks(list);
+	AddSortBenchmarks(list);
+
+	if (opt.szFilter)
+	{
+		list.erase(std::remove_if(list.begin(), list.end(),
+			[&opt](const SBenchmark& b) { return b.name.find(opt.szFilter) == std::string::npos; }),
+			list.end());
+	}
+	if (opt.bList)
+	{
+		for (const SBenchmark& b : list) {
+			printf("%s\n", b.name.c_str());
+		}
+		return 0;
+	}
+
+	printf("%-32s %12s %12s %14s\n", "benchmark", "ns/item", "median", "items/s");
+	std::vector<SBenchResult> results;
+	for (const SBenchmark& b : list)
+	{
+		results.push_back(Measure(b, opt.fMinMs, opt.nRepeats));
+		const SBenchResult& r = results.back();
+		printf("%-32s %12.3f %12.3f %14.0f\n",
+			r.name.c_str(), r.nsMin, r.nsMedian, 1e9 / r.nsMin);
+		fflush(stdout);
+	}
+
+	if (opt.szJson && !WriteJson(opt.szJson, opt, results))
+	{
+		fprintf(stderr, "Can't write '%s'.\n", opt.szJson);
+		return 1;
+	}
+	return 0;
+}
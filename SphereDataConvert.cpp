@@ -0,0 +1,149 @@
+// SphereDataConvert.cpp : Converts a text dataset to the binary sphere
+// file loaded by CSphereData without parsing, or to the chunked file
+// of CSphereStream, and checks the sphere files.
+
+// fopen() is portable, skip MSVC's *_s() advice
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Timer.h"
+#include "Test/SphereData.h"
+#include "Test/SphereFile.h"
+#include "Test/SphereStream.h"
+
+
+//////////////////////////////////////////////////////////////////////////////////
+static void PrintUsage(const char* szExe)
+{
+	printf(
+		"Usage: %s [--no-checksum] input.txt output.spheres\n"
+		"       %s --chunk N input output.stream\n"
+		"       %s --verify file.spheres\n"
+		"  --no-checksum   don't store FNV-1a of the columns\n"
+		"  --chunk N       chunked file for streaming, N spheres per chunk at most\n"
+		"                  (default %u); the input is a text or a .spheres file\n"
+		"  --verify        map the file and check its checksum\n",
+		szExe, szExe, szExe, CSphereStream::DEFAULT_CHUNK_SPHERES);
+}
+
+
+static void PrintHeader(const SSphereFileHeader& header)
+{
+	printf("Spheres:    %llu\n", (unsigned long long)header.count);
+	printf("Bounds:     [%g %g %g] .. [%g %g %g]\n",
+		header.boundsMin[0], header.boundsMin[1], header.boundsMin[2],
+		header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	printf("Radius:     %g .. %g\n", header.radiusMin, header.radiusMax);
+}
+
+
+static int Verify(const char* szFilename)
+{
+	const double t0 = Timer::GetMillisFloat();
+	CSphereFile file;
+	if (!file.Open(szFilename))
+	{
+		fprintf(stderr, "'%s' isn't a sphere file of version %u.\n",
+			szFilename, SSphereFileHeader::VERSION);
+		return 1;
+	}
+	const double t1 = Timer::GetMillisFloat();
+	PrintHeader(file.GetHeader());
+	printf("Map:        %.2f ms\n", t1 - t0);
+
+	if (!(file.GetHeader().flags & SSphereFileHeader::FLAG_CHECKSUM))
+	{
+		printf("Checksum:   none\n");
+		return 0;
+	}
+	const bool ok = file.VerifyChecksum();
+	printf("Checksum:   %s, %.2f ms\n",
+		ok ? "ok" : "MISMATCH", Timer::GetMillisFloat() - t1);
+	return ok ? 0 : 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+	Timer::Init();
+
+	bool checksum = true;
+	unsigned int nChunkSpheres = 0;
+	const char* szVerify = nullptr;
+	const char* files[2] = {};
+	int nFiles = 0;
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		if (!strcmp(arg, "--no-checksum")) {
+			checksum = false;
+		}
+		else if (!strcmp(arg, "--chunk") && i + 1 < argc) {
+			nChunkSpheres = (unsigned int)atoi(argv[++i]);
+			if (nChunkSpheres == 0) {
+				nChunkSpheres = CSphereStream::DEFAULT_CHUNK_SPHERES;
+			}
+		}
+		else if (!strcmp(arg, "--verify") && i + 1 < argc) {
+			szVerify = argv[++i];
+		}
+		else if (arg[0] != '-' && nFiles < 2) {
+			files[nFiles++] = arg;
+		}
+		else
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (szVerify && nFiles == 0) {
+		return Verify(szVerify);
+	}
+	if (szVerify || nFiles != 2)
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	const double t0 = Timer::GetMillisFloat();
+	const CSphereData data(files[0]);
+	const double t1 = Timer::GetMillisFloat();
+	if (data.Size() == 0)
+	{
+		fprintf(stderr, "Can't load spheres from '%s'.\n", files[0]);
+		return 1;
+	}
+	const bool written = nChunkSpheres > 0 ?
+		CSphereStream::Write(files[1], data.GetSpheres(), nChunkSpheres) :
+		CSphereFile::Write(files[1], data.GetSpheres(), checksum);
+	if (!written)
+	{
+		fprintf(stderr, "Can't write '%s'.\n", files[1]);
+		return 1;
+	}
+	const double t2 = Timer::GetMillisFloat();
+
+	PrintHeader(CSphereFile::MakeHeader(data.GetSpheres(), false));
+	printf("Load:       %.2f ms\n", t1 - t0);
+	if (nChunkSpheres > 0)
+	{
+		CSphereStream stream;
+		if (stream.Open(files[1])) {
+			printf("Chunks:     %llu of up to %u spheres\n",
+				(unsigned long long)stream.GetHeader().chunkCount,
+				stream.GetHeader().chunkSpheres);
+		}
+		printf("Write:      %.2f ms\n", t2 - t1);
+	}
+	else {
+		printf("Write:      %.2f ms, %llu bytes\n", t2 - t1,
+			(unsigned long long)CSphereFile::GetFileSize(data.Size()));
+	}
+
+	return 0;
+}
@@ -0,0 +1,212 @@
+// SphereDataGenerate.cpp : Writes a reproducible synthetic scene,
+// from thousands to a hundred million spheres, for scaling benchmarks.
+
+// fopen() is portable, skip MSVC's *_s() advice
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Timer.h"
+#include "Test/SceneGenerator.h"
+#include "Test/SphereData.h"
+#include "Test/SphereFile.h"
+#include "Test/SphereStream.h"
+#include "Test/SphereText.h"
+
+
+//////////////////////////////////////////////////////////////////////////////////
+static void PrintUsage(const char* szExe)
+{
+	const SSceneParams params;
+	printf(
+		"Usage: %s [options] output\n"
+		"  output          .spheres, .txt or a chunked file with --chunk\n"
+		"  --count N       spheres, k and M suffixes (default %zu)\n"
+		"  --dist NAME     uniform, clustered, shell, dense (default %s)\n"
+		"  --seed N        (default %u)\n"
+		"  --extent E      half side of the scene cube (default %g)\n"
+		"  --radius A,B    radius range (default %g,%g)\n"
+		"  --depth D       scale the radii for D spheres per ray\n"
+		"  --clusters N    blobs of clustered (default %d)\n"
+		"  --spread S      size of a blob (default %g)\n"
+		"  --shell T       thickness of shell, part of the extent (default %g)\n"
+		"  --chunk N       chunked file of N spheres per chunk for streaming\n"
+		"All sizes are in scene units, the camera is %g from the center.\n",
+		szExe, params.count, GetSceneDistributionName(params.distribution),
+		params.seed, params.extent, params.radiusMin, params.radiusMax,
+		params.nClusters, params.clusterSpread, params.shellThickness,
+		CSphereData::CAMERA_DISTANCE);
+}
+
+
+//! "250k", "10M" or a number.
+static bool ParseCount(const char* sz, size_t& count)
+{
+	char* end;
+	const double v = strtod(sz, &end);
+	double scale = 1;
+	if (*end == 'k' || *end == 'K') {
+		scale = 1e3;
+		++end;
+	}
+	else if (*end == 'm' || *end == 'M') {
+		scale = 1e6;
+		++end;
+	}
+	if (*end != 0 || !(v > 0)) {
+		return false;
+	}
+	count = (size_t)(v * scale + 0.5);
+	return true;
+}
+
+
+static bool EndsWith(const char* sz, const char* szEnd)
+{
+	const size_t n = strlen(sz);
+	const size_t nEnd = strlen(szEnd);
+	return n >= nEnd && !strcmp(sz + n - nEnd, szEnd);
+}
+
+
+//! \brief Writes the units of the text datasets, every value as the
+//! float it's read back as. LoadSphereText() makes SnapToText() of the
+//! spheres of them.
+static bool WriteText(const char* szFilename, const SSphereView& spheres)
+{
+	FILE* out = fopen(szFilename, "w");
+	if (!out) {
+		return false;
+	}
+
+	fprintf(out, "# x y z r argb\n");
+	bool r = true;
+	for (size_t i = 0; r && i < spheres.size(); ++i)
+	{
+		r = fprintf(out, "%.9g %.9g %.9g %.9g %08x\n",
+			SceneToText(spheres.x[i], 0),
+			SceneToText(spheres.y[i], TEXT_ORIGIN_Y),
+			SceneToText(spheres.z[i], TEXT_ORIGIN_Z),
+			SceneToText(spheres.r[i], 0),
+			spheres.dwARGB[i]) > 0;
+	}
+
+	return (fclose(out) == 0) && r;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+	Timer::Init();
+
+	SSceneParams params;
+	unsigned int nChunkSpheres = 0;
+	const char* szOutput = nullptr;
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool hasValue = (i + 1 < argc);
+		bool ok = true;
+		if (!strcmp(arg, "--count") && hasValue) {
+			ok = ParseCount(argv[++i], params.count);
+		}
+		else if (!strcmp(arg, "--dist") && hasValue) {
+			ok = ParseSceneDistribution(argv[++i], params.distribution);
+		}
+		else if (!strcmp(arg, "--seed") && hasValue) {
+			params.seed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (!strcmp(arg, "--extent") && hasValue) {
+			params.extent = (float)atof(argv[++i]);
+		}
+		else if (!strcmp(arg, "--radius") && hasValue) {
+			ok = sscanf(argv[++i], "%f,%f", &params.radiusMin, &params.radiusMax) == 2;
+		}
+		else if (!strcmp(arg, "--depth") && hasValue) {
+			params.depthComplexity = (float)atof(argv[++i]);
+		}
+		else if (!strcmp(arg, "--clusters") && hasValue) {
+			params.nClusters = atoi(argv[++i]);
+		}
+		else if (!strcmp(arg, "--spread") && hasValue) {
+			params.clusterSpread = (float)atof(argv[++i]);
+		}
+		else if (!strcmp(arg, "--shell") && hasValue) {
+			params.shellThickness = (float)atof(argv[++i]);
+		}
+		else if (!strcmp(arg, "--chunk") && hasValue) {
+			nChunkSpheres = (unsigned int)atoi(argv[++i]);
+			if (nChunkSpheres == 0) {
+				nChunkSpheres = CSphereStream::DEFAULT_CHUNK_SPHERES;
+			}
+		}
+		else if (arg[0] != '-' && !szOutput) {
+			szOutput = arg;
+		}
+		else {
+			ok = false;
+		}
+
+		if (!ok)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (!szOutput)
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	const double t0 = Timer::GetMillisFloat();
+	SSphereColumns spheres;
+	if (!GenerateScene(params, spheres))
+	{
+		fprintf(stderr, "The scene parameters are out of range.\n");
+		PrintUsage(argv[0]);
+		return 1;
+	}
+	const double t1 = Timer::GetMillisFloat();
+
+	// the binary files get the spheres the text file is loaded as
+	const bool bText = (nChunkSpheres == 0 && EndsWith(szOutput, ".txt"));
+	bool written;
+	if (bText) {
+		written = WriteText(szOutput, spheres.View());
+	}
+	SnapToText(spheres);
+	const SSphereView view = spheres.View();
+	if (nChunkSpheres > 0) {
+		written = CSphereStream::Write(szOutput, view, nChunkSpheres);
+	}
+	else if (!bText) {
+		written = CSphereFile::Write(szOutput, view, true);
+	}
+	if (!written)
+	{
+		fprintf(stderr, "Can't write '%s'.\n", szOutput);
+		return 1;
+	}
+	const double t2 = Timer::GetMillisFloat();
+
+	const SSphereFileHeader header = CSphereFile::MakeHeader(view, false);
+	printf("Scene:      %s, seed %u\n",
+		GetSceneDistributionName(params.distribution), params.seed);
+	printf("Spheres:    %llu\n", (unsigned long long)header.count);
+	printf("Bounds:     [%g %g %g] .. [%g %g %g]\n",
+		header.boundsMin[0], header.boundsMin[1], header.boundsMin[2],
+		header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	printf("Radius:     %g .. %g\n", header.radiusMin, header.radiusMax);
+	SSceneParams generated = params;
+	generated.radiusMin = header.radiusMin;
+	generated.radiusMax = header.radiusMax;
+	printf("Depth:      ~%.1f spheres per ray\n", generated.EstimateDepthComplexity());
+	printf("Generate:   %.2f ms\n", t1 - t0);
+	printf("Write:      %.2f ms\n", t2 - t1);
+
+	return 0;
+}
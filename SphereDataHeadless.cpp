@@ -0,0 +1,1126 @@
+// SphereDataHeadless.cpp : Renders a turntable without a window and
+// reports frame and stage timings. The reference for performance changes.
+
+#define _USE_MATH_DEFINES
+// sprintf() and fopen() are portable, skip MSVC's *_s() advice
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "Timer.h"
+#include "Test/SphereData.h"
+#include "Test/FrameBuffer.h"
+#include "Test/FrameCache.h"
+#include "Test/FramePipeline.h"
+#include "Test/QualityController.h"
+#include "Test/FrameTrace.h"
+#include "Test/RayCaster.h"
+#include "Test/SphereStream.h"
+#include "Test/TaskScheduler.h"
+#include "Test/Upscale.h"
+
+
+// Same turntable as the viewer
+static const float INITIAL_ANGLE = M_PI / 3;
+static const float ANGLE_AUTO_ROTATION = 0.05f;
+static const int NUM_FRAMES = 126;
+static const int NUM_WARMUP_FRAMES = 3;
+static const int FRAME_SIZE = 1024;
+
+
+//////////////////////////////////////////////////////////////////////////////////
+struct SOptions
+{
+	const char* szDataset = "sphere_sample_points.txt";
+	const char* szDump = nullptr;
+	//! Fields of a text dataset, detected when not set.
+	const char* szColumns = nullptr;
+	int nFrames = NUM_FRAMES;
+	int nWarmupFrames = NUM_WARMUP_FRAMES;
+	int iWidth = FRAME_SIZE;
+	int iHeight = FRAME_SIZE;
+	int iTileSize = CFrameBuffer::DEFAULT_TILE_SIZE;
+	bool bHiZ = true;
+	bool bImpostors = true;
+	bool bDeferred = false;
+	//! Pixel of the last frame to pick a sphere at, -1 is off.
+	int iPickX = -1;
+	int iPickY = -1;
+	float fSplatRadius = CFrameBuffer::DEFAULT_SPLAT_RADIUS;
+	//! Best one for the CPU when not set.
+	const char* szKernelISA = nullptr;
+	EShadingModel shading = EShadingModel::Phong;
+	//! --shading is given.
+	bool bShading = false;
+	//! CLighting::MakeRig() of the lights model, -1 is not given.
+	int nLights = -1;
+	float fAmbient = CLighting::DEFAULT_AMBIENT;
+	float fShininess = CLighting::DEFAULT_SHININESS;
+	ESpecularPow specularPow = ESpecularPow::Fast;
+	//! --lights, --ambient, --shininess or --specular is given.
+	bool bLighting = false;
+	EDepthSort depthSort = EDepthSort::Sort;
+	ERenderEngine engine = ERenderEngine::Raster;
+	int nTurntableSectors = CSphereData::DEFAULT_TURNTABLE_SECTORS;
+	//! Frames in flight of CFramePipeline, 0 runs the stages in turn.
+	int nPipelineDepth = 0;
+	//! Budget of CFrameCache, MB, 0 is off.
+	int nFrameCache = 0;
+	//! Frame time of CQualityController, ms, 0 is off.
+	float fTargetMs = 0;
+	//! Chrome trace events and CSV of the measured frames.
+	const char* szTrace = nullptr;
+	const char* szTraceCsv = nullptr;
+	//! Threads of CTaskScheduler, 0 is one per core.
+	int nThreads = 0;
+	bool bAffinity = false;
+	//! Chunk slots of a chunked file, MB.
+	int nStreamBudget = (int)(CSphereStream::DEFAULT_MEMORY_BUDGET >> 20);
+	float fStartAngle = INITIAL_ANGLE;
+	float fAngleStep = ANGLE_AUTO_ROTATION;
+};
+
+
+//! Durations of one frame, ms.
+struct SFrameTimes
+{
+	double clear;
+	double transform;
+	double sort;
+	double rasterize;
+	double total;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////////
+static void PrintUsage(const char* szExe)
+{
+	printf(
+		"Usage: %s [options] [dataset]\n"
+		"  dataset         text, .spheres or chunked file of SphereDataConvert\n"
+		"  --columns LIST  fields of a text line, e.g. x,y,z,r,argb (default by count)\n"
+		"  --frames N      frames to measure (default %d)\n"
+		"  --warmup N      frames rendered before measuring (default %d)\n"
+		"  --size WxH      frame buffer size (default %dx%d)\n"
+		"  --tile N        screen tile size, pixels (default %d)\n"
+		"  --no-hiz        disable hierarchical Z culling\n"
+		"  --no-impostors  compute depth and normals per pixel\n"
+		"  --deferred      visibility buffer, then every visible pixel shaded once\n"
+		"  --pick X,Y      print the sphere at the pixel of the last deferred frame,\n"
+		"                  with --deferred, not with --pipeline or a chunked file\n"
+		"  --splat R       draw spheres below R pixels as splats, 0 is off (default %.1f)\n"
+		"  --isa NAME      span kernel: scalar, sse4.1, avx2 (default best)\n"
+		"  --shading NAME  direct, lambert, phong, blinn-phong, lights (default phong)\n"
+		"  --lights N      shading by N lights, up to %d (default 1), the lights\n"
+		"                  model when --shading isn't given\n"
+		"  --ambient A     ambient of the lights (default %.2f)\n"
+		"  --shininess S   specular power of the lights (default %.0f)\n"
+		"  --specular NAME power of the lights: exact, fast, table (default fast)\n"
+		"  --sort MODE     depth order: full, turntable, clusters, radix,\n"
+		"                  bucket, none (default full)\n"
+		"  --sectors N     turntable orders per half turn (default %d)\n"
+		"  --engine NAME   hidden surfaces: raster, raycast (default raster),\n"
+		"                  raycast shades by phong with the default light\n"
+		"  --budget MB     chunk memory of a chunked file (default %d)\n"
+		"  --pipeline N    overlap the stages of N frames, 0 is off (default 0)\n"
+		"  --frame-cache MB  decode the frames of the angles drawn before, 0 is off,\n"
+		"                  not with --pipeline or a chunked file\n"
+		"  --target-ms MS  lower the render size to hold the frame time, 0 is off,\n"
+		"                  not with --pipeline or a chunked file\n"
+		"  --threads N     threads of the task scheduler, 0 is one per core (default 0)\n"
+		"  --affinity      pin the scheduler threads to cores\n"
+		"  --start A       initial angle, radians (default %.4f)\n"
+		"  --step A        angle step per frame, radians (default %.4f)\n"
+		"  --dump FILE     save the last frame as binary PPM\n"
+		"  --trace FILE    save zones and counters as Chrome trace JSON\n"
+		"  --trace-csv FILE  save zone times and counters per frame as CSV\n",
+		szExe, NUM_FRAMES, NUM_WARMUP_FRAMES, FRAME_SIZE, FRAME_SIZE,
+		CFrameBuffer::DEFAULT_TILE_SIZE, CFrameBuffer::DEFAULT_SPLAT_RADIUS,
+		SLightSet::MAX_LIGHTS, CLighting::DEFAULT_AMBIENT, CLighting::DEFAULT_SHININESS,
+		CSphereData::DEFAULT_TURNTABLE_SECTORS,
+		(int)(CSphereStream::DEFAULT_MEMORY_BUDGET >> 20),
+		INITIAL_ANGLE, ANGLE_AUTO_ROTATION);
+}
+
+
+static bool ParseOptions(int argc, char* argv[], SOptions& opt)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool hasValue = (i + 1 < argc);
+		if (!strcmp(arg, "--columns") && hasValue) {
+			opt.szColumns = argv[++i];
+		}
+		else if (!strcmp(arg, "--frames") && hasValue) {
+			opt.nFrames = atoi(argv[++i]);
+		}
+		else if (!strcmp(arg, "--warmup") && hasValue) {
+			opt.nWarmupFrames = atoi(argv[++i]);
+		}
+		else if (!strcmp(arg, "--size") && hasValue) {
+			if (sscanf(argv[++i], "%dx%d", &opt.iWidth, &opt.iHeight) != 2) {
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--tile") && hasValue) {
+			opt.iTileSize = atoi(argv[++i]);
+		}
+		else if (!strcmp(arg, "--no-hiz")) {
+			opt.bHiZ = false;
+		}
+		else if (!strcmp(arg, "--no-impostors")) {
+			opt.bImpostors = false;
+		}
+		else if (!strcmp(arg, "--deferred")) {
+			opt.bDeferred = true;
+		}
+		else if (!strcmp(arg, "--pick") && hasValue) {
+			if (sscanf(argv[++i], "%d,%d", &opt.iPickX, &opt.iPickY) != 2) {
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--splat") && hasValue) {
+			opt.fSplatRadius = (float)atof(argv[++i]);
+		}
+		else if (!strcmp(arg, "--isa") && hasValue) {
+			opt.szKernelISA = argv[++i];
+		}
+		else if (!strcmp(arg, "--shading") && hasValue) {
+			const char* v = argv[++i];
+			bool bFound = false;
+			for (const EShadingModel model : { EShadingModel::Direct, EShadingModel::Lambert,
+				EShadingModel::Phong, EShadingModel::BlinnPhong, EShadingModel::Lights })
+			{
+				if (!strcmp(v, GetShadingModelName(model)))
+				{
+					opt.shading = model;
+					opt.bShading = true;
+					bFound = true;
+				}
+			}
+			if (!bFound) {
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--lights") && hasValue) {
+			opt.nLights = atoi(argv[++i]);
+			opt.bLighting = true;
+			if (opt.nLights < 0) {
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--ambient") && hasValue) {
+			opt.fAmbient = (float)atof(argv[++i]);
+			opt.bLighting = true;
+		}
+		else if (!strcmp(arg, "--shininess") && hasValue) {
+			opt.fShininess = (float)atof(argv[++i]);
+			opt.bLighting = true;
+		}
+		else if (!strcmp(arg, "--specular") && hasValue) {
+			const char* v = argv[++i];
+			opt.bLighting = true;
+			if (!strcmp(v, "exact")) {
+				opt.specularPow = ESpecularPow::Exact;
+			}
+			else if (!strcmp(v, "fast")) {
+				opt.specularPow = ESpecularPow::Fast;
+			}
+			else if (!strcmp(v, "table")) {
+				opt.specularPow = ESpecularPow::Table;
+			}
+			else {
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--sort") && hasValue) {
+			const char* v = argv[++i];
+			if (!strcmp(v, "full")) {
+				opt.depthSort = EDepthSort::Sort;
+			}
+			else if (!strcmp(v, "turntable")) {
+				opt.depthSort = EDepthSort::Turntable;
+			}
+			else if (!strcmp(v, "clusters")) {
+				opt.depthSort = EDepthSort::Clusters;
+			}
+			else if (!strcmp(v, "radix")) {
+				opt.depthSort = EDepthSort::Radix;
+			}
+			else if (!strcmp(v, "bucket")) {
+				opt.depthSort = EDepthSort::Bucket;
+			}
+			else if (!strcmp(v, "none")) {
+				opt.depthSort = EDepthSort::None;
+			}
+			else {
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--engine") && hasValue) {
+			const char* v = argv[++i];
+			if (!strcmp(v, "raster")) {
+				opt.engine = ERenderEngine::Raster;
+			}
+			else if (!strcmp(v, "raycast")) {
+				opt.engine = ERenderEngine::RayCast;
+			}
+			else {
+				return false;
+			}
+		}
+		else if (!strcmp(arg, "--sectors") && hasValue) {
+			opt.nTurntableSectors = atoi(argv[++i]);
+		}
+		else if (!strcmp(arg, "--pipeline") && hasValue) {
+			opt.nPipelineDepth = atoi(argv[++i]);
+		}
+		else if (!strcmp(arg, "--frame-cache") && hasValue) {
+			opt.nFrameCache = atoi(argv[++i]);
+		}
+		else if (!strcmp(arg, "--target-ms") && hasValue) {
+			opt.fTargetMs = (float)atof(argv[++i]);
+		}
+		else if (!strcmp(arg, "--threads") && hasValue) {
+			opt.nThreads = atoi(argv[++i]);
+		}
+		else if (!strcmp(arg, "--affinity")) {
+			opt.bAffinity = true;
+		}
+		else if (!strcmp(arg, "--budget") && hasValue) {
+			opt.nStreamBudget = atoi(argv[++i]);
+		}
+		else if (!strcmp(arg, "--start") && hasValue) {
+			opt.fStartAngle = (float)atof(argv[++i]);
+		}
+		else if (!strcmp(arg, "--step") && hasValue) {
+			opt.fAngleStep = (float)atof(argv[++i]);
+		}
+		else if (!strcmp(arg, "--dump") && hasValue) {
+			opt.szDump = argv[++i];
+		}
+		else if (!strcmp(arg, "--trace") && hasValue) {
+			opt.szTrace = argv[++i];
+		}
+		else if (!strcmp(arg, "--trace-csv") && hasValue) {
+			opt.szTraceCsv = argv[++i];
+		}
+		else if (arg[0] == '-') {
+			return false;
+		}
+		else {
+			opt.szDataset = arg;
+		}
+	}
+
+	// --lights picks the lights model unless another one is asked for
+	if (opt.nLights >= 0)
+	{
+		if (opt.bShading && opt.shading != EShadingModel::Lights)
+		{
+			fprintf(stderr, "--lights needs --shading lights, not '%s'.\n",
+				GetShadingModelName(opt.shading));
+			return false;
+		}
+		opt.shading = EShadingModel::Lights;
+	}
+
+	return opt.nFrames > 0 && opt.nWarmupFrames >= 0 &&
+		opt.iWidth > 0 && opt.iHeight > 0 && opt.nStreamBudget >= 0 &&
+		opt.nPipelineDepth >= 0 &&
+		// the pipeline passes render lists of the raster
+		(opt.engine == ERenderEngine::Raster || opt.nPipelineDepth == 0);
+}
+
+
+//! Nearest-rank percentile.
+//! \param sorted Ascending values, not empty.
+static double Percentile(const std::vector<double>& sorted, double p)
+{
+	const size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+	return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+
+static void PrintStage(const char* szName, std::vector<double> times)
+{
+	std::sort(times.begin(), times.end());
+	double sum = 0;
+	for (const double t : times) {
+		sum += t;
+	}
+	printf("  %-10s avg %8.3f  p50 %8.3f  p95 %8.3f  p99 %8.3f  max %8.3f\n",
+		szName,
+		sum / times.size(),
+		Percentile(times, 50),
+		Percentile(times, 95),
+		Percentile(times, 99),
+		times.back());
+}
+
+
+//! FNV-1a over the pixels, used to compare an output between builds.
+static unsigned long long HashPixels(
+	const CFrameBuffer::color_t* p, size_t size, unsigned long long hash)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= p[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+
+static unsigned long long HashFrame(
+	const CFrameBuffer& fb, unsigned long long hash)
+{
+	return HashPixels(fb.GetFrameBuffer(), (size_t)fb.GetWidth() * fb.GetHeight(), hash);
+}
+
+
+static bool DumpFrame(
+	const CFrameBuffer::color_t* p, int iWidth, int iHeight, const char* szFilename)
+{
+	FILE* out = fopen(szFilename, "wb");
+	if (!out) {
+		return false;
+	}
+
+	fprintf(out, "P6\n%d %d\n255\n", iWidth, iHeight);
+	std::vector<unsigned char> row(iWidth * 3);
+	for (int y = 0; y < iHeight; ++y)
+	{
+		for (int x = 0; x < iWidth; ++x)
+		{
+			const CFrameBuffer::color_t color = p[x + y * iWidth];
+			row[x * 3 + 0] = (color >> 16) & 0xFF;
+			row[x * 3 + 1] = (color >> 8) & 0xFF;
+			row[x * 3 + 2] = (color >> 0) & 0xFF;
+		}
+		fwrite(std::data(row), 1, row.size(), out);
+	}
+
+	fclose(out);
+	return true;
+}
+
+
+static bool SetupFrameBuffer(const SOptions& opt, CFrameBuffer& fb)
+{
+	fb.EnableHiZ(opt.bHiZ);
+	fb.EnableImpostors(opt.bImpostors);
+	fb.EnableDeferred(opt.bDeferred);
+	fb.SetSplatRadius(opt.fSplatRadius);
+	fb.SetShadingModel(opt.shading);
+	CLighting lighting = CLighting::MakeRig((opt.nLights >= 0) ? opt.nLights : 1);
+	lighting.SetAmbient(opt.fAmbient);
+	lighting.SetShininess(opt.fShininess);
+	lighting.SetSpecularPow(opt.specularPow);
+	fb.SetLighting(lighting);
+	if (!opt.szKernelISA) {
+		return true;
+	}
+	for (const EKernelISA isa :
+		{ EKernelISA::Scalar, EKernelISA::SSE41, EKernelISA::AVX2 })
+	{
+		if (!strcmp(opt.szKernelISA, GetKernelISAName(isa)))
+		{
+			if (!fb.SetKernelISA(isa))
+			{
+				fprintf(stderr, "The CPU doesn't support '%s'.\n", opt.szKernelISA);
+				return false;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+
+static void PrintThreads()
+{
+	const CTaskScheduler& scheduler = CTaskScheduler::Get();
+	printf("Threads:    %d%s\n", scheduler.GetThreadCount(),
+		scheduler.IsAffinityEnabled() ? ", pinned" : "");
+}
+
+
+static void PrintLighting(const CFrameBuffer& fb)
+{
+	if (fb.GetShadingModel() != EShadingModel::Lights) {
+		return;
+	}
+	const CLighting& lighting = fb.GetLighting();
+	printf("Lights:     %d, ambient %.2f, shininess %.1f, %s power, error %.2e\n",
+		lighting.GetLightCount(), lighting.GetAmbient(), lighting.GetShininess(),
+		CLighting::GetSpecularPowName(lighting.GetSpecularPow()),
+		lighting.MeasureSpecularError());
+}
+
+
+//! Prints the measured frames and saves the last one.
+//! \return Exit code.
+//! \param pLastFrame Pixels of the last frame, of the size of the options,
+//!        when not of the frame buffer.
+static int Report(
+	const SOptions& opt,
+	const CFrameBuffer& fb,
+	const std::vector<SFrameTimes>& frames,
+	const CFrameBuffer::SRasterStats& stats,
+	unsigned long long hash,
+	double tWall,
+	const CFrameBuffer::color_t* pLastFrame = nullptr)
+{
+	const auto Column = [&frames](double SFrameTimes::* field) {
+		std::vector<double> r;
+		r.reserve(frames.size());
+		for (const auto& ft : frames) {
+			r.push_back(ft.*field);
+		}
+		return r;
+	};
+
+	printf("Wall time:  %.2f ms, %.1f FPS\n",
+		tWall, frames.size() * 1000.0 / tWall);
+	printf("Stages, ms:\n");
+	PrintStage("frame", Column(&SFrameTimes::total));
+	PrintStage("clear", Column(&SFrameTimes::clear));
+	PrintStage("transform", Column(&SFrameTimes::transform));
+	PrintStage("sort", Column(&SFrameTimes::sort));
+	PrintStage("rasterize", Column(&SFrameTimes::rasterize));
+
+	const double perFrame = 1.0 / frames.size();
+	printf("Raster per frame%s:\n", opt.bHiZ ? "" : " (Hi-Z off)");
+	printf("  spheres %.0f, culled %.0f (%.1f%%)\n",
+		stats.spheres * perFrame,
+		stats.spheresCulled * perFrame,
+		100.0 * stats.spheresCulled / std::max<size_t>(stats.spheres, 1));
+	printf("  splats %.0f (radius < %.2f px)\n",
+		stats.spheresSplatted * perFrame,
+		fb.GetSplatRadius());
+	printf("  blocks culled %.0f, pixels culled %.0f\n",
+		stats.blocksCulled * perFrame,
+		stats.pixelsCulled * perFrame);
+	printf("  pixels tested %.0f, written %.0f\n",
+		stats.pixelsTested * perFrame,
+		stats.pixelsWritten * perFrame);
+	if (opt.bImpostors) {
+		printf("Impostors:  %d, %.1f KB of %.1f KB\n",
+			fb.GetImpostors().Size(),
+			fb.GetImpostors().GetMemoryUsed() / 1024.0,
+			fb.GetImpostors().GetMemoryBudget() / 1024.0);
+	}
+	const CTaskScheduler::SSchedulerStats tasks = CTaskScheduler::Get().GetStats();
+	printf("Scheduler per frame:\n");
+	printf("  loops %.0f, alone on the caller %.0f, chunks %.0f, steals %.0f\n",
+		tasks.loops * perFrame,
+		tasks.inlineLoops * perFrame,
+		tasks.chunks * perFrame,
+		tasks.steals * perFrame);
+	printf("Image hash: %016llx\n", hash);
+
+	if (opt.szDump && !DumpFrame(pLastFrame ? pLastFrame : fb.GetFrameBuffer(),
+		opt.iWidth, opt.iHeight, opt.szDump))
+	{
+		fprintf(stderr, "Can't write '%s'.\n", opt.szDump);
+		return 1;
+	}
+
+	const CFrameTrace& trace = CFrameTrace::Get();
+	if (opt.szTrace || opt.szTraceCsv)
+	{
+		printf("Trace:      %zu frames, %zu zones dropped\n",
+			trace.GetFrameCount(), trace.GetDroppedZones());
+	}
+	if (opt.szTrace && !trace.WriteChromeTrace(opt.szTrace))
+	{
+		fprintf(stderr, "Can't write '%s'.\n", opt.szTrace);
+		return 1;
+	}
+	if (opt.szTraceCsv && !trace.WriteCsv(opt.szTraceCsv))
+	{
+		fprintf(stderr, "Can't write '%s'.\n", opt.szTraceCsv);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+//! Renders a chunked file by CSphereStream, the stages are in rasterize.
+//! \return Exit code.
+static int RunStream(const SOptions& opt, CFrameBuffer& fb)
+{
+	CSphereStream stream;
+	if (!stream.Open(opt.szDataset, (size_t)opt.nStreamBudget << 20))
+	{
+		fprintf(stderr, "Can't open the chunked file '%s'.\n", opt.szDataset);
+		return 1;
+	}
+
+	const SSphereStreamHeader& header = stream.GetHeader();
+	printf("Dataset:    %s, chunked\n", opt.szDataset);
+	printf("Spheres:    %llu\n", (unsigned long long)header.spheres.count);
+	printf("Chunks:     %llu of up to %u spheres, %d slots, %.1f MB used\n",
+		(unsigned long long)header.chunkCount, header.chunkSpheres,
+		stream.GetSlotCount(), stream.GetMemoryUsed() / (1024.0 * 1024.0));
+	printf("Frame:      %dx%d, tiles %dx%d\n", opt.iWidth, opt.iHeight,
+		fb.GetTileSize(), fb.GetTileSize());
+	printf("Kernel:     %s, %s%s\n", GetKernelISAName(fb.GetKernelISA()),
+		GetShadingModelName(fb.GetShadingModel()),
+		fb.IsDeferredEnabled() ? ", deferred" : "");
+	PrintLighting(fb);
+	PrintThreads();
+	printf("Angles:     %d frames (+%d warmup), start %.4f, step %.4f\n",
+		opt.nFrames, opt.nWarmupFrames, opt.fStartAngle, opt.fAngleStep);
+
+	std::vector<SFrameTimes> frames;
+	frames.reserve(opt.nFrames);
+	unsigned long long hash = 14695981039346656037ull;
+	CFrameBuffer::SRasterStats stats = {};
+	size_t chunksVisible = 0;
+	size_t bytesRead = 0;
+	double tWait = 0;
+
+	float wi = opt.fStartAngle;
+	double tWall0 = 0;
+	double tHash = 0;
+	for (int n = -opt.nWarmupFrames; n < opt.nFrames; ++n)
+	{
+		if (n == 0) {
+			tWall0 = Timer::GetMillisFloat();
+			CTaskScheduler::Get().ResetStats();
+			CFrameTrace::Get().Clear();
+		}
+		CFrameTrace::Get().BeginFrame();
+
+		SFrameTimes ft = {};
+		const double t0 = Timer::GetMillisFloat();
+		fb.Clear();
+		const double t1 = Timer::GetMillisFloat();
+		if (!stream.Render(fb, wi))
+		{
+			fprintf(stderr, "Can't read a chunk of '%s'.\n", opt.szDataset);
+			return 1;
+		}
+		const double t2 = Timer::GetMillisFloat();
+		CFrameTrace::Get().EndFrame();
+		ft.clear = t1 - t0;
+		ft.rasterize = t2 - t1;
+		ft.total = t2 - t0;
+
+		if (n >= 0)
+		{
+			frames.push_back(ft);
+			const CSphereStream::SStreamStats& ss = stream.GetStats();
+			stats += ss.raster;
+			chunksVisible += ss.chunksVisible;
+			bytesRead += ss.bytesRead;
+			tWait += ss.waitMs;
+			CFrameTrace::Get().RasterCounters(fb, ss.raster);
+			hash = HashFrame(fb, hash);
+			tHash += Timer::GetMillisFloat() - t2;
+		}
+
+		wi += opt.fAngleStep;
+		if (wi >= 2 * M_PI) {
+			wi = 0;
+		}
+	}
+	const double tWall = Timer::GetMillisFloat() - tWall0 - tHash;
+
+	const double perFrame = 1.0 / frames.size();
+	printf("Streaming per frame: %.1f chunks, %.1f MB read, waited %.3f ms\n",
+		chunksVisible * perFrame,
+		bytesRead * perFrame / (1024.0 * 1024.0),
+		tWait * perFrame);
+	return Report(opt, fb, frames, stats, hash, tWall);
+}
+
+
+//! \brief Renders the turntable by CFramePipeline, frames overlap.
+//! Frame time is the latency from the submit to the end of the raster.
+//! \return Exit code.
+static int RunPipeline(const SOptions& opt, CSphereData& data)
+{
+	CFramePipeline pipeline(
+		data, opt.iWidth, opt.iHeight, opt.iTileSize, opt.nPipelineDepth);
+	for (int slot = 0; slot < pipeline.GetDepth(); ++slot)
+	{
+		if (!SetupFrameBuffer(opt, pipeline.GetFrameBuffer(slot))) {
+			return 1;
+		}
+	}
+	printf("Pipeline:   %d frames in flight\n", pipeline.GetDepth());
+
+	std::vector<SFrameTimes> frames;
+	frames.reserve(opt.nFrames);
+	unsigned long long hash = 14695981039346656037ull;
+	CFrameBuffer::SRasterStats stats = {};
+
+	float wi = opt.fStartAngle;
+	int nSubmitted = 0;
+	const int nTotal = opt.nWarmupFrames + opt.nFrames;
+	double tWall0 = Timer::GetMillisFloat();
+	double tHash = 0;
+	// the last frame stays held for the report
+	int slot = -1;
+	for (int n = -opt.nWarmupFrames; n < opt.nFrames; ++n)
+	{
+		if (slot >= 0) {
+			pipeline.Release(slot);
+		}
+		CFrameTrace::Get().BeginFrame();
+		while (nSubmitted < nTotal && pipeline.GetInFlight() < pipeline.GetDepth())
+		{
+			pipeline.Submit(wi);
+			++nSubmitted;
+			wi += opt.fAngleStep;
+			if (wi >= 2 * M_PI) {
+				wi = 0;
+			}
+		}
+
+		SPipelineFrame frame;
+		slot = pipeline.Acquire(&frame);
+		CFrameTrace::Get().AddFrameZones(frame.traceFrame);
+		CFrameTrace::Get().EndFrame();
+		const double t0 = Timer::GetMillisFloat();
+		if (n == -1) {
+			tWall0 = t0;
+			CTaskScheduler::Get().ResetStats();
+			CFrameTrace::Get().Clear();
+		}
+		if (n >= 0)
+		{
+			SFrameTimes ft;
+			ft.clear = frame.clear;
+			ft.transform = frame.transform;
+			ft.sort = frame.sort;
+			ft.rasterize = frame.project + frame.rasterize;
+			ft.total = frame.latency;
+			frames.push_back(ft);
+
+			const CFrameBuffer& fb = pipeline.GetFrameBuffer(slot);
+			stats += fb.GetStats();
+			CFrameTrace::Get().RasterCounters(fb, fb.GetStats());
+			hash = HashFrame(fb, hash);
+			tHash += Timer::GetMillisFloat() - t0;
+		}
+	}
+	const double tWall = Timer::GetMillisFloat() - tWall0 - tHash;
+
+	return Report(opt, pipeline.GetFrameBuffer(slot), frames, stats, hash, tWall);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////
+//! \brief Frame cache and quality control of the frames in turn,
+//!        see DrawFrame().
+struct SFrameControl
+{
+	//! Frames of the angles drawn before, decoded instead.
+	std::unique_ptr<CFrameCache> cache;
+	std::vector<CFrameBuffer::color_t> cachedFrame;
+	//! Shrinks the frame buffer to hold the target, the output is
+	//! scaled up to outFrame.
+	std::unique_ptr<CQualityController> quality;
+	std::vector<CFrameBuffer::color_t> outFrame;
+	std::vector<int> levelFrames;
+
+	//! Output of the last DrawFrame(), of the size of the options.
+	const CFrameBuffer::color_t* pixels = nullptr;
+	//! The last frame is of the cache, not of the frame buffer.
+	bool bCached = false;
+};
+
+
+static void InitFrameControl(const SOptions& opt, SFrameControl& control)
+{
+	if (opt.nFrameCache > 0)
+	{
+		control.cache = std::make_unique<CFrameCache>((size_t)opt.nFrameCache << 20);
+		control.cachedFrame.resize((size_t)opt.iWidth * opt.iHeight);
+	}
+	if (opt.fTargetMs > 0)
+	{
+		control.quality = std::make_unique<CQualityController>(opt.fTargetMs);
+		control.outFrame.resize((size_t)opt.iWidth * opt.iHeight);
+		control.levelFrames.resize(CQualityController::GetLevelCount());
+	}
+}
+
+
+//! \brief Draws the frame of the angle at the size of the quality, or
+//!        decodes it from the cache, then scales it up to the output.
+static void DrawFrame(
+	const SOptions& opt,
+	CSphereData& data,
+	CFrameBuffer& fb,
+	float wi,
+	SFrameControl& control,
+	SFrameTimes& ft)
+{
+	if (control.quality)
+	{
+		int iWidth, iHeight;
+		control.quality->GetRenderSize(opt.iWidth, opt.iHeight, iWidth, iHeight);
+		if (iWidth != fb.GetWidth() || iHeight != fb.GetHeight())
+		{
+			fb.Resize(iWidth, iHeight);
+			fb.SetSplatRadius(control.quality->GetSplatRadius(opt.fSplatRadius));
+		}
+	}
+
+	ft = {};
+	const double t0 = Timer::GetMillisFloat();
+	int y0, y1;
+	control.bCached = control.cache && control.cache->Find(
+		wi, fb.GetWidth(), fb.GetHeight(), std::data(control.cachedFrame), y0, y1);
+	control.pixels = control.bCached ? std::data(control.cachedFrame) : fb.GetFrameBuffer();
+	if (!control.bCached)
+	{
+		fb.Clear();
+		const double t1 = Timer::GetMillisFloat();
+		data.Transform(wi);
+		const double t2 = Timer::GetMillisFloat();
+		data.Sort();
+		const double t3 = Timer::GetMillisFloat();
+		data.Rasterize(fb, wi);
+		const double t4 = Timer::GetMillisFloat();
+		if (control.cache) {
+			control.cache->Insert(wi, fb);
+		}
+		fb.GetDrawnRows(y0, y1);
+		ft.clear = t1 - t0;
+		ft.transform = t2 - t1;
+		ft.sort = t3 - t2;
+		ft.rasterize = t4 - t3;
+	}
+	if (fb.GetWidth() != opt.iWidth || fb.GetHeight() != opt.iHeight)
+	{
+		UpscaleFrame(control.pixels, fb.GetWidth(), fb.GetHeight(), y0, y1,
+			std::data(control.outFrame), opt.iWidth, opt.iHeight, y0, y1);
+		control.pixels = std::data(control.outFrame);
+	}
+	ft.total = Timer::GetMillisFloat() - t0;
+}
+
+
+//! \brief Prints the sphere at the pick pixel of the last frame.
+//! A frame of the cache or of a smaller size has no keys of its own
+//! in the frame buffer, the angle is drawn anew at the output size.
+static void PrintPick(
+	const SOptions& opt,
+	CSphereData& data,
+	CFrameBuffer& fb,
+	float wi,
+	const SFrameControl& control)
+{
+	if (control.pixels != fb.GetFrameBuffer())
+	{
+		fb.Resize(opt.iWidth, opt.iHeight);
+		fb.SetSplatRadius(opt.fSplatRadius);
+		fb.Clear();
+		data.Transform(wi);
+		data.Sort();
+		data.Rasterize(fb, wi);
+	}
+
+	const unsigned int sphere = data.PickSphere(fb, opt.iPickX, opt.iPickY);
+	if (sphere == CSphereData::NO_SPHERE) {
+		printf("Pick:       (%d, %d) no sphere\n", opt.iPickX, opt.iPickY);
+	}
+	else {
+		const SSphereView& spheres = data.GetSpheres();
+		printf("Pick:       (%d, %d) sphere %u at [%g %g %g] r %g, %08x\n",
+			opt.iPickX, opt.iPickY, sphere,
+			spheres.x[sphere], spheres.y[sphere], spheres.z[sphere],
+			spheres.r[sphere], spheres.dwARGB[sphere]);
+	}
+}
+
+
+static void PrintFrameControl(const SFrameControl& control)
+{
+	if (control.cache)
+	{
+		const CFrameCache& cache = *control.cache;
+		const CFrameCache::SCacheStats& cs = cache.GetStats();
+		printf("Frame cache: %zu hits, %zu misses, %zu evicted, %zu frames, "
+			"%.1f MB of %.1f MB, coded to %.1f%%\n",
+			cs.hits, cs.misses, cs.evictions, cache.Size(),
+			cache.GetMemoryUsed() / (1024.0 * 1024.0),
+			cache.GetMemoryBudget() / (1024.0 * 1024.0),
+			100.0 * cs.bytesCoded / std::max<size_t>(cs.bytesRaw, 1));
+	}
+	if (control.quality)
+	{
+		const CQualityController& quality = *control.quality;
+		printf("Quality:    target %.2f ms, %zu changes, frames by level:",
+			quality.GetTarget(), quality.GetChanges());
+		for (int level = 0; level < CQualityController::GetLevelCount(); ++level) {
+			printf(" %.3f %d%s", CQualityController::GetQuality(level).scale,
+				control.levelFrames[level],
+				level + 1 < CQualityController::GetLevelCount() ? "," : "\n");
+		}
+	}
+}
+
+
+//! \brief Renders the turntable of the loaded spheres, a frame at a time.
+//! \return Exit code.
+static int RunFrames(const SOptions& opt, CSphereData& data, CFrameBuffer& fb)
+{
+	std::vector<SFrameTimes> frames;
+	frames.reserve(opt.nFrames);
+	unsigned long long hash = 14695981039346656037ull;
+	CFrameBuffer::SRasterStats stats = {};
+	CRayCaster::SRayStats rayStats = {};
+	SFrameControl control;
+	InitFrameControl(opt, control);
+
+	float wi = opt.fStartAngle;
+	float wiLast = wi;
+	double tWall0 = 0;
+	// time out of the measurement, ms
+	double tHash = 0;
+	for (int n = -opt.nWarmupFrames; n < opt.nFrames; ++n)
+	{
+		if (n == 0) {
+			tWall0 = Timer::GetMillisFloat();
+			CTaskScheduler::Get().ResetStats();
+			CFrameTrace::Get().Clear();
+			if (control.cache) {
+				control.cache->ResetStats();
+			}
+		}
+		CFrameTrace::Get().BeginFrame();
+		SFrameTimes ft;
+		DrawFrame(opt, data, fb, wi, control, ft);
+		const double tEnd = Timer::GetMillisFloat();
+		CFrameTrace::Get().EndFrame();
+
+		if (n >= 0)
+		{
+			frames.push_back(ft);
+			if (!control.bCached)
+			{
+				stats += fb.GetStats();
+				if (opt.engine == ERenderEngine::RayCast) {
+					rayStats += data.GetRayCaster()->GetStats();
+				}
+				CFrameTrace::Get().RasterCounters(fb, fb.GetStats());
+			}
+			if (control.quality) {
+				++control.levelFrames[control.quality->GetLevel()];
+			}
+			hash = HashPixels(control.pixels, (size_t)opt.iWidth * opt.iHeight, hash);
+			tHash += Timer::GetMillisFloat() - tEnd;
+		}
+		if (control.quality) {
+			control.quality->AddFrame(ft.total);
+		}
+
+		wiLast = wi;
+		wi += opt.fAngleStep;
+		if (wi >= 2 * M_PI) {
+			wi = 0;
+		}
+	}
+	const double tWall = Timer::GetMillisFloat() - tWall0 - tHash;
+
+	if (opt.engine == ERenderEngine::RayCast)
+	{
+		const double perFrame = 1.0 / frames.size();
+		printf("Rays per frame:\n");
+		printf("  rays %.0f, hits %.0f\n",
+			rayStats.rays * perFrame,
+			rayStats.hits * perFrame);
+		printf("  packet tests: nodes %.0f, spheres %.0f\n",
+			rayStats.nodeTests * perFrame,
+			rayStats.sphereTests * perFrame);
+	}
+	// the output of the measured frame is saved before a pick draws anew
+	const CFrameBuffer::color_t* pLastFrame =
+		(control.pixels != fb.GetFrameBuffer()) ? control.pixels : nullptr;
+	PrintFrameControl(control);
+	const int result = Report(opt, fb, frames, stats, hash, tWall, pLastFrame);
+	if (result == 0 && opt.iPickX >= 0) {
+		PrintPick(opt, data, fb, wiLast, control);
+	}
+	return result;
+}
+
+
+int main(int argc, char* argv[])
+{
+	SOptions opt;
+	if (!ParseOptions(argc, argv, opt))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	Timer::Init();
+
+	if (opt.szTrace || opt.szTraceCsv)
+	{
+		TRACE_THREAD_NAME("main");
+		CFrameTrace::Get().Enable(true);
+	}
+
+	CTaskScheduler& scheduler = CTaskScheduler::Get();
+	scheduler.SetThreadCount(opt.nThreads);
+	if (opt.bAffinity && !scheduler.SetAffinity(true)) {
+		fprintf(stderr, "Can't pin the threads, they run unpinned.\n");
+	}
+
+	// the rays go to the Phong of the span kernels with the default light
+	if (opt.engine == ERenderEngine::RayCast &&
+		(opt.shading != EShadingModel::Phong || opt.bLighting || opt.bDeferred))
+	{
+		fprintf(stderr, "The ray caster shades by phong, without --shading, "
+			"--lights, --ambient, --shininess, --specular and --deferred.\n");
+		return 1;
+	}
+
+	// the frame cache and the quality control are of the frames in turn
+	// of the loaded spheres
+	const bool bStream = CSphereStream::IsStreamFile(opt.szDataset);
+	if (opt.nFrameCache > 0 && (opt.nPipelineDepth > 0 || bStream))
+	{
+		fprintf(stderr, "--frame-cache is for the frames in turn, "
+			"without --pipeline and a chunked file.\n");
+		return 1;
+	}
+	if (opt.fTargetMs > 0 && (opt.nPipelineDepth > 0 || bStream))
+	{
+		fprintf(stderr, "--target-ms is for the frames in turn, "
+			"without --pipeline and a chunked file.\n");
+		return 1;
+	}
+	// the pick reads the visibility buffer of the deferred shading
+	if (opt.iPickX >= 0 && (!opt.bDeferred || opt.nPipelineDepth > 0 || bStream))
+	{
+		fprintf(stderr, "--pick needs --deferred, "
+			"without --pipeline and a chunked file.\n");
+		return 1;
+	}
+
+	STextLayout textLayout;
+	if (opt.szColumns && !textLayout.Parse(opt.szColumns))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (bStream)
+	{
+		if (opt.engine != ERenderEngine::Raster)
+		{
+			fprintf(stderr, "A chunked file is drawn by the raster only.\n");
+			return 1;
+		}
+		if (opt.bDeferred)
+		{
+			fprintf(stderr, "A chunked file is drawn without --deferred.\n");
+			return 1;
+		}
+		CFrameBuffer fb(opt.iWidth, opt.iHeight, opt.iTileSize);
+		if (!SetupFrameBuffer(opt, fb))
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		return RunStream(opt, fb);
+	}
+
+	const double tLoad0 = Timer::GetMillisFloat();
+	CSphereData data(opt.szDataset, opt.szColumns ? &textLayout : nullptr);
+	const double tLoad1 = Timer::GetMillisFloat();
+	if (data.Size() == 0)
+	{
+		fprintf(stderr, "Can't load spheres from '%s'.\n", opt.szDataset);
+		return 1;
+	}
+
+	CFrameBuffer fb(opt.iWidth, opt.iHeight, opt.iTileSize);
+	if (!SetupFrameBuffer(opt, fb))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	double tPrepare = 0;
+	if (opt.depthSort == EDepthSort::Turntable)
+	{
+		const double t0 = Timer::GetMillisFloat();
+		data.PrepareTurntable(opt.nTurntableSectors);
+		tPrepare = Timer::GetMillisFloat() - t0;
+	}
+	else if (opt.depthSort == EDepthSort::Clusters)
+	{
+		const double t0 = Timer::GetMillisFloat();
+		data.PrepareClusters();
+		tPrepare = Timer::GetMillisFloat() - t0;
+	}
+	data.SetDepthSort(opt.depthSort);
+	data.SetViewAspect((float)opt.iHeight / opt.iWidth);
+	double tBuild = 0;
+	if (opt.engine == ERenderEngine::RayCast)
+	{
+		const double t0 = Timer::GetMillisFloat();
+		data.SetRenderEngine(opt.engine);
+		tBuild = Timer::GetMillisFloat() - t0;
+	}
+
+	printf("Dataset:    %s\n", opt.szDataset);
+	printf("Spheres:    %zu\n", data.Size());
+	const double tLoad = std::max(tLoad1 - tLoad0, 1e-3);
+	printf("Load:       %.2f ms, %.1f MB/s, %.2f M spheres/s%s\n",
+		tLoad1 - tLoad0,
+		data.GetFileSize() / (1024.0 * 1024.0) / tLoad * 1000,
+		data.Size() / 1e6 / tLoad * 1000,
+		data.IsMapped() ? ", mapped" : "");
+	if (!data.IsMapped() && data.GetTextLoadStats().linesSkipped > 0) {
+		printf("Skipped:    %zu lines of %zu\n",
+			data.GetTextLoadStats().linesSkipped,
+			data.GetTextLoadStats().lines);
+	}
+	if (opt.depthSort == EDepthSort::Turntable) {
+		printf("Turntable:  %d sectors per half turn, prepared in %.2f ms\n",
+			data.GetTurntableSectors(), tPrepare);
+	}
+	if (opt.depthSort == EDepthSort::Clusters) {
+		printf("Clusters:   %d nodes, up to %u spheres, built in %.2f ms\n",
+			data.GetClusterCount(), CSphereData::CLUSTER_SIZE, tPrepare);
+	}
+	if (opt.engine == ERenderEngine::RayCast) {
+		printf("Ray cast:   %d nodes, up to %u spheres, built in %.2f ms\n",
+			data.GetRayCaster()->GetNodeCount(), CRayCaster::LEAF_SIZE, tBuild);
+	}
+	printf("Frame:      %dx%d, tiles %dx%d\n", opt.iWidth, opt.iHeight,
+		fb.GetTileSize(), fb.GetTileSize());
+	printf("Kernel:     %s, %s%s\n", GetKernelISAName(fb.GetKernelISA()),
+		GetShadingModelName(fb.GetShadingModel()),
+		fb.IsDeferredEnabled() ? ", deferred" : "");
+	PrintLighting(fb);
+	PrintThreads();
+	printf("Angles:     %d frames (+%d warmup), start %.4f, step %.4f\n",
+		opt.nFrames, opt.nWarmupFrames, opt.fStartAngle, opt.fAngleStep);
+
+	if (opt.nPipelineDepth > 0) {
+		return RunPipeline(opt, data);
+	}
+
+	return RunFrames(opt, data, fb);
+}
@@ -2,20 +2,35 @@
 
 // Exclude rarely-used stuff from Windows headers
 #define WIN32_LEAN_AND_MEAN
+// std::min() and std::max()
+#define NOMINMAX
 #define _USE_MATH_DEFINES
 
 #include <math.h>
 #include <windows.h>
+#include <algorithm>
 
 #include "resource.h"
 #include "Timer.h"
 #include "Test/SphereData.h"
 #include "Test/FrameBuffer.h"
+#include "Test/FrameCache.h"
+#include "Test/FramePipeline.h"
+#include "Test/FrameTrace.h"
+#include "Test/QualityController.h"
+#include "Test/Upscale.h"
 
 
 CSphereData g_Data("sphere_sample_points.txt");
 //CSphereData g_Data("sphere_sample_points_min.txt");
-CFrameBuffer g_Framebuffer(1024, 1024);
+// A frame of the auto rotation is drawn while the previous one is shown
+static const int FRAME_WIDTH = 1024;
+static const int FRAME_HEIGHT = 1024;
+CFramePipeline g_Pipeline(g_Data, FRAME_WIDTH, FRAME_HEIGHT);
+// The auto rotation repeats its angles, the second turn is decoded
+CFrameCache g_FrameCache;
+// Slow frames are drawn smaller and scaled up to the window
+CQualityController g_Quality;
 
 // Initial orientation
 static const float INITIAL_ANGLE = M_PI / 3;
@@ -24,6 +39,12 @@ static const float ANGLE_AUTO_ROTATION = 0.05f;
 static const bool AUTO_ROTATION = true;
 
 static const int NUM_TIME_HISTORY = 16;
+// Rows of the FPS text
+static const int TEXT_HEIGHT = 48;
+
+// Written when the trace is toggled off
+static const char* TRACE_FILENAME = "SphereDataViewer.trace.json";
+static const char* TRACE_CSV_FILENAME = "SphereDataViewer.trace.csv";
 
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -43,19 +64,31 @@ public:
 		hdcMem = 0;
 		m_nFrame = 0;
 		m_curTimeHistory = 0;
+		m_iShownSlot = -1;
+		m_bShown = false;
+		m_bScaled = false;
+		m_iShownY0 = m_iShownY1 = 0;
+		m_iPaintedY0 = m_iPaintedY1 = 0;
 	}
 
 	void RenderFrame(HDC hdc)
 	{
+		CFrameTrace& trace = CFrameTrace::Get();
+		trace.BeginFrame();
 		double t0 = Timer::GetMillisFloat();
-		if (m_wi != m_wi_last) {
-			g_Framebuffer.Clear();
-			g_Data.Render(g_Framebuffer, m_wi);
+		if (m_wi != m_wi_last || !m_bShown) {
+			ShowFrame(m_wi);
 		}
-		PaintFrameBuffer(hdc);
+		PaintFrame(hdc, GetShownPixels());
 
 		double t1 = Timer::GetMillisFloat();
 		SetRenderTime(t1 - t0);
+		trace.EndFrame();
+		if (m_iShownSlot >= 0)
+		{
+			const CFrameBuffer& fb = g_Pipeline.GetFrameBuffer(m_iShownSlot);
+			trace.RasterCounters(fb, fb.GetStats());
+		}
 
 		m_wi_last = m_wi;
 
@@ -86,45 +119,202 @@ public:
 		m_autoRotation = v;
 	}
 
+	//! Starts the trace or stops it and writes the files.
+	void ToggleTrace()
+	{
+		CFrameTrace& trace = CFrameTrace::Get();
+		if (!trace.IsEnabled())
+		{
+			trace.Clear();
+			trace.Enable(true);
+			return;
+		}
+
+		// the stages append zones, the next frame is queued anew
+		trace.Enable(false);
+		while (g_Pipeline.GetInFlight() > 0) {
+			g_Pipeline.Release(g_Pipeline.Acquire());
+		}
+		trace.WriteChromeTrace(TRACE_FILENAME);
+		trace.WriteCsv(TRACE_CSV_FILENAME);
+	}
+
 
 private:
-	void PaintFrameBuffer(HDC hdc)
+	//! Angle of the auto rotation after wi.
+	float GetNextAngle(float wi) const
+	{
+		wi += m_fAnimateAngleRatio;
+		return (wi >= 2 * M_PI) ? 0 : wi;
+	}
+
+	//! \brief Takes the frame of the angle from the cache or the pipeline,
+	//! the auto rotation queues the next one to be drawn meanwhile.
+	void ShowFrame(float wi)
+	{
+		int iWidth, iHeight;
+		g_Quality.GetRenderSize(FRAME_WIDTH, FRAME_HEIGHT, iWidth, iHeight);
+		m_bShown = true;
+		m_CachedFrame.resize((size_t)iWidth * iHeight);
+		if (g_FrameCache.Find(
+			wi, iWidth, iHeight, std::data(m_CachedFrame), m_iShownY0, m_iShownY1))
+		{
+			if (m_iShownSlot >= 0) {
+				g_Pipeline.Release(m_iShownSlot);
+			}
+			m_iShownSlot = -1;
+			ScaleShownFrame(std::data(m_CachedFrame), iWidth, iHeight);
+			SubmitNextAngle(wi);
+			return;
+		}
+
+		// frames queued for the angles the user turned away from are dropped
+		int slot = -1;
+		SPipelineFrame frame;
+		while (slot < 0 && g_Pipeline.GetInFlight() > 0)
+		{
+			const int s = g_Pipeline.Acquire(&frame);
+			if (frame.wi == wi) {
+				slot = s;
+			}
+			else {
+				g_Pipeline.Release(s);
+			}
+		}
+		if (slot < 0)
+		{
+			g_Pipeline.Submit(wi);
+			slot = g_Pipeline.Acquire(&frame);
+		}
+		CFrameTrace::Get().AddFrameZones(frame.traceFrame);
+
+		if (m_iShownSlot >= 0) {
+			g_Pipeline.Release(m_iShownSlot);
+		}
+		m_iShownSlot = slot;
+		const CFrameBuffer& fb = g_Pipeline.GetFrameBuffer(slot);
+		fb.GetDrawnRows(m_iShownY0, m_iShownY1);
+		g_FrameCache.Insert(wi, fb);
+		ScaleShownFrame(fb.GetFrameBuffer(), fb.GetWidth(), fb.GetHeight());
+
+		SubmitNextAngle(wi);
+	}
+
+	//! A frame drawn smaller than the window to m_ScaledFrame.
+	void ScaleShownFrame(const CFrameBuffer::color_t* pixels, int iWidth, int iHeight)
+	{
+		m_bScaled = (iWidth != FRAME_WIDTH || iHeight != FRAME_HEIGHT);
+		if (m_bScaled)
+		{
+			m_ScaledFrame.resize((size_t)FRAME_WIDTH * FRAME_HEIGHT);
+			UpscaleFrame(pixels, iWidth, iHeight, m_iShownY0, m_iShownY1,
+				std::data(m_ScaledFrame), FRAME_WIDTH, FRAME_HEIGHT, m_iShownY0, m_iShownY1);
+		}
+	}
+
+	//! The auto rotation draws the next angle unless it's cached.
+	void SubmitNextAngle(float wi)
+	{
+		if (!m_autoRotation) {
+			return;
+		}
+		int iWidth, iHeight;
+		g_Quality.GetRenderSize(FRAME_WIDTH, FRAME_HEIGHT, iWidth, iHeight);
+		const float next = GetNextAngle(wi);
+		if (!g_FrameCache.Contains(next, iWidth, iHeight)) {
+			g_Pipeline.Submit(next);
+		}
+	}
+
+	//! Pixels of the shown frame, of a pipeline slot, decoded or scaled.
+	const CFrameBuffer::color_t* GetShownPixels() const
+	{
+		if (m_bScaled) {
+			return std::data(m_ScaledFrame);
+		}
+		return (m_iShownSlot >= 0) ?
+			g_Pipeline.GetFrameBuffer(m_iShownSlot).GetFrameBuffer() :
+			std::data(m_CachedFrame);
+	}
+
+	//! Rows [y0..y1[ of the frame to the back buffer.
+	void CopyRows(const CFrameBuffer::color_t* pixels, int iWidth, int iHeight, int y0, int y1)
+	{
+		y1 = std::min(y1, iHeight);
+		if (y0 >= y1) {
+			return;
+		}
+
+		// top-down rows of the band
+		BITMAPINFO bmi = {};
+		bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		bmi.bmiHeader.biWidth = iWidth;
+		bmi.bmiHeader.biHeight = -(y1 - y0);
+		bmi.bmiHeader.biPlanes = 1;
+		bmi.bmiHeader.biBitCount = 32;
+		bmi.bmiHeader.biCompression = BI_RGB;
+		SetDIBitsToDevice(
+			hdcMem, 0, y0, iWidth, y1 - y0, 0, 0, 0, y1 - y0,
+			pixels + y0 * iWidth, &bmi, DIB_RGB_COLORS);
+	}
+
+	//! The shown frame of FRAME_WIDTH x FRAME_HEIGHT, drawn in
+	//! [m_iShownY0..m_iShownY1[.
+	void PaintFrame(HDC hdc, const CFrameBuffer::color_t* pixels)
 	{
+		TRACE_ZONE("paint");
 		m_nFrame++;
 
-		const int iWidth = g_Framebuffer.GetWidth();
-		const int iHeight = g_Framebuffer.GetHeight();
+		const int iWidth = FRAME_WIDTH;
+		const int iHeight = FRAME_HEIGHT;
 
 		// Create an off-screen DC for double-buffering
 		if (!hbmMem)
 		{
 			hdcMem = CreateCompatibleDC(hdc);
 			hbmMem = CreateCompatibleBitmap(hdc, iWidth, iHeight);
+			m_iPaintedY0 = 0;
+			m_iPaintedY1 = iHeight;
 		}
 
-		const CFrameBuffer::color_t* p = g_Framebuffer.GetFrameBuffer();
-
 		// Draw back buffer
 		HANDLE hOld = SelectObject(hdcMem, hbmMem);
 
-		SetBitmapBits(
-			hbmMem,
-			sizeof(CFrameBuffer::frameBuffer_t::value_type) * iWidth * iHeight, p);
+		// only the rows drawn in this frame or the painted one differ,
+		// the rest of both is clear
+		const int y0 = m_iShownY0;
+		const int y1 = m_iShownY1;
+		if (m_iPaintedY0 == m_iPaintedY1) {
+			CopyRows(pixels, iWidth, iHeight, y0, y1);
+		}
+		else if (y0 == y1) {
+			CopyRows(pixels, iWidth, iHeight, m_iPaintedY0, m_iPaintedY1);
+		}
+		else {
+			CopyRows(pixels, iWidth, iHeight,
+				std::min(y0, m_iPaintedY0), std::max(y1, m_iPaintedY1));
+		}
+		CopyRows(pixels, iWidth, iHeight, 0, TEXT_HEIGHT);
+		m_iPaintedY0 = y0;
+		m_iPaintedY1 = y1;
 
 		//////////////////////////////////////////////////////////////////////////////////
 		// Display FPS
 		//////////////////////////////////////////////////////////////////////////////////
 		float fps = (float)(1000 / m_averageFrameTime);
 		char str[1024];
-		sprintf_s(str, "Frame: %d:  FPS: %.1f ms, %.2f ms",
-			m_nFrame, fps, m_averageFrameTime);
+		sprintf_s(str, "Frame: %d:  FPS: %.1f ms, %.2f ms, scale %.3f",
+			m_nFrame, fps, m_averageFrameTime, g_Quality.GetQuality().scale);
 		TextOut(hdcMem, 0, 0, str, (int)strlen(str));
 
-		sprintf_s(str, "Turn time: %.2f s",
-			(float)(m_lastFullRotationTime / 1000));
+		sprintf_s(str, "Turn time: %.2f s, cached %zu frames, %.1f MB",
+			(float)(m_lastFullRotationTime / 1000),
+			g_FrameCache.Size(), g_FrameCache.GetMemoryUsed() / (1024.0 * 1024.0));
 		TextOut(hdcMem, 0, 16, str, (int)strlen(str));
 
-		const char* s = "> Press arrows for manual rotation.";
+		const char* s = CFrameTrace::Get().IsEnabled() ?
+			"> Tracing, press T to save the trace." :
+			"> Press arrows for manual rotation, T to trace.";
 		TextOut(hdcMem, 0, 32, s, (int)strlen(s));
 		//////////////////////////////////////////////////////////////////////////////////
 
@@ -157,6 +347,15 @@ private:
 		float ratio = 1.0f;
 		m_averageFrameTime =
 			m_averageFrameTime * (1.0f - ratio) + avgt * ratio;
+
+		// the frames in flight keep their size, the next ones take the new one
+		if (g_Quality.AddFrame(t))
+		{
+			int iWidth, iHeight;
+			g_Quality.GetRenderSize(FRAME_WIDTH, FRAME_HEIGHT, iWidth, iHeight);
+			g_Pipeline.SetRenderSize(iWidth, iHeight,
+				g_Quality.GetSplatRadius(CFrameBuffer::DEFAULT_SPLAT_RADIUS));
+		}
 	}
 
 
@@ -176,6 +375,22 @@ private:
 	float m_wi_last;
 	float m_fAnimateAngleRatio;
 	bool m_autoRotation;
+
+	//! Slot of g_Pipeline on the screen, held until the next frame,
+	//! -1 for a frame of g_FrameCache.
+	int m_iShownSlot;
+	bool m_bShown;
+	//! Decoded frame of g_FrameCache.
+	std::vector<CFrameBuffer::color_t> m_CachedFrame;
+	//! The shown frame scaled up, used when m_bScaled.
+	std::vector<CFrameBuffer::color_t> m_ScaledFrame;
+	bool m_bScaled;
+	//! Drawn rows of the shown frame.
+	int m_iShownY0;
+	int m_iShownY1;
+	//! Drawn rows of the frame in hbmMem.
+	int m_iPaintedY0;
+	int m_iPaintedY1;
 };
 
 
@@ -302,9 +517,13 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow)
 	hInst = hInstance; // Store instance handle in our global variable
 
 	Timer::Init();
+	TRACE_THREAD_NAME("main");
+
+	// the viewer spins around Y only
+	g_Data.SetDepthSort(EDepthSort::Turntable);
 
-	int width = g_Framebuffer.GetWidth();
-	int height = g_Framebuffer.GetHeight();
+	int width = FRAME_WIDTH;
+	int height = FRAME_HEIGHT;
 	hWnd = CreateWindow(szWindowClass, szTitle, WS_OVERLAPPEDWINDOW,
 		CW_USEDEFAULT, CW_USEDEFAULT, width, height, 0, NULL, hInstance, NULL);
 
@@ -345,6 +564,11 @@ LRESULT CALLBACK WndProc(
 	switch (message)
 	{
 	case WM_KEYDOWN:
+		if (wParam == 'T')
+		{
+			g_viewer.ToggleTrace();
+			break;
+		}
 		// any key stops auto rotation
 		g_viewer.SetAutoRotation(false);
 		switch (wParam)
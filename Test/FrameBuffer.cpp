@@ -1,29 +1,63 @@
 #include "FrameBuffer.h"
+#include "FrameTrace.h"
+#include "RasterKernel.h"
+#include "ShadingModels.h"
+#include "TaskScheduler.h"
 #include "../Vec3.h"
 #include "../Vec3SIMD.h"
 
 #include <math.h>
+#include <string.h>
 #include <algorithm>
-#include <execution>
+#include <limits>
 
 // change a vector
 typedef Vec3SIMD vec_t;
 //typedef Vec3 vec_t;
 
-// Global light
-vec_t Light = { 1.f, -0.5f, 0.7f };
+// Global light, normalized once: every frame buffer shades the same
+const vec_t Light = vec_t{ 1.f, -0.5f, 0.7f }.normalizeCopy();
+
+//! Spheres per chunk of the binning on the scheduler.
+static constexpr size_t BIN_GRAIN = 1024;
+//! Least spheres per part of the counting sort by tile.
+static constexpr size_t BIN_PART = 1 << 14;
 
 
 //////////////////////////////////////////////////////////////////////////
-CFrameBuffer::CFrameBuffer(int iWidth, int iHeight) :
-	m_iWidth(iWidth),
-	m_iHeight(iHeight)
+CFrameBuffer::SRasterStats& CFrameBuffer::SRasterStats::operator+=(
+	const SRasterStats& b)
 {
-	const int size = iWidth * iHeight;
-	m_FramebufferArray.resize(size, 0);
-	m_ZBuffer.resize(size, 0);
+	spheres += b.spheres;
+	spheresCulled += b.spheresCulled;
+	blocksCulled += b.blocksCulled;
+	pixelsCulled += b.pixelsCulled;
+	pixelsTested += b.pixelsTested;
+	pixelsWritten += b.pixelsWritten;
+	spheresSplatted += b.spheresSplatted;
+	spheresImpostor += b.spheresImpostor;
+	pixelsShaded += b.pixelsShaded;
+	return *this;
+}
+
 
-	Light.normalize();
+
+
+//////////////////////////////////////////////////////////////////////////
+CFrameBuffer::CFrameBuffer(int iWidth, int iHeight, int iTileSize) :
+	m_iWidth(iWidth),
+	m_iHeight(iHeight),
+	m_fSplatRadius(DEFAULT_SPLAT_RADIUS),
+	m_bHiZ(true),
+	m_bDeferred(false),
+	m_bImpostors(true),
+	m_Stats(),
+	m_ShadingModel(EShadingModel::Phong),
+	m_Lighting(CLighting::MakeRig(1))
+{
+	SetKernelISA(GetBestKernelISA());
+	m_iTileSize = iTileSize;
+	Resize(iWidth, iHeight);
 }
 
 
@@ -34,14 +68,74 @@ CFrameBuffer::~CFrameBuffer()
 
 void CFrameBuffer::Clear()
 {
-	const int size = m_iWidth * m_iHeight;
-	memset(std::data(m_FramebufferArray), 0,
-		size * sizeof(frameBuffer_t::value_type));
-	std::fill(
-		std::execution::par,
-		std::begin(m_ZBuffer),
-		std::end(m_ZBuffer),
-		std::numeric_limits< zBuffer_t::value_type >::max());
+	TRACE_ZONE("clear");
+
+	// a tile which wasn't drawn is clear already
+	m_ClearTiles.clear();
+	for (int t = 0; t < (int)m_TileDrawn.size(); ++t)
+	{
+		if (m_TileDrawn[t]) {
+			m_ClearTiles.push_back(t);
+		}
+	}
+	CTaskScheduler::Get().ParallelFor(
+		m_ClearTiles.size(),
+		1,
+		[this](size_t i) { ClearTile(m_ClearTiles[i]); });
+}
+
+
+void CFrameBuffer::ClearTile(int t)
+{
+	const float zMax = std::numeric_limits< zBuffer_t::value_type >::max();
+	const int tx = t % m_nTilesX;
+	const int ty = t / m_nTilesX;
+	const int x0 = tx * m_iTileSize;
+	const int y0 = ty * m_iTileSize;
+	const int x1 = std::min(x0 + m_iTileSize, m_iWidth);
+	const int y1 = std::min(y0 + m_iTileSize, m_iHeight);
+	for (int y = y0; y < y1; ++y)
+	{
+		const int i = y * m_iWidth;
+		memset(std::data(m_FramebufferArray) + i + x0, 0,
+			(x1 - x0) * sizeof(frameBuffer_t::value_type));
+		std::fill(
+			std::begin(m_ZBuffer) + i + x0,
+			std::begin(m_ZBuffer) + i + x1,
+			zMax);
+		if (!m_VisBuffer.empty())
+		{
+			std::fill(
+				std::begin(m_VisBuffer) + i + x0,
+				std::begin(m_VisBuffer) + i + x1,
+				EMPTY_VISIBILITY_KEY);
+		}
+	}
+
+	// whole blocks, a tile is a whole number of them
+	const int bx1 = (x1 + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+	const int by1 = (y1 + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+	for (int by = y0 / HIZ_BLOCK_SIZE; by < by1; ++by)
+	{
+		for (int bx = x0 / HIZ_BLOCK_SIZE; bx < bx1; ++bx)
+		{
+			m_HiZMin[bx + by * m_nBlocksX] = zMax;
+			m_HiZMax[bx + by * m_nBlocksX] = zMax;
+		}
+	}
+	m_TileMaxZ[t] = zMax;
+	m_TileMaxDirty[t] = false;
+	m_TileDrawn[t] = false;
+}
+
+
+void CFrameBuffer::MarkDrawn(const SRect& rect)
+{
+	for (int ty = rect.y0 / m_iTileSize; ty <= (rect.y1 - 1) / m_iTileSize; ++ty) {
+		for (int tx = rect.x0 / m_iTileSize; tx <= (rect.x1 - 1) / m_iTileSize; ++tx) {
+			m_TileDrawn[tx + ty * m_nTilesX] = true;
+		}
+	}
 }
 
 
@@ -51,66 +145,213 @@ const CFrameBuffer::color_t* CFrameBuffer::GetFrameBuffer() const
 };
 
 
-void CFrameBuffer::RenderSphere(const FrameRenderElement& fre)
+void CFrameBuffer::GetDrawnRows(int& y0, int& y1) const
 {
-	const float halfWidth = m_iWidth / 2;
-	const float centerX = fre.screenX * halfWidth + halfWidth;
-	const float centerY = fre.screenY * halfWidth + halfWidth;
+	int ty0 = m_nTilesY;
+	int ty1 = -1;
+	for (int t = 0; t < (int)m_TileDrawn.size(); ++t)
+	{
+		if (m_TileDrawn[t])
+		{
+			ty0 = std::min(ty0, t / m_nTilesX);
+			ty1 = std::max(ty1, t / m_nTilesX);
+		}
+	}
+	y0 = (ty1 < ty0) ? 0 : ty0 * m_iTileSize;
+	y1 = (ty1 < ty0) ? 0 : std::min((ty1 + 1) * m_iTileSize, m_iHeight);
+}
 
-	const float radius = fre.screenRadius * halfWidth;
 
-	if (!IsCircleOnScene(centerX, centerY, radius)) {
-		return;
+void CFrameBuffer::Resize(int iWidth, int iHeight)
+{
+	m_iWidth = iWidth;
+	m_iHeight = iHeight;
+
+	// the capacity stays, so going back up doesn't allocate
+	const int size = iWidth * iHeight;
+	m_FramebufferArray.assign(size, 0);
+	m_ZBuffer.assign(size, 0);
+	if (!m_VisBuffer.empty()) {
+		m_VisBuffer.assign(size, EMPTY_VISIBILITY_KEY);
 	}
 
-	const float radius2 = radius * radius;
+	m_nBlocksX = (iWidth + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+	m_nBlocksY = (iHeight + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+	m_HiZMin.resize(m_nBlocksX * m_nBlocksY);
+	m_HiZMax.resize(m_nBlocksX * m_nBlocksY);
+
+	SetTileSize(m_iTileSize);
+}
+
+
+void CFrameBuffer::SetTileSize(int iTileSize)
+{
+	// whole Hi-Z blocks
+	m_iTileSize = std::max(iTileSize, HIZ_BLOCK_SIZE);
+	m_iTileSize = (m_iTileSize + HIZ_BLOCK_SIZE - 1) /
+		HIZ_BLOCK_SIZE * HIZ_BLOCK_SIZE;
+	m_nTilesX = (m_iWidth + m_iTileSize - 1) / m_iTileSize;
+	m_nTilesY = (m_iHeight + m_iTileSize - 1) / m_iTileSize;
+
+	m_tileIds.resize(m_nTilesX * m_nTilesY);
+	for (int t = 0; t < (int)m_tileIds.size(); ++t) {
+		m_tileIds[t] = t;
+	}
+	m_tileOffsets.resize(m_tileIds.size() + 1);
+	m_tileStats.resize(m_tileIds.size());
+	m_TileMaxZ.assign(m_tileIds.size(), 0);
+	m_TileMaxDirty.assign(m_tileIds.size(), true);
+	// the old tiles aren't known, the next Clear() takes all
+	m_TileDrawn.assign(m_tileIds.size(), true);
+
+	UpdateHiZ({ 0, 0, m_iWidth, m_iHeight });
+}
 
-	//const DirectShading shading{ fre };
-	const PhongShading shading{ fre, radius };
 
-	for (int x = centerX - radius * 2; x <= centerX + radius * 2; ++x)
+bool CFrameBuffer::SetKernelISA(EKernelISA isa)
+{
+	const ESpecularPow pow = m_Lighting.GetSpecularPow();
+	const spanKernel_t kernel = GetSpanKernel(isa, m_ShadingModel, pow);
+	if (!kernel) {
+		return false;
+	}
+	m_KernelISA = isa;
+	m_SpanKernel = kernel;
+	m_VisibilityKernel = GetVisibilityKernel(isa, m_ShadingModel, pow);
+	return true;
+}
+
+
+void CFrameBuffer::SetShadingModel(EShadingModel model)
+{
+	m_ShadingModel = model;
+	SetKernelISA(m_KernelISA);
+}
+
+
+void CFrameBuffer::SetLighting(const CLighting& v)
+{
+	m_Lighting = v;
+	SetKernelISA(m_KernelISA);
+}
+
+
+void CFrameBuffer::SetSplatRadius(float fPixels)
+{
+	m_fSplatRadius = std::min(std::max(fPixels, 0.f), MAX_SPLAT_RADIUS);
+}
+
+
+void CFrameBuffer::PrebuildImpostors(
+	float fScreenRadiusMin, float fScreenRadiusMax)
+{
+	const float halfWidth = m_iWidth / 2;
+	m_Impostors.Prebuild(
+		fScreenRadiusMin * halfWidth,
+		fScreenRadiusMax * halfWidth);
+}
+
+
+void CFrameBuffer::EnableHiZ(bool v)
+{
+	// the pyramid isn't maintained while off
+	if (v && !m_bHiZ)
 	{
-		if (x < 0 || x >= m_iWidth)
-			continue;
+		std::fill(std::begin(m_TileMaxDirty), std::end(m_TileMaxDirty), true);
+		UpdateHiZ({ 0, 0, m_iWidth, m_iHeight });
+	}
+	m_bHiZ = v;
+}
 
-		const int dx = x - centerX;
-		const int dx2 = dx * dx;
 
-		for (int y = centerY - radius * 2; y <= centerY + radius * 2; ++y)
-		{
-			if (y < 0 || y >= m_iHeight)
-				continue;
+void CFrameBuffer::EnableDeferred(bool v)
+{
+	m_bDeferred = v;
+	if (!v)
+	{
+		std::vector< std::uint64_t >().swap(m_VisBuffer);
+		return;
+	}
+	if (m_VisBuffer.empty()) {
+		m_VisBuffer.assign(m_FramebufferArray.size(), EMPTY_VISIBILITY_KEY);
+	}
+}
 
-			const int dy = y - centerY;
-			const int dy2 = dy * dy;
-			if (dx2 + dy2 > radius2)
-				continue;
 
-			// smooth a 2D circle to 3D
-			const float avgD = sqrtf(dx2 + dy2);
-			// faster but more dirt
-			//const float avgD = (std::abs(dx) + std::abs(dy)) / 2;
-			const float dr = avgD / halfWidth;
-			const float fScreenZ3D = fre.screenZ + dr;
+unsigned int CFrameBuffer::GetElementAt(int x, int y) const
+{
+	if (m_VisBuffer.empty() || x < 0 || y < 0 || x >= m_iWidth || y >= m_iHeight) {
+		return NO_ELEMENT;
+	}
+	// the index of the empty key is NO_ELEMENT
+	return (unsigned int)m_VisBuffer[x + y * m_iWidth];
+}
+
 
-			const int i = x + y * m_iWidth;
-			if (m_ZBuffer[i] > fScreenZ3D)
+void CFrameBuffer::UpdateHiZ(const SRect& rect)
+{
+	const int bx0 = rect.x0 / HIZ_BLOCK_SIZE;
+	const int by0 = rect.y0 / HIZ_BLOCK_SIZE;
+	const int bx1 = (rect.x1 - 1) / HIZ_BLOCK_SIZE;
+	const int by1 = (rect.y1 - 1) / HIZ_BLOCK_SIZE;
+	for (int by = by0; by <= by1; ++by)
+	{
+		const int y0 = by * HIZ_BLOCK_SIZE;
+		const int y1 = std::min(y0 + HIZ_BLOCK_SIZE, m_iHeight);
+		for (int bx = bx0; bx <= bx1; ++bx)
+		{
+			const int x0 = bx * HIZ_BLOCK_SIZE;
+			const int x1 = std::min(x0 + HIZ_BLOCK_SIZE, m_iWidth);
+			float zMin = std::numeric_limits< float >::max();
+			float zMax = 0;
+			for (int y = y0; y < y1; ++y)
 			{
-				const Shading::color_t color = shading(dx, dy);
-				if (Shading::IsDefinedColor(color))
+				const float* z = std::data(m_ZBuffer) + y * m_iWidth;
+				for (int x = x0; x < x1; ++x)
 				{
-					std::lock_guard guard(mutex);
-					m_FramebufferArray[i] = color;
-					m_ZBuffer[i] = fScreenZ3D;
+					zMin = std::min(zMin, z[x]);
+					zMax = std::max(zMax, z[x]);
 				}
-			} // if fScreenZ3D
+			}
+			// the tile max changes only when it was this block's max
+			const int block = bx + by * m_nBlocksX;
+			const int tile = x0 / m_iTileSize + (y0 / m_iTileSize) * m_nTilesX;
+			if (m_HiZMax[block] >= m_TileMaxZ[tile]) {
+				m_TileMaxDirty[tile] = true;
+			}
+			m_HiZMin[block] = zMin;
+			m_HiZMax[block] = zMax;
+		}
+	}
 
-		} // for y
-	} // for x
+	const int blocksPerTile = m_iTileSize / HIZ_BLOCK_SIZE;
+	const int tx0 = rect.x0 / m_iTileSize;
+	const int ty0 = rect.y0 / m_iTileSize;
+	const int tx1 = (rect.x1 - 1) / m_iTileSize;
+	const int ty1 = (rect.y1 - 1) / m_iTileSize;
+	for (int ty = ty0; ty <= ty1; ++ty)
+	{
+		for (int tx = tx0; tx <= tx1; ++tx)
+		{
+			if (!m_TileMaxDirty[tx + ty * m_nTilesX])
+				continue;
+			m_TileMaxDirty[tx + ty * m_nTilesX] = false;
+
+			const int tbx1 = std::min((tx + 1) * blocksPerTile, m_nBlocksX);
+			const int tby1 = std::min((ty + 1) * blocksPerTile, m_nBlocksY);
+			float zMax = 0;
+			for (int by = ty * blocksPerTile; by < tby1; ++by) {
+				for (int bx = tx * blocksPerTile; bx < tbx1; ++bx) {
+					zMax = std::max(zMax, m_HiZMax[bx + by * m_nBlocksX]);
+				}
+			}
+			m_TileMaxZ[tx + ty * m_nTilesX] = zMax;
+		}
+	}
 }
 
 
-void CFrameBuffer::RenderSphere2(const FrameRenderElement& fre)
+void CFrameBuffer::RenderSphere(const FrameRenderElement& fre)
 {
 	const float halfWidth = m_iWidth / 2;
 	const float centerX = fre.screenX * halfWidth + halfWidth;
@@ -123,150 +364,672 @@ void CFrameBuffer::RenderSphere2(const FrameRenderElement& fre)
 	}
 
 	const float radius2 = radius * radius;
+	const SSphereSetup setup = MakeSetup(fre, radius2, 1 / radius);
 
-	//const DirectShading shading{ fre };
-	const PhongShading shading{ fre, radius };
-
+	SRect written = { m_iWidth, m_iHeight, 0, 0 };
+	const auto DrawRun = [&](int dx, int dy, int x, int y, int count)
+	{
+		const int i = x + y * m_iWidth;
+		SSpanResult result = { 0, 0, std::numeric_limits< float >::max() };
+		m_SpanKernel(setup, dx, dy, count, true, { nullptr, nullptr },
+			std::data(m_ZBuffer) + i, std::data(m_FramebufferArray) + i, result);
+		if (result.written > 0)
+		{
+			written = {
+				std::min(written.x0, x),
+				std::min(written.y0, y),
+				std::max(written.x1, x + count),
+				std::max(written.y1, y + 1) };
+		}
+	};
 
-	// take from pool or create a new template circle
-	const int r2 = radius * 2;
-	const int sizeSide = (r2 + 1) * 2;
-	const int sizeBox = sizeSide * sizeSide;
-	auto ft = poolCircles.find(sizeBox);
-	static constexpr int UNDEFINED_X = std::numeric_limits< int >::min();
-	static constexpr coord_t UNDEFINED_COORD = { UNDEFINED_X, UNDEFINED_X };
-	if (ft == poolCircles.cend()) {
-		circle_t circle;
-		circle.resize(sizeBox, UNDEFINED_COORD);
-		for (int x = 0; x <= r2 * 2; ++x)
+	// dx and dy are truncated toward zero, so 2 pixels of a row may
+	// have dx = 0: a run goes to the span kernel while dx goes by 1
+	const int x0 = std::max(int(floorf(centerX - radius)) - 1, 0);
+	const int y0 = std::max(int(floorf(centerY - radius)) - 1, 0);
+	for (int y = y0; y <= centerY + radius + 1 && y < m_iHeight; ++y)
+	{
+		const int dy = y - centerY;
+		const int dy2 = dy * dy;
+		int runX = 0;
+		int runDx = 0;
+		int runCount = 0;
+		for (int x = x0; x <= centerX + radius + 1 && x < m_iWidth; ++x)
 		{
-			const int dx = x - r2;
-			const int dx2 = dx * dx;
-			for (int y = 0; y <= r2 * 2; ++y)
+			const int dx = x - centerX;
+			const bool inside = (dx * dx + dy2 <= radius2);
+			if (runCount > 0 && !(inside && dx == runDx + runCount))
 			{
-				const int dy = y - r2;
-				const int dy2 = dy * dy;
-				if (dx2 + dy2 <= radius2)
+				DrawRun(runDx, dy, runX, y, runCount);
+				runCount = 0;
+			}
+			if (inside)
+			{
+				if (runCount == 0)
 				{
-					const int pi = x + y * sizeSide;
-					circle[pi] = { dx, dy };
+					runX = x;
+					runDx = dx;
 				}
+				++runCount;
 			}
+		} // for x
+		if (runCount > 0) {
+			DrawRun(runDx, dy, runX, y, runCount);
 		}
-		ft = poolCircles.emplace(sizeBox, circle).first;
+	} // for y
+
+	if (written.x0 < written.x1) {
+		MarkDrawn(written);
 	}
-	const circle_t& circle = ft->second;
+	if (m_bHiZ && written.x0 < written.x1) {
+		UpdateHiZ(written);
+	}
+}
+
+
+void CFrameBuffer::RenderSphere2(const FrameRenderElement& fre)
+{
+	SRasterStats stats = {};
+	RasterSphere(fre, { 0, 0, m_iWidth, m_iHeight }, stats);
+	if (stats.pixelsWritten > 0) {
+		MarkDrawn({ 0, 0, m_iWidth, m_iHeight });
+	}
+}
+
 
+void CFrameBuffer::RenderSpheres(const std::vector<FrameRenderElement>& list)
+{
+	TRACE_ZONE("raster");
+	const float halfWidth = m_iWidth / 2;
+	const size_t n = list.size();
+	m_tileRanges.resize(n);
+	m_Splats.resize(n);
 
-	std::for_each(
-		std::execution::par,
-		std::begin(circle),
-		std::end(circle),
-		[this, &fre, centerX, centerY, radius, radius2, r2,
-		halfWidth, sizeSide, &shading](const coord_t& coord)
+	// tiles covered by every sphere, the splats
+	CTaskScheduler::Get().ParallelFor(
+		n,
+		BIN_GRAIN,
+		[this, &list, halfWidth](size_t k)
 		{
-			if (coord.first == UNDEFINED_COORD.first)
+			const FrameRenderElement& fre = list[k];
+			STileRange& range = m_tileRanges[k];
+			SSplat& splat = m_Splats[k];
+			splat.size = 0;
+			const float centerX = fre.screenX * halfWidth + halfWidth;
+			const float centerY = fre.screenY * halfWidth + halfWidth;
+			const float radius = fre.screenRadius * halfWidth;
+			if (fre.screenRadius <= 0 ||
+				!IsCircleOnScene(centerX, centerY, radius))
 			{
+				range = { 0, 0, -1, -1 };
 				return;
 			}
 
-			const int dx = coord.first;
-			const int x = centerX + dx;
-			if (x < 0 || x >= m_iWidth)
-				return;
-
-			const int dy = coord.second;
-			const int y = centerY + dy;
-			if (y < 0 || y >= m_iHeight)
+			if (radius < m_fSplatRadius)
+			{
+				// the pixel of dx = dy = 0 like RasterSphere(), or
+				// the 2x2 block nearest to the center
+				const bool quad = (radius >= 1);
+				splat.size = quad ? 2 : 1;
+				splat.x = quad ? int(floorf(centerX - 0.5f)) : int(centerX);
+				splat.y = quad ? int(floorf(centerY - 0.5f)) : int(centerY);
+				splat.z = fre.screenZ;
+				const int x0 = std::max(splat.x, 0);
+				const int y0 = std::max(splat.y, 0);
+				const int x1 = std::min(splat.x + splat.size - 1, m_iWidth - 1);
+				const int y1 = std::min(splat.y + splat.size - 1, m_iHeight - 1);
+				if (x0 > x1 || y0 > y1)
+				{
+					range = { 0, 0, -1, -1 };
+					return;
+				}
+				range = {
+					x0 / m_iTileSize,
+					y0 / m_iTileSize,
+					x1 / m_iTileSize,
+					y1 / m_iTileSize };
 				return;
+			}
 
-			const int dx2 = dx * dx;
-			const int dy2 = dy * dy;
+			// conservative, RasterSphere() clips exactly
+			const int x0 = std::max(int(floorf(centerX - radius)) - 1, 0);
+			const int y0 = std::max(int(floorf(centerY - radius)) - 1, 0);
+			const int x1 = std::min(int(centerX + radius) + 1, m_iWidth - 1);
+			const int y1 = std::min(int(centerY + radius) + 1, m_iHeight - 1);
+			range = {
+				x0 / m_iTileSize,
+				y0 / m_iTileSize,
+				x1 / m_iTileSize,
+				y1 / m_iTileSize };
+		});
 
-			// smooth a 2D circle to 3D
-			const float avgD = sqrtf(dx2 + dy2);
-			// faster but more dirt
-			//const float avgD = (std::abs(dx) + std::abs(dy)) / 2;
-			const float dr = avgD / halfWidth;
-			const float fScreenZ3D = fre.screenZ + dr;
+	// counting sort by tile, parts of the list counted and scattered on
+	// the scheduler; tile by tile, part by part in a tile, so the order
+	// of the list stays inside every tile
+	CTaskScheduler& scheduler = CTaskScheduler::Get();
+	const size_t nTiles = m_tileIds.size();
+	size_t nParts = 1;
+	while (nParts < (size_t)scheduler.GetThreadCount() * 2 &&
+		n / (nParts + 1) >= BIN_PART)
+	{
+		++nParts;
+	}
+	const auto Bound = [n, nParts](size_t part) {
+		return n * part / nParts;
+	};
+	m_tilePartOffsets.resize(nParts * nTiles);
+	scheduler.ParallelFor(nParts, 1, [this, nTiles, &Bound](size_t part) {
+		size_t* count = std::data(m_tilePartOffsets) + part * nTiles;
+		std::fill(count, count + nTiles, 0);
+		for (size_t k = Bound(part); k < Bound(part + 1); ++k)
+		{
+			const STileRange& range = m_tileRanges[k];
+			for (int ty = range.ty0; ty <= range.ty1; ++ty) {
+				for (int tx = range.tx0; tx <= range.tx1; ++tx) {
+					++count[tx + ty * m_nTilesX];
+				}
+			}
+		}
+	});
+	size_t offset = 0;
+	for (size_t t = 0; t < nTiles; ++t)
+	{
+		m_tileOffsets[t] = offset;
+		for (size_t part = 0; part < nParts; ++part)
+		{
+			const size_t count = m_tilePartOffsets[part * nTiles + t];
+			m_tilePartOffsets[part * nTiles + t] = offset;
+			offset += count;
+		}
+	}
+	m_tileOffsets[nTiles] = offset;
+	m_tileItems.resize(offset);
+	scheduler.ParallelFor(nParts, 1, [this, nTiles, &Bound](size_t part) {
+		size_t* next = std::data(m_tilePartOffsets) + part * nTiles;
+		for (size_t k = Bound(part); k < Bound(part + 1); ++k)
+		{
+			const STileRange& range = m_tileRanges[k];
+			for (int ty = range.ty0; ty <= range.ty1; ++ty) {
+				for (int tx = range.tx0; tx <= range.tx1; ++tx) {
+					m_tileItems[next[tx + ty * m_nTilesX]++] = (unsigned int)k;
+				}
+			}
+		}
+	});
 
-			const int i = x + y * m_iWidth;
-			if (m_ZBuffer[i] > fScreenZ3D)
+	CTaskScheduler::Get().ParallelFor(
+		m_tileIds.size(),
+		1,
+		[this, &list](size_t i)
+		{
+			TRACE_ZONE("tile");
+			const int t = m_tileIds[i];
+			// the first pass of the deferred shading draws the keys
+			const auto Element = [this](unsigned int item) {
+				return m_bDeferred ? item : NO_ELEMENT;
+			};
+			const int tx = t % m_nTilesX;
+			const int ty = t / m_nTilesX;
+			const SRect rect = {
+				tx * m_iTileSize,
+				ty * m_iTileSize,
+				std::min((tx + 1) * m_iTileSize, m_iWidth),
+				std::min((ty + 1) * m_iTileSize, m_iHeight) };
+			SRasterStats& stats = m_tileStats[t];
+			stats = {};
+			// Hi-Z max of the splats is refreshed once for a run of them
+			SRect splatWritten = { rect.x1, rect.y1, rect.x0, rect.y0 };
+			for (size_t k = m_tileOffsets[t]; k < m_tileOffsets[t + 1]; ++k)
 			{
-				const Shading::color_t color = shading(dx, dy);
-				if (Shading::IsDefinedColor(color))
+				const unsigned int item = m_tileItems[k];
+				if (m_Splats[item].size > 0)
 				{
-					std::lock_guard guard(mutex);
-					m_FramebufferArray[i] = color;
-					m_ZBuffer[i] = fScreenZ3D;
+					RasterSplat(list[item], m_Splats[item], rect, splatWritten, stats,
+						Element(item));
+					continue;
+				}
+				if (m_bHiZ && splatWritten.x0 < splatWritten.x1)
+				{
+					UpdateHiZ(splatWritten);
+					splatWritten = { rect.x1, rect.y1, rect.x0, rect.y0 };
+				}
+				RasterSphere(list[item], rect, stats, Element(item));
+			}
+			if (m_bHiZ && splatWritten.x0 < splatWritten.x1) {
+				UpdateHiZ(splatWritten);
+			}
+			if (stats.pixelsWritten > 0)
+			{
+				m_TileDrawn[t] = true;
+				if (m_bDeferred) {
+					ShadeVisible(list, rect, stats);
 				}
-			} // if fScreenZ3D
+			}
 		});
+
+	m_Stats = {};
+	for (const SRasterStats& stats : m_tileStats) {
+		m_Stats += stats;
+	}
 }
 
 
-bool CFrameBuffer::IsCircleOnScene(float x, float y, float radius) const
+void CFrameBuffer::GetLight(float& x, float& y, float& z)
 {
-	const auto IsPointOnBox = [this](float px, float py) {
-		return (px > 0 && px < m_iWidth) && (py > 0 && py < m_iHeight);
-	};
-	const float left = x - radius;
-	const float right = x + radius;
-	const float top = y - radius;
-	const float bottom = y + radius;
-	return
-		IsPointOnBox(left, top) ||
-		IsPointOnBox(right, top) ||
-		IsPointOnBox(right, bottom) ||
-		IsPointOnBox(left, bottom);
+	x = Light.x;
+	y = Light.y;
+	z = Light.z;
 }
 
 
+SSphereSetup CFrameBuffer::MakeSetup(
+	const FrameRenderElement& fre, float radius2, float invRadius) const
+{
+	SSphereSetup setup = {
+		fre.screenZ,
+		(float)(m_iWidth / 2),
+		radius2,
+		invRadius,
+		Light.x, Light.y, Light.z,
+		0, 0, 0,
+		(float)((fre.ARGB & 0xFF0000) >> 16),
+		(float)((fre.ARGB & 0x00FF00) >> 8),
+		(float)((fre.ARGB & 0x0000FF) >> 0),
+		&m_Lighting.GetLightSet() };
+	WithShadingModel(m_ShadingModel, m_Lighting.GetSpecularPow(), [&](auto shading) {
+		decltype(shading)::Setup(Light, fre.screenX, fre.screenY, setup);
+	});
+	return setup;
+}
 
 
-Shading::color_t DirectShading::operator()(int, int) const
+void CFrameBuffer::RasterSplat(
+	const FrameRenderElement& fre,
+	const SSplat& splat,
+	const SRect& rect,
+	SRect& written,
+	SRasterStats& stats,
+	unsigned int element)
 {
-	return GetBaseColor();
+	const int x0 = std::max(splat.x, rect.x0);
+	const int y0 = std::max(splat.y, rect.y0);
+	const int x1 = std::min(splat.x + splat.size, rect.x1);
+	const int y1 = std::min(splat.y + splat.size, rect.y1);
+	++stats.spheres;
+	++stats.spheresSplatted;
+
+	// shaded once, when a pixel is visible; the depth pass of the
+	// deferred shading only tests the light
+	bool tested = false;
+	bool drawn = false;
+	color_t color = UNDEFINED_COLOR;
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = x0; x < x1; ++x)
+		{
+			++stats.pixelsTested;
+			const int i = x + y * m_iWidth;
+			if (!(m_ZBuffer[i] > splat.z))
+				continue;
+
+			if (!tested)
+			{
+				tested = true;
+				const float radius = fre.screenRadius * (m_iWidth / 2);
+				const SSphereSetup setup = MakeSetup(fre, radius * radius, 1 / radius);
+				if (element == NO_ELEMENT)
+				{
+					color = ShadeSplat(setup, splat.size > 1, m_ShadingModel);
+					drawn = Shading::IsDefinedColor(color);
+					++stats.pixelsShaded;
+				}
+				else {
+					drawn = IsSplatLit(setup, splat.size > 1, m_ShadingModel);
+				}
+			}
+			if (!drawn) {
+				return;
+			}
+
+			m_ZBuffer[i] = splat.z;
+			if (element == NO_ELEMENT) {
+				m_FramebufferArray[i] = color;
+			}
+			else {
+				m_VisBuffer[i] = MakeVisibilityKey(splat.z, element);
+			}
+			++stats.pixelsWritten;
+			written = {
+				std::min(written.x0, x),
+				std::min(written.y0, y),
+				std::max(written.x1, x + 1),
+				std::max(written.y1, y + 1) };
+			if (m_bHiZ)
+			{
+				float& blockMin = m_HiZMin[
+					x / HIZ_BLOCK_SIZE + (y / HIZ_BLOCK_SIZE) * m_nBlocksX];
+				blockMin = std::min(blockMin, splat.z);
+			}
+		}
+	}
 }
 
 
+template <class F>
+void CFrameBuffer::WalkCircle(
+	float centerX, float centerY, float radius, const SRect& rect, F span) const
+{
+	const float radius2 = radius * radius;
+
+	// Walk the circle by rows, the pixels in the same order as a box
+	// [-r2..r2] x [-r2..r2] filtered by dx^2 + dy^2 <= radius^2.
+	// The rows and the pixels left of the frame truncate toward zero
+	// like before, so the coverage of the border pixels doesn't change.
+	const int r2 = radius * 2;
+	for (int dy = -r2; dy <= r2; ++dy)
+	{
+		const int y = centerY + dy;
+		if (y < rect.y0 || y >= rect.y1)
+			continue;
+
+		const int dy2 = dy * dy;
+		if (dy2 > radius2)
+			continue;
+
+		// the widest dx on the row
+		int dxMax = (int)sqrtf(radius2 - dy2);
+		while (dxMax > 0 && dxMax * dxMax + dy2 > radius2)
+			--dxMax;
+		while ((dxMax + 1) * (dxMax + 1) + dy2 <= radius2)
+			++dxMax;
+
+		// clip by the rect with a margin for the truncation
+		int dx = std::max(-dxMax, int(rect.x0 - centerX) - 1);
+		const int dxTo = std::min(dxMax, int(rect.x1 - centerX) + 1);
+
+		// left of the frame, ]-1..0[ truncates to the pixel 0
+		for (; dx <= dxTo && centerX + dx < 0; ++dx)
+		{
+			if (int(centerX + dx) == rect.x0) {
+				span(dx, dy, rect.x0, y, 1);
+			}
+		}
+		for (; dx <= dxTo && int(centerX + dx) < rect.x0; ++dx)
+			;
+		if (dx > dxTo)
+			continue;
+
+		// one pixel per dx from here
+		const int x = centerX + dx;
+		const int count = std::min(dxTo - dx + 1, rect.x1 - x);
+		if (count > 0) {
+			span(dx, dy, x, y, count);
+		}
+	} // for dy
+}
 
 
-Shading::color_t PhongShading::operator()(int x, int y) const
+void CFrameBuffer::ShadeVisible(
+	const std::vector<FrameRenderElement>& list, const SRect& rect, SRasterStats& stats)
 {
-	vec_t vec_normal = {
-		(float)x,
-		(float)y,
-		sqrtf(m_frameRadius * m_frameRadius - (x * x + y * y)) };
-	vec_normal.normalize();
-
-	const float NdotL = Light.dot(vec_normal);
-	color_t color = GetUndefinedColor();
-	if (NdotL > 0)
+	TRACE_ZONE("shade");
+	const float halfWidth = m_iWidth / 2;
+
+	// the element of the last run, its neighbours in the next rows
+	// are mostly the same
+	unsigned int element = NO_ELEMENT;
+	float centerX = 0;
+	float centerY = 0;
+	const CImpostorCache::SImpostor* impostor = nullptr;
+	SSphereSetup setup = {};
+	color_t splatColor = UNDEFINED_COLOR;
+
+	for (int y = rect.y0; y < rect.y1; ++y)
 	{
-		const FrameRenderElement& fre = GetFrameRenderElement();
-		const vec_t vec_eye = {
-			Light.x + fre.screenX,
-			Light.y + fre.screenY,
-			Light.z + 1.f };
-		const vec_t vec_half = vec_eye.normalizeCopy();
-
-		const float NdotHV = vec_half.dot(vec_normal);
-		static constexpr float shininess = 12;
-		const float specular = pow(NdotHV, shininess);
-		float alpha = (NdotL + specular);
-		if (alpha > 1.0f)
-			alpha = 1.0f;
-
-		float r = ((GetBaseColor() & 0xFF0000) >> 16) * alpha;
-		float g = ((GetBaseColor() & 0x00FF00) >> 8) * alpha;
-		float b = ((GetBaseColor() & 0x0000FF >> 0)) * alpha;
-		r = std::min(r, 255.f);
-		g = std::min(g, 255.f);
-		b = std::min(b, 255.f);
-
-		color = (int(r) << 16) | (int(g) << 8) | (int(b) << 0);
-	} // if NdotL > 0
-
-	return color;
+		const std::uint64_t* keys = std::data(m_VisBuffer) + y * m_iWidth;
+		float* zRow = std::data(m_ZBuffer) + y * m_iWidth;
+		color_t* colorRow = std::data(m_FramebufferArray) + y * m_iWidth;
+		for (int x = rect.x0; x < rect.x1; )
+		{
+			const unsigned int id = (unsigned int)keys[x];
+			if (id == NO_ELEMENT)
+			{
+				++x;
+				continue;
+			}
+			int end = x + 1;
+			while (end < rect.x1 && (unsigned int)keys[end] == id) {
+				++end;
+			}
+			const int count = end - x;
+
+			if (id != element)
+			{
+				element = id;
+				const FrameRenderElement& fre = list[element];
+				centerX = fre.screenX * halfWidth + halfWidth;
+				centerY = fre.screenY * halfWidth + halfWidth;
+				const float radius = fre.screenRadius * halfWidth;
+				if (m_Splats[element].size > 0)
+				{
+					splatColor = ShadeSplat(
+						MakeSetup(fre, radius * radius, 1 / radius),
+						m_Splats[element].size > 1, m_ShadingModel);
+				}
+				else
+				{
+					impostor = m_bImpostors ? m_Impostors.Find(radius) : nullptr;
+					setup = MakeSetup(
+						fre, radius * radius, impostor ? impostor->invRadius : 1 / radius);
+				}
+			}
+
+			if (m_Splats[element].size > 0)
+			{
+				std::fill(colorRow + x, colorRow + end, splatColor);
+				stats.pixelsShaded += end - x;
+				x = end;
+				continue;
+			}
+
+			// the pixel x is centerX + dx truncated, see WalkCircle(),
+			// a run truncated to the pixel 0 may be out of the impostor
+			const int dx = x - (int)floorf(centerX);
+			const int dy = y - (int)floorf(centerY);
+			SImpostorSpan span = { nullptr, nullptr };
+			if (impostor && dy >= -impostor->rows && dy <= impostor->rows &&
+				std::max(-dx, dx + count - 1) <= impostor->rowWidth[dy + impostor->rows])
+			{
+				const std::size_t i = impostor->rowCenter[dy + impostor->rows] + dx;
+				span = { std::data(impostor->dist) + i, std::data(impostor->nz) + i };
+			}
+			SSpanResult result = { 0, 0, std::numeric_limits< float >::max() };
+			m_SpanKernel(setup, dx, dy, count, false, span,
+				zRow + x, colorRow + x, result);
+			stats.pixelsShaded += result.shaded;
+			x = end;
+		}
+	}
+}
+
+
+void CFrameBuffer::RasterSphere(
+	const FrameRenderElement& fre,
+	const SRect& rect,
+	SRasterStats& stats,
+	unsigned int element)
+{
+	const float halfWidth = m_iWidth / 2;
+	const float centerX = fre.screenX * halfWidth + halfWidth;
+	const float centerY = fre.screenY * halfWidth + halfWidth;
+
+	const float radius = fre.screenRadius * halfWidth;
+
+	if (!IsCircleOnScene(centerX, centerY, radius)) {
+		return;
+	}
+
+	const float radius2 = radius * radius;
+
+	// pixels of the sphere are behind its center: z + dr, dr >= 0
+	const float zNear = fre.screenZ;
+	// +1 covers a rounding of sqrtf()
+	const float zFar = fre.screenZ + (radius + 1) / halfWidth;
+
+	++stats.spheres;
+	if (m_bHiZ)
+	{
+		// the sphere is hidden when every block under it is nearer
+		const SRect box = {
+			std::max(int(floorf(centerX - radius)) - 1, rect.x0),
+			std::max(int(floorf(centerY - radius)) - 1, rect.y0),
+			std::min(int(centerX + radius) + 2, rect.x1),
+			std::min(int(centerY + radius) + 2, rect.y1) };
+		if (box.x0 >= box.x1 || box.y0 >= box.y1) {
+			return;
+		}
+
+		bool hidden = true;
+		for (int ty = box.y0 / m_iTileSize;
+			hidden && ty <= (box.y1 - 1) / m_iTileSize; ++ty)
+		{
+			for (int tx = box.x0 / m_iTileSize;
+				hidden && tx <= (box.x1 - 1) / m_iTileSize; ++tx)
+			{
+				hidden = m_TileMaxZ[tx + ty * m_nTilesX] <= zNear;
+			}
+		}
+		if (!hidden)
+		{
+			hidden = true;
+			for (int by = box.y0 / HIZ_BLOCK_SIZE;
+				hidden && by <= (box.y1 - 1) / HIZ_BLOCK_SIZE; ++by)
+			{
+				for (int bx = box.x0 / HIZ_BLOCK_SIZE;
+					hidden && bx <= (box.x1 - 1) / HIZ_BLOCK_SIZE; ++bx)
+				{
+					hidden = m_HiZMax[bx + by * m_nBlocksX] <= zNear;
+				}
+			}
+		}
+		if (hidden)
+		{
+			++stats.spheresCulled;
+			return;
+		}
+	}
+
+	const CImpostorCache::SImpostor* impostor =
+		m_bImpostors ? m_Impostors.Find(radius) : nullptr;
+	if (impostor) {
+		++stats.spheresImpostor;
+	}
+
+	const SSphereSetup setup = MakeSetup(
+		fre, radius2, impostor ? impostor->invRadius : 1 / radius);
+
+	SRect written = { rect.x1, rect.y1, rect.x0, rect.y0 };
+
+	// Draws count pixels of the row y from x on, split by Hi-Z blocks:
+	// hidden blocks are skipped, the others go to the span kernel.
+	const auto DrawSpan = [&](int dx, int dy, int x, int y, int count)
+	{
+		float* zRow = std::data(m_ZBuffer) + y * m_iWidth;
+		color_t* colorRow = std::data(m_FramebufferArray) + y * m_iWidth;
+		const int blockRow = (y / HIZ_BLOCK_SIZE) * m_nBlocksX;
+		while (count > 0)
+		{
+			int n = count;
+			bool testDepth = true;
+			if (m_bHiZ)
+			{
+				const int block = blockRow + x / HIZ_BLOCK_SIZE;
+				n = std::min(count, (x / HIZ_BLOCK_SIZE + 1) * HIZ_BLOCK_SIZE - x);
+				if (m_HiZMax[block] <= zNear)
+				{
+					++stats.blocksCulled;
+					stats.pixelsCulled += n;
+					dx += n;
+					x += n;
+					count -= n;
+					continue;
+				}
+				// trivial accept, the farthest pixel of the sphere is nearer
+				testDepth = !(zFar < m_HiZMin[block]);
+
+				// join the next blocks which go the same way
+				for (int next = block + 1; n < count; ++next)
+				{
+					if (m_HiZMax[next] <= zNear ||
+						testDepth != !(zFar < m_HiZMin[next]))
+					{
+						break;
+					}
+					n = std::min(count, n + HIZ_BLOCK_SIZE);
+				}
+			}
+
+			if (testDepth) {
+				stats.pixelsTested += n;
+			}
+			SImpostorSpan span = { nullptr, nullptr };
+			if (impostor)
+			{
+				const std::size_t i =
+					impostor->rowCenter[dy + impostor->rows] + dx;
+				span = { std::data(impostor->dist) + i, std::data(impostor->nz) + i };
+			}
+			SSpanResult result = { 0, 0, std::numeric_limits< float >::max() };
+			if (element == NO_ELEMENT)
+			{
+				m_SpanKernel(setup, dx, dy, n, testDepth, span,
+					zRow + x, colorRow + x, result);
+			}
+			else
+			{
+				m_VisibilityKernel(setup, dx, dy, n, testDepth, span, element,
+					zRow + x, std::data(m_VisBuffer) + x + y * m_iWidth, result);
+			}
+			stats.pixelsShaded += result.shaded;
+			if (result.written > 0)
+			{
+				stats.pixelsWritten += result.written;
+				written = {
+					std::min(written.x0, x),
+					std::min(written.y0, y),
+					std::max(written.x1, x + n),
+					std::max(written.y1, y + 1) };
+				// exact min for the trivial accept of the next spans,
+				// the max is refreshed by UpdateHiZ()
+				if (m_bHiZ)
+				{
+					for (int bx = x / HIZ_BLOCK_SIZE;
+						bx <= (x + n - 1) / HIZ_BLOCK_SIZE; ++bx)
+					{
+						float& blockMin = m_HiZMin[blockRow + bx];
+						blockMin = std::min(blockMin, result.zMin);
+					}
+				}
+			}
+			dx += n;
+			x += n;
+			count -= n;
+		}
+	};
+
+	WalkCircle(centerX, centerY, radius, rect, DrawSpan);
+
+	if (m_bHiZ && written.x0 < written.x1) {
+		UpdateHiZ(written);
+	}
+}
+
+
+bool CFrameBuffer::IsCircleOnScene(float x, float y, float radius) const
+{
+	// the box of the circle overlaps the frame, a circle bigger
+	// than the frame or over its edge is kept too
+	return
+		x + radius > 0 && x - radius < m_iWidth &&
+		y + radius > 0 && y - radius < m_iHeight;
 }
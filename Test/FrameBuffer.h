@@ -1,11 +1,16 @@
 #pragma once
 
+#include "ImpostorCache.h"
+#include "Lighting.h"
+#include "RasterKernel.h"
+
+#include <cstddef>
+#include <cstdint>
 #include <vector>
-#include <mutex>
-#include <unordered_map>
 
 
 class Shading;
+class CRayCaster;
 struct FrameRenderElement;
 
 
@@ -18,27 +23,212 @@ public:
 
 	static constexpr color_t UNDEFINED_COLOR = 0x00000000;
 
+	//! Pixel of no sphere, see GetElementAt().
+	static constexpr unsigned int NO_ELEMENT = 0xFFFFFFFF;
+
+	//! Side of a square screen tile, pixels.
+	//! \see RenderSpheres()
+	static constexpr int DEFAULT_TILE_SIZE = 64;
+
+	//! Side of a Hi-Z block, pixels. A tile is a whole number of blocks.
+	static constexpr int HIZ_BLOCK_SIZE = 8;
+
+	//! Spheres smaller than this, pixels, are splats.
+	//! \see SetSplatRadius()
+	static constexpr float DEFAULT_SPLAT_RADIUS = 1.0f;
+	static constexpr float MAX_SPLAT_RADIUS = 2.0f;
+
+	//! Counters of the last RenderSpheres().
+	//! A sphere is counted once per tile it covers.
+	struct SRasterStats
+	{
+		std::size_t spheres;
+		//! Rejected by Hi-Z before any per-pixel work.
+		std::size_t spheresCulled;
+		//! Hi-Z blocks skipped inside the drawn spheres.
+		std::size_t blocksCulled;
+		//! Pixels of the circles skipped with the blocks.
+		std::size_t pixelsCulled;
+		std::size_t pixelsTested;
+		//! Shaded, by the second pass of the deferred shading only.
+		std::size_t pixelsShaded;
+		std::size_t pixelsWritten;
+		//! Drawn as splats, counted in spheres too.
+		std::size_t spheresSplatted;
+		//! Drawn with an impostor of the cache, counted in spheres too.
+		std::size_t spheresImpostor;
+
+		SRasterStats& operator+=(const SRasterStats&);
+	};
+
 
 public:
-	CFrameBuffer(int iWidth, int iHeight);
+	CFrameBuffer(int iWidth, int iHeight, int iTileSize = DEFAULT_TILE_SIZE);
 
 	~CFrameBuffer();
 
+	//! \brief Clears the tiles drawn since the previous Clear() only,
+	//! the cost follows the touched part of the frame, not its size.
 	void Clear();
 
 	//! \param fScreenX [-1..1]
 	//! \param fScreenY [-1..1]
 	//! \param fScreenZ ]0..1[
 	//! \param fScreenRadius >0 (-1..1 = 2 means full screen)
+	//! \warning Single-threaded. Use RenderSpheres() for a list.
 	void RenderSphere(const FrameRenderElement&);
 	void RenderSphere2(const FrameRenderElement&);
 
+	//! \brief Renders the spheres in the given order on all cores.
+	//! The spheres are binned into screen tiles and every tile is drawn
+	//! by exactly one worker, so depth test and write need no locks and
+	//! the image is the same as if the spheres were drawn one by one.
+	//! \param list Spheres with fScreenRadius <= 0 are skipped.
+	void RenderSpheres(const std::vector<FrameRenderElement>& list);
+
 	const color_t* GetFrameBuffer() const;
+
+	//! \brief Rows [y0..y1[ of the tiles drawn since the last Clear(),
+	//! y0 == y1 for an empty frame. Pixels out of them are UNDEFINED_COLOR,
+	//! so a presenter copies these rows of this frame and the last one.
+	void GetDrawnRows(int& y0, int& y1) const;
+
 	int GetWidth() const { return m_iWidth; }
 	int GetHeight() const { return m_iHeight; }
-
+	//! \brief New size of the frame, cleared by the next Clear(). The
+	//!        spheres are in screen units, so they draw the same at any.
+	//! \see CQualityController
+	void Resize(int iWidth, int iHeight);
+
+	int GetTileSize() const { return m_iTileSize; }
+	void SetTileSize(int iTileSize);
+
+	//! \brief Hierarchical Z: min and max depth of every 8x8 block and
+	//! max depth of every tile. A sphere which front is behind the max
+	//! of a tile or a block is skipped there without per-pixel tests.
+	bool IsHiZEnabled() const { return m_bHiZ; }
+	void EnableHiZ(bool v);
+
+	//! \brief Spheres up to CImpostorCache::MAX_RADIUS pixels take their
+	//! depth offsets and normals from the cache. Slightly rounder rims
+	//! because the radius is quantized up.
+	bool IsImpostorsEnabled() const { return m_bImpostors; }
+	void EnableImpostors(bool v) { m_bImpostors = v; }
+
+	//! \brief Builds impostors for the screen radii [min..max].
+	//! Cheap when they are built, call it before every RenderSpheres().
+	//! \param fScreenRadiusMin, fScreenRadiusMax As fScreenRadius.
+	void PrebuildImpostors(float fScreenRadiusMin, float fScreenRadiusMax);
+	const CImpostorCache& GetImpostors() const { return m_Impostors; }
+
+	//! \brief Deferred shading in RenderSpheres(). The first pass keeps
+	//! only the nearest sphere of every pixel, a 64-bit key of its depth
+	//! and index in the list, the second one shades every visible pixel
+	//! once by the span kernels. The first pass tests only N.L > 0, so a
+	//! pixel shaded to black hides the spheres behind it, where the
+	//! forward raster leaves it undrawn and shows them. The keys take 8
+	//! bytes per pixel while on.
+	//! \see GetElementAt()
+	bool IsDeferredEnabled() const { return m_bDeferred; }
+	void EnableDeferred(bool v);
+
+	//! \brief Index in the list of the last deferred RenderSpheres()
+	//!        of the sphere seen at the pixel, O(1).
+	//! \return NO_ELEMENT for the background, out of the frame or
+	//!         when the deferred shading is off.
+	unsigned int GetElementAt(int x, int y) const;
+
+	//! \brief Level of detail for tiny spheres in RenderSpheres().
+	//! A sphere with a radius below 1 pixel is 1 pixel, below
+	//! MAX_SPLAT_RADIUS a 2x2 block, of one color and one depth.
+	//! The 1 pixel splats are the same pixels as the full raster draws.
+	//! \param fPixels 0 turns the splats off.
+	void SetSplatRadius(float fPixels);
+	float GetSplatRadius() const { return m_fSplatRadius; }
+
+	const SRasterStats& GetStats() const { return m_Stats; }
+
+	//! \brief Instruction set of the sphere raster.
+	//! The best one of the CPU by default.
+	//! \return false when the CPU doesn't support the set.
+	bool SetKernelISA(EKernelISA);
+	EKernelISA GetKernelISA() const { return m_KernelISA; }
+
+	//! Conservative: the box of the circle overlaps the frame.
 	bool IsCircleOnScene(float x, float y, float radius) const;
 
+	//! \brief Lighting model of the span kernels and the splats,
+	//!        Phong by default. Picks the kernels, so it's free per pixel.
+	//!        The ray caster keeps Phong.
+	void SetShadingModel(EShadingModel);
+	EShadingModel GetShadingModel() const { return m_ShadingModel; }
+
+	//! \brief Lights of EShadingModel::Lights, a key light by default.
+	//!        Picks the kernels of the specular power.
+	//! \see CLighting::MakeRig()
+	void SetLighting(const CLighting&);
+	const CLighting& GetLighting() const { return m_Lighting; }
+
+	//! Normalized direction of the light of the other models.
+	static void GetLight(float& x, float& y, float& z);
+
+
+private:
+	//! Traces the tiles into the buffers instead of RenderSpheres().
+	friend class CRayCaster;
+
+	//! Pixel rectangle [x0..x1[ x [y0..y1[.
+	struct SRect
+	{
+		int x0, y0, x1, y1;
+	};
+
+	//! Invariants of a sphere for the span kernels, of the shading model.
+	SSphereSetup MakeSetup(const FrameRenderElement&, float radius2, float invRadius) const;
+
+	//! Draws a part of the sphere inside the rect.
+	//! The rect is owned by a caller, so no locks.
+	//! \param element Index in the deferred list, the keys are drawn
+	//!        instead of the colors. NO_ELEMENT draws the colors.
+	void RasterSphere(
+		const FrameRenderElement&, const SRect&, SRasterStats&,
+		unsigned int element = NO_ELEMENT);
+
+	//! Sphere of RenderSpheres() drawn as a block of pixels.
+	struct SSplat
+	{
+		//! Top left pixel, may be out of the frame.
+		int x, y;
+		//! Side of the block, 0 when the sphere isn't a splat.
+		int size;
+		float z;
+	};
+
+	//! Draws a part of the splat inside the rect, shaded at the first
+	//! visible pixel. Hi-Z min is kept exact, the pixels are added
+	//! to `written` for UpdateHiZ().
+	void RasterSplat(
+		const FrameRenderElement&, const SSplat&, const SRect&,
+		SRect& written, SRasterStats&, unsigned int element = NO_ELEMENT);
+
+	//! \brief Calls span(dx, dy, x, y, count) for the rows of the circle
+	//!        inside the rect, one pixel per dx, in the order of the rows.
+	template <class F>
+	void WalkCircle(float centerX, float centerY, float radius, const SRect&, F span) const;
+
+	//! \brief Second pass of the deferred shading: the runs of one
+	//!        element in a row go to the span kernel, no depth test.
+	void ShadeVisible(
+		const std::vector<FrameRenderElement>& list, const SRect&, SRasterStats&);
+
+	//! Recomputes the Hi-Z blocks and tiles over the rect.
+	void UpdateHiZ(const SRect&);
+
+	//! Marks the tiles of the rect for the next Clear().
+	void MarkDrawn(const SRect&);
+	//! Resets color, depth and Hi-Z of the tile.
+	void ClearTile(int tile);
+
 
 private:
 	frameBuffer_t m_FramebufferArray;
@@ -46,15 +236,59 @@ private:
 	int m_iWidth;
 	int m_iHeight;
 
-	std::mutex mutex;
-
-	//! Pixels of active circle.
-	//! \see RenderSphere2()
-	typedef std::pair< int, int > coord_t;
-	typedef std::vector< coord_t > circle_t;
-	typedef std::unordered_map< int /* sizeBox */, circle_t > poolCircles_t;
-	//! Adaptive pool for fixed circle's radius.
-	mutable poolCircles_t poolCircles;
+	//! Screen tiles for RenderSpheres().
+	int m_iTileSize;
+	int m_nTilesX;
+	int m_nTilesY;
+	//! Range of tiles covered by an element of a list, inclusive.
+	struct STileRange
+	{
+		int tx0, ty0, tx1, ty1;
+	};
+	std::vector< STileRange > m_tileRanges;
+	//! Splats of the elements of a list.
+	std::vector< SSplat > m_Splats;
+	float m_fSplatRadius;
+	//! Elements of a tile t are
+	//! m_tileItems[ m_tileOffsets[t] .. m_tileOffsets[t + 1] [
+	std::vector< std::size_t > m_tileOffsets;
+	std::vector< unsigned int > m_tileItems;
+	//! Elements of every tile in a part of a list, then the offsets of
+	//! the part in the tiles, part by part.
+	std::vector< std::size_t > m_tilePartOffsets;
+	std::vector< int > m_tileIds;
+	std::vector< SRasterStats > m_tileStats;
+	//! A pixel of the tile was drawn since its last clear.
+	std::vector< unsigned char > m_TileDrawn;
+	//! Tiles of Clear().
+	std::vector< int > m_ClearTiles;
+
+	//! Hi-Z pyramid: blocks HIZ_BLOCK_SIZE x HIZ_BLOCK_SIZE and tiles.
+	bool m_bHiZ;
+	int m_nBlocksX;
+	int m_nBlocksY;
+	zBuffer_t m_HiZMin;
+	zBuffer_t m_HiZMax;
+	zBuffer_t m_TileMaxZ;
+	//! The tile max is recomputed when its max block gets nearer.
+	std::vector< unsigned char > m_TileMaxDirty;
+
+	//! Keys of m_VisibilityKernel while the deferred shading is on.
+	std::vector< std::uint64_t > m_VisBuffer;
+	bool m_bDeferred;
+
+	//! Read-only while RenderSpheres() runs.
+	CImpostorCache m_Impostors;
+	bool m_bImpostors;
+
+	SRasterStats m_Stats;
+
+	EKernelISA m_KernelISA;
+	EShadingModel m_ShadingModel;
+	//! Read-only while RenderSpheres() runs.
+	CLighting m_Lighting;
+	spanKernel_t m_SpanKernel;
+	visibilityKernel_t m_VisibilityKernel;
 };
 
 
@@ -71,7 +305,9 @@ struct FrameRenderElement {
 
 
 
-//! \brief Base class for shading.
+//! \brief Colors of an element. The lighting models are the
+//!        compile-time policies of ShadingModels.h, set by
+//!        CFrameBuffer::SetShadingModel().
 class Shading {
 public:
 	typedef CFrameBuffer::color_t color_t;
@@ -82,9 +318,6 @@ public:
 		m_fre(fre)
 	{}
 
-	virtual ~Shading()
-	{}
-
 	color_t GetBaseColor() const
 	{
 		return m_fre.ARGB;
@@ -114,40 +347,7 @@ public:
 		return m_fre;
 	}
 
-	//! \param x Coord in a frame buffer.
-	//! \param y Coord in a frame buffer.
-	virtual color_t operator()(int x, int y) const = 0;
-
 
 private:
 	FrameRenderElement m_fre;
 };
-
-
-
-
-class DirectShading : public Shading {
-public:
-	explicit DirectShading(const FrameRenderElement& fre) :
-		Shading(fre)
-	{}
-
-	virtual color_t operator()(int x, int y) const override;
-};
-
-
-
-
-class PhongShading : public Shading {
-public:
-	PhongShading(const FrameRenderElement& fre, float frameRadius) :
-		Shading(fre),
-		m_frameRadius(frameRadius)
-	{}
-
-	virtual color_t operator()(int x, int y) const override;
-
-
-private:
-	float m_frameRadius;
-};
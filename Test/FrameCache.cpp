@@ -0,0 +1,190 @@
+#define _USE_MATH_DEFINES
+
+#include "FrameCache.h"
+#include "FrameTrace.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+
+namespace {
+
+//! Code word of a run, the rest of the bits is the count.
+static constexpr std::uint32_t RUN_BIT = 0x80000000u;
+//! Shorter runs are literals, a run costs two words.
+static constexpr std::size_t MIN_RUN = 3;
+
+} // namespace
+
+
+CFrameCache::CFrameCache(std::size_t budget) :
+	m_nBudget(budget),
+	m_nBytes(0),
+	m_Stats()
+{
+}
+
+
+std::uint64_t CFrameCache::Key(float wi, int width, int height)
+{
+	double a = fmod((double)wi, 2 * M_PI);
+	if (a < 0) {
+		a += 2 * M_PI;
+	}
+	const std::uint64_t turn = (std::uint64_t)llround(2 * M_PI / ANGLE_QUANTUM);
+	const std::uint64_t angle = (std::uint64_t)llround(a / ANGLE_QUANTUM) % turn;
+	return (angle << 32) | ((std::uint64_t)(width & 0xFFFF) << 16) | (height & 0xFFFF);
+}
+
+
+bool CFrameCache::Find(float wi, int width, int height, color_t* pixels, int& y0, int& y1)
+{
+	const auto it = m_Index.find(Key(wi, width, height));
+	if (it == m_Index.end())
+	{
+		++m_Stats.misses;
+		return false;
+	}
+
+	TRACE_ZONE("decode");
+	++m_Stats.hits;
+	m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+	const SEntry& entry = *it->second;
+	y0 = entry.y0;
+	y1 = entry.y1;
+	const std::size_t size = (std::size_t)width * height;
+	std::fill(pixels, pixels + (std::size_t)y0 * width, CFrameBuffer::UNDEFINED_COLOR);
+	Decode(entry.codes, pixels + (std::size_t)y0 * width);
+	std::fill(pixels + (std::size_t)y1 * width, pixels + size, CFrameBuffer::UNDEFINED_COLOR);
+	return true;
+}
+
+
+bool CFrameCache::Contains(float wi, int width, int height) const
+{
+	return m_Index.count(Key(wi, width, height)) > 0;
+}
+
+
+bool CFrameCache::Insert(float wi, const CFrameBuffer& fb)
+{
+	TRACE_ZONE("encode");
+	const int width = fb.GetWidth();
+	int y0, y1;
+	fb.GetDrawnRows(y0, y1);
+	m_Codes.clear();
+	Encode(fb.GetFrameBuffer() + (std::size_t)y0 * width,
+		(std::size_t)(y1 - y0) * width, m_Codes);
+
+	const std::uint64_t key = Key(wi, width, fb.GetHeight());
+	const auto it = m_Index.find(key);
+	if (it != m_Index.end())
+	{
+		m_nBytes -= sizeof(SEntry) + it->second->codes.size() * sizeof(std::uint32_t);
+		m_Entries.erase(it->second);
+		m_Index.erase(it);
+	}
+
+	const std::size_t bytes = sizeof(SEntry) + m_Codes.size() * sizeof(std::uint32_t);
+	if (bytes > m_nBudget) {
+		return false;
+	}
+	Evict(m_nBudget - bytes);
+
+	m_Entries.push_front({ key, y0, y1, std::vector<std::uint32_t>(m_Codes) });
+	m_Index[key] = m_Entries.begin();
+	m_nBytes += bytes;
+	++m_Stats.inserts;
+	m_Stats.bytesRaw += (std::size_t)width * fb.GetHeight() * sizeof(color_t);
+	m_Stats.bytesCoded += bytes;
+	return true;
+}
+
+
+void CFrameCache::Clear()
+{
+	m_Entries.clear();
+	m_Index.clear();
+	m_nBytes = 0;
+}
+
+
+void CFrameCache::SetMemoryBudget(std::size_t budget)
+{
+	m_nBudget = budget;
+	Evict(m_nBudget);
+}
+
+
+void CFrameCache::ResetStats()
+{
+	m_Stats = {};
+}
+
+
+void CFrameCache::Evict(std::size_t budget)
+{
+	while (m_nBytes > budget && !m_Entries.empty())
+	{
+		const SEntry& entry = m_Entries.back();
+		m_nBytes -= sizeof(SEntry) + entry.codes.size() * sizeof(std::uint32_t);
+		m_Index.erase(entry.key);
+		m_Entries.pop_back();
+		++m_Stats.evictions;
+	}
+}
+
+
+void CFrameCache::Encode(const color_t* pixels, std::size_t n, std::vector<std::uint32_t>& codes)
+{
+	// literals [from..i[ wait for the next run or the end
+	std::size_t from = 0;
+	const auto Literals = [pixels, &codes, &from](std::size_t to) {
+		if (to > from)
+		{
+			codes.push_back((std::uint32_t)(to - from));
+			codes.insert(codes.end(), pixels + from, pixels + to);
+		}
+	};
+
+	std::size_t i = 0;
+	while (i < n)
+	{
+		std::size_t j = i + 1;
+		while (j < n && pixels[j] == pixels[i] && j - i < RUN_BIT - 1) {
+			++j;
+		}
+		if (j - i >= MIN_RUN)
+		{
+			Literals(i);
+			codes.push_back(RUN_BIT | (std::uint32_t)(j - i));
+			codes.push_back(pixels[i]);
+			from = j;
+		}
+		i = j;
+	}
+	Literals(n);
+}
+
+
+void CFrameCache::Decode(const std::vector<std::uint32_t>& codes, color_t* pixels)
+{
+	const std::uint32_t* code = std::data(codes);
+	const std::uint32_t* end = code + codes.size();
+	while (code < end)
+	{
+		const std::uint32_t word = *code++;
+		const std::uint32_t count = word & ~RUN_BIT;
+		if (word & RUN_BIT)
+		{
+			std::fill(pixels, pixels + count, *code++);
+		}
+		else
+		{
+			memcpy(pixels, code, count * sizeof(color_t));
+			code += count;
+		}
+		pixels += count;
+	}
+}
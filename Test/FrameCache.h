@@ -0,0 +1,108 @@
+#pragma once
+
+#include "FrameBuffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+
+//! \brief Finished frames of the turntable by quantized angle and size,
+//!        run-length coded, least recently used out over the budget.
+//! The auto rotation goes through the same angles every turn, so after
+//! the first one a static scene is decoded instead of drawn. The frames
+//! are of the scene and the settings they were drawn with: the owner
+//! calls Clear() when either changes.
+//!
+//! A frame keeps its drawn rows only, pixels out of them are
+//! UNDEFINED_COLOR. A row is runs of one color, the background and
+//! flat splats, and literal pixels, the shaded spheres.
+//! \warning Not thread safe.
+class CFrameCache
+{
+public:
+	typedef CFrameBuffer::color_t color_t;
+
+	//! Limit for the coded frames, bytes.
+	static constexpr std::size_t DEFAULT_MEMORY_BUDGET = 256u << 20;
+	//! Angles of one frame, radians: far below a step of the rotation,
+	//! far above the rounding of the sum of the steps.
+	static constexpr float ANGLE_QUANTUM = 1e-4f;
+
+	//! Counters since the last ResetStats().
+	struct SCacheStats
+	{
+		std::size_t hits;
+		std::size_t misses;
+		std::size_t inserts;
+		std::size_t evictions;
+		//! Of the inserted frames, uncoded and coded.
+		std::size_t bytesRaw;
+		std::size_t bytesCoded;
+	};
+
+
+public:
+	explicit CFrameCache(std::size_t budget = DEFAULT_MEMORY_BUDGET);
+
+	//! \brief Decodes the frame of the angle, the most recent one then.
+	//! \param pixels width * height, all written.
+	//! \param y0, y1 Drawn rows as CFrameBuffer::GetDrawnRows().
+	//! \return false when it isn't there.
+	bool Find(float wi, int width, int height, color_t* pixels, int& y0, int& y1);
+
+	//! Whether the frame is there, no decoding and no counters.
+	bool Contains(float wi, int width, int height) const;
+
+	//! \brief Codes the frame of the angle, replaces an older one.
+	//! \return false when it's over the whole budget.
+	bool Insert(float wi, const CFrameBuffer&);
+
+	void Clear();
+
+	//! Evicts down to the new budget.
+	void SetMemoryBudget(std::size_t);
+	std::size_t GetMemoryBudget() const { return m_nBudget; }
+	std::size_t GetMemoryUsed() const { return m_nBytes; }
+	//! Frames in the cache.
+	std::size_t Size() const { return m_Entries.size(); }
+
+	const SCacheStats& GetStats() const { return m_Stats; }
+	void ResetStats();
+
+
+private:
+	struct SEntry
+	{
+		std::uint64_t key;
+		int y0;
+		int y1;
+		//! \see Encode()
+		std::vector<std::uint32_t> codes;
+	};
+	typedef std::list<SEntry> entries_t;
+
+	static std::uint64_t Key(float wi, int width, int height);
+
+	//! \brief Appends the pixels as runs and literals: a code word with
+	//!        RUN_BIT and a count, then the color, or a word of a count
+	//!        and as many colors.
+	static void Encode(const color_t* pixels, std::size_t n, std::vector<std::uint32_t>& codes);
+	static void Decode(const std::vector<std::uint32_t>& codes, color_t* pixels);
+
+	//! Drops the least recently used frames until the bytes fit.
+	void Evict(std::size_t budget);
+
+
+private:
+	//! The most recent first.
+	entries_t m_Entries;
+	std::unordered_map<std::uint64_t, entries_t::iterator> m_Index;
+	std::size_t m_nBudget;
+	std::size_t m_nBytes;
+	SCacheStats m_Stats;
+	//! Codes of Insert() before they are kept, reused.
+	std::vector<std::uint32_t> m_Codes;
+};
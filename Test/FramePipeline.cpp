@@ -0,0 +1,180 @@
+#include "FramePipeline.h"
+#include "FrameTrace.h"
+#include "Timer.h"
+
+#include <algorithm>
+
+
+//////////////////////////////////////////////////////////////////////////
+CFramePipeline::CFramePipeline(
+	CSphereData& data, int iWidth, int iHeight, int iTileSize, int depth) :
+	m_Data(data),
+	m_nSubmitted(0),
+	m_iRenderWidth(0),
+	m_iRenderHeight(0),
+	m_fSplatRadius(CFrameBuffer::DEFAULT_SPLAT_RADIUS),
+	m_nInFlight(0),
+	m_bStop(false)
+{
+	for (int slot = 0; slot < std::max(depth, 1); ++slot)
+	{
+		m_Slots.push_back(std::make_unique<SSlot>(iWidth, iHeight, iTileSize));
+		m_Free.push_back(slot);
+	}
+	m_Data.SetViewAspect((float)iHeight / iWidth);
+
+	m_PrepareThread = std::thread(&CFramePipeline::PrepareThread, this);
+	m_RasterThread = std::thread(&CFramePipeline::RasterThread, this);
+}
+
+
+CFramePipeline::~CFramePipeline()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_bStop = true;
+	}
+	m_Changed.notify_all();
+	m_PrepareThread.join();
+	m_RasterThread.join();
+}
+
+
+void CFramePipeline::SetRenderSize(int iWidth, int iHeight, float fSplatRadius)
+{
+	m_iRenderWidth = iWidth;
+	m_iRenderHeight = iHeight;
+	m_fSplatRadius = fSplatRadius;
+}
+
+
+bool CFramePipeline::Submit(float wi)
+{
+	int slot;
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		// only the stages can free a slot
+		if (m_Free.empty() && m_nInFlight == 0) {
+			return false;
+		}
+		m_Changed.wait(lock, [this]() { return !m_Free.empty(); });
+		slot = m_Free.front();
+		m_Free.pop_front();
+		++m_nInFlight;
+	}
+
+	// a free slot is of no stage
+	SSlot& s = *m_Slots[slot];
+	if (m_iRenderWidth > 0 &&
+		(s.fb.GetWidth() != m_iRenderWidth || s.fb.GetHeight() != m_iRenderHeight))
+	{
+		s.fb.Resize(m_iRenderWidth, m_iRenderHeight);
+		s.fb.SetSplatRadius(m_fSplatRadius);
+	}
+	s.info = {};
+	s.info.wi = wi;
+	s.info.frame = m_nSubmitted++;
+	s.info.traceFrame = CFrameTrace::Get().NewFrameId();
+	s.tSubmit = Timer::GetMillisFloat();
+	Push(m_Prepare, slot);
+	return true;
+}
+
+
+int CFramePipeline::GetInFlight() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_nInFlight;
+}
+
+
+int CFramePipeline::Acquire(SPipelineFrame* frame)
+{
+	int slot;
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		if (m_nInFlight == 0) {
+			return -1;
+		}
+		m_Changed.wait(lock, [this]() { return !m_Ready.empty(); });
+		slot = m_Ready.front();
+		m_Ready.pop_front();
+		--m_nInFlight;
+	}
+
+	if (frame) {
+		*frame = m_Slots[slot]->info;
+	}
+	return slot;
+}
+
+
+void CFramePipeline::Release(int slot)
+{
+	Push(m_Free, slot);
+}
+
+
+int CFramePipeline::Pop(std::deque<int>& queue)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Changed.wait(lock, [&]() { return m_bStop || !queue.empty(); });
+	if (m_bStop) {
+		return -1;
+	}
+	const int slot = queue.front();
+	queue.pop_front();
+	return slot;
+}
+
+
+void CFramePipeline::Push(std::deque<int>& queue, int slot)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		queue.push_back(slot);
+	}
+	m_Changed.notify_all();
+}
+
+
+void CFramePipeline::PrepareThread()
+{
+	TRACE_THREAD_NAME("prepare");
+	for (int slot; (slot = Pop(m_Prepare)) >= 0; )
+	{
+		SSlot& s = *m_Slots[slot];
+		CFrameTrace::Get().SetThreadFrame(s.info.traceFrame);
+		const double t0 = Timer::GetMillisFloat();
+		m_Data.Transform(s.info.wi);
+		const double t1 = Timer::GetMillisFloat();
+		m_Data.Sort();
+		const double t2 = Timer::GetMillisFloat();
+		m_Data.MakeRenderList(s.info.wi, s.list);
+		const double t3 = Timer::GetMillisFloat();
+		s.info.transform = t1 - t0;
+		s.info.sort = t2 - t1;
+		s.info.project = t3 - t2;
+		Push(m_Raster, slot);
+	}
+}
+
+
+void CFramePipeline::RasterThread()
+{
+	TRACE_THREAD_NAME("raster");
+	for (int slot; (slot = Pop(m_Raster)) >= 0; )
+	{
+		SSlot& s = *m_Slots[slot];
+		CFrameTrace::Get().SetThreadFrame(s.info.traceFrame);
+		const double t0 = Timer::GetMillisFloat();
+		s.fb.Clear();
+		const double t1 = Timer::GetMillisFloat();
+		m_Data.Rasterize(s.fb, s.list);
+		const double t2 = Timer::GetMillisFloat();
+		s.info.clear = t1 - t0;
+		s.info.rasterize = t2 - t1;
+		s.info.latency = t2 - s.tSubmit;
+		Push(m_Ready, slot);
+	}
+}
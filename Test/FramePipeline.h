@@ -0,0 +1,134 @@
+#pragma once
+
+#include "SphereData.h"
+#include "FrameBuffer.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//! \brief Frame of CFramePipeline given to the caller.
+struct SPipelineFrame
+{
+	float wi;
+	//! Number of Submit().
+	unsigned int frame;
+	//! Id of its zones, see CFrameTrace::AddFrameZones().
+	unsigned int traceFrame;
+	//! Stage durations, ms: Transform(), Sort() and MakeRenderList()
+	//! of the prepare thread, Clear() and Rasterize() of the raster one.
+	double transform;
+	double sort;
+	double project;
+	double clear;
+	double rasterize;
+	//! From Submit() to the end of the rasterization, ms.
+	double latency;
+};
+
+
+//! \brief Runs the frames of CSphereData as a pipeline of stages.
+//! A frame is a slot with its own frame buffer and render list. The
+//! prepare thread transforms, sorts and projects frame N+1 while the
+//! raster thread draws frame N into another slot and the caller shows
+//! frame N-1. The frames come out in the order of Submit().
+//!
+//! The depth is the number of slots: 1 is the sequential Render(),
+//! more slots let more frames be in flight at the cost of latency.
+//! \warning The pipeline owns the CSphereData stages while frames are
+//!          in flight, don't call its Transform() or Sort() meanwhile.
+class CFramePipeline
+{
+public:
+	//! Preparing, rasterizing and a shown frame.
+	static constexpr int DEFAULT_DEPTH = 3;
+
+
+public:
+	CFramePipeline(
+		CSphereData& data,
+		int iWidth,
+		int iHeight,
+		int iTileSize = CFrameBuffer::DEFAULT_TILE_SIZE,
+		int depth = DEFAULT_DEPTH);
+	~CFramePipeline();
+
+	CFramePipeline(const CFramePipeline&) = delete;
+	CFramePipeline& operator=(const CFramePipeline&) = delete;
+
+	int GetDepth() const { return (int)m_Slots.size(); }
+
+	//! \brief Frame buffer of a slot, 0 .. GetDepth() - 1.
+	//! Set Hi-Z, kernel and so on for every slot before Submit().
+	CFrameBuffer& GetFrameBuffer(int slot) { return m_Slots[slot]->fb; }
+	const CFrameBuffer& GetFrameBuffer(int slot) const { return m_Slots[slot]->fb; }
+
+	//! \brief Size and splat radius of the frames submitted from now on,
+	//!        a slot is resized when Submit() takes it.
+	//! Until it's called the slots keep their own.
+	//! \see CQualityController
+	void SetRenderSize(int iWidth, int iHeight, float fSplatRadius);
+
+	//! \brief Queues a frame of the turntable angle, waits for a free slot.
+	//! \return false when every slot is held by the caller.
+	bool Submit(float wi);
+
+	//! Submitted frames not acquired yet.
+	int GetInFlight() const;
+
+	//! \brief Waits for the oldest frame in flight to be rasterized.
+	//! \return Its slot, held until Release(), or -1 when nothing
+	//!         is in flight.
+	int Acquire(SPipelineFrame* frame = nullptr);
+	void Release(int slot);
+
+
+private:
+	struct SSlot
+	{
+		SSlot(int iWidth, int iHeight, int iTileSize) :
+			fb(iWidth, iHeight, iTileSize), info(), tSubmit(0)
+		{
+		}
+
+		CFrameBuffer fb;
+		std::vector<FrameRenderElement> list;
+		SPipelineFrame info;
+		double tSubmit;
+	};
+
+	void PrepareThread();
+	void RasterThread();
+
+	//! Waits for a slot of the queue, -1 when stopped.
+	int Pop(std::deque<int>& queue);
+	void Push(std::deque<int>& queue, int slot);
+
+
+private:
+	CSphereData& m_Data;
+	std::vector< std::unique_ptr<SSlot> > m_Slots;
+	unsigned int m_nSubmitted;
+	//! Of SetRenderSize(), 0 when not set.
+	int m_iRenderWidth;
+	int m_iRenderHeight;
+	float m_fSplatRadius;
+
+	//! Slots move free -> prepare -> raster -> ready -> held -> free.
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_Changed;
+	std::deque<int> m_Free;
+	std::deque<int> m_Prepare;
+	std::deque<int> m_Raster;
+	std::deque<int> m_Ready;
+	//! Frames between Submit() and Acquire().
+	int m_nInFlight;
+	bool m_bStop;
+
+	std::thread m_PrepareThread;
+	std::thread m_RasterThread;
+};
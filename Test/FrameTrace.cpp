@@ -0,0 +1,386 @@
+// fopen() is portable, skip MSVC's *_s() advice
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "FrameTrace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+
+
+namespace {
+
+//! The zones of the thread, set by GetThreadZones().
+thread_local void* g_pThreadZones = nullptr;
+//! See SetThreadFrame().
+thread_local unsigned int g_iThreadFrame = CFrameTrace::NO_FRAME;
+
+//! A name as a JSON or CSV string, quoted.
+std::string Quote(const char* sz)
+{
+	std::string s = "\"";
+	for (; *sz; ++sz)
+	{
+		if (*sz == '"' || *sz == '\\') {
+			s += '\\';
+		}
+		s += *sz;
+	}
+	return s + "\"";
+}
+
+//! Milliseconds of the timer to microseconds of the trace events.
+double ToMicros(double t, double tStart)
+{
+	return (t - tStart) * 1000.0;
+}
+
+} // namespace
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+CFrameTrace& CFrameTrace::Get()
+{
+	static CFrameTrace trace;
+	return trace;
+}
+
+
+CFrameTrace::CFrameTrace() :
+	m_bEnabled(false),
+	m_tStart(0),
+	m_bInFrame(false),
+	m_nNextFrameId(0)
+{
+}
+
+
+void CFrameTrace::Enable(bool v)
+{
+	if (v && !IsEnabled() && m_Frames.empty()) {
+		m_tStart = Timer::GetMillisFloat();
+	}
+	m_bEnabled = v;
+}
+
+
+void CFrameTrace::Clear()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	for (auto& thread : m_Threads)
+	{
+		thread->zones.clear();
+		thread->dropped = 0;
+	}
+	m_Frames.clear();
+	m_bInFrame = false;
+	m_tStart = Timer::GetMillisFloat();
+}
+
+
+void CFrameTrace::SetThreadName(const char* szName)
+{
+	GetThreadZones().name = szName;
+}
+
+
+CFrameTrace::SThreadZones& CFrameTrace::GetThreadZones()
+{
+	if (!g_pThreadZones)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Threads.push_back(std::make_unique<SThreadZones>());
+		SThreadZones& thread = *m_Threads.back();
+		thread.name = "thread " + std::to_string(m_Threads.size() - 1);
+		thread.dropped = 0;
+		g_pThreadZones = &thread;
+	}
+	return *static_cast<SThreadZones*>(g_pThreadZones);
+}
+
+
+void CFrameTrace::AddZone(const char* szName, double tBegin, double tEnd)
+{
+	SThreadZones& thread = GetThreadZones();
+	if (thread.zones.size() < MAX_ZONES_PER_THREAD) {
+		thread.zones.push_back({ szName, tBegin, tEnd, g_iThreadFrame });
+	}
+	else {
+		++thread.dropped;
+	}
+}
+
+
+void CFrameTrace::BeginFrame()
+{
+	if (!IsEnabled()) {
+		return;
+	}
+	const unsigned int id = NewFrameId();
+	const double t = Timer::GetMillisFloat();
+	m_Frames.push_back({ (unsigned int)m_Frames.size(), { id }, t, t, {} });
+	m_bInFrame = true;
+	SetThreadFrame(id);
+}
+
+
+void CFrameTrace::EndFrame()
+{
+	if (!m_bInFrame) {
+		return;
+	}
+	m_Frames.back().tEnd = Timer::GetMillisFloat();
+	m_bInFrame = false;
+	SetThreadFrame(NO_FRAME);
+}
+
+
+unsigned int CFrameTrace::NewFrameId()
+{
+	return m_nNextFrameId++;
+}
+
+
+void CFrameTrace::SetThreadFrame(unsigned int id)
+{
+	g_iThreadFrame = id;
+}
+
+
+unsigned int CFrameTrace::GetThreadFrame() const
+{
+	return g_iThreadFrame;
+}
+
+
+void CFrameTrace::AddFrameZones(unsigned int id)
+{
+	if (IsEnabled() && !m_Frames.empty()) {
+		m_Frames.back().ids.push_back(id);
+	}
+}
+
+
+void CFrameTrace::Counter(const char* szName, double value)
+{
+	if (IsEnabled() && !m_Frames.empty()) {
+		m_Frames.back().counters.emplace_back(szName, value);
+	}
+}
+
+
+void CFrameTrace::RasterCounters(
+	const CFrameBuffer& fb, const CFrameBuffer::SRasterStats& stats)
+{
+	if (!IsEnabled() || m_Frames.empty()) {
+		return;
+	}
+
+	// pixels of the image, the writes above them are the overdraw
+	int y0, y1;
+	fb.GetDrawnRows(y0, y1);
+	const CFrameBuffer::color_t* color = fb.GetFrameBuffer();
+	std::size_t drawn = 0;
+	for (std::size_t i = (std::size_t)y0 * fb.GetWidth();
+		i < (std::size_t)y1 * fb.GetWidth(); ++i)
+	{
+		drawn += (color[i] != CFrameBuffer::UNDEFINED_COLOR);
+	}
+
+	const std::size_t rastered =
+		stats.spheres - stats.spheresCulled - stats.spheresSplatted;
+	Counter("tile visits", (double)stats.spheres);
+	Counter("tile visits culled", (double)stats.spheresCulled);
+	Counter("tile visits drawn", (double)(stats.spheres - stats.spheresCulled));
+	Counter("tile visits splatted", (double)stats.spheresSplatted);
+	Counter("pixels tested", (double)stats.pixelsTested);
+	Counter("pixels shaded", (double)stats.pixelsShaded);
+	Counter("pixels written", (double)stats.pixelsWritten);
+	Counter("overdraw", drawn ? (double)stats.pixelsWritten / drawn : 0.0);
+	Counter("impostor hit rate",
+		rastered ? (double)stats.spheresImpostor / rastered : 0.0);
+}
+
+
+std::size_t CFrameTrace::GetDroppedZones() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	std::size_t dropped = 0;
+	for (const auto& thread : m_Threads) {
+		dropped += thread->dropped;
+	}
+	return dropped;
+}
+
+
+bool CFrameTrace::WriteChromeTrace(const char* szFilename) const
+{
+	FILE* f = fopen(szFilename, "w");
+	if (!f) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	const char* szSeparator = "\n";
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (std::size_t k = 0; k < m_Threads.size(); ++k)
+	{
+		const SThreadZones& thread = *m_Threads[k];
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,"
+			"\"args\":{\"name\":%s}}",
+			szSeparator, k, Quote(thread.name.c_str()).c_str());
+		szSeparator = ",\n";
+		for (const SZone& zone : thread.zones)
+		{
+			fprintf(f, ",\n{\"name\":%s,\"ph\":\"X\",\"pid\":1,\"tid\":%zu,"
+				"\"ts\":%.3f,\"dur\":%.3f}",
+				Quote(zone.szName).c_str(), k,
+				ToMicros(zone.tBegin, m_tStart),
+				(zone.tEnd - zone.tBegin) * 1000.0);
+		}
+	}
+
+	// frames on a row of their own, counters as graphs
+	const std::size_t frameTid = m_Threads.size();
+	fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,"
+		"\"args\":{\"name\":\"frames\"}}", szSeparator, frameTid);
+	for (const SFrame& frame : m_Frames)
+	{
+		fprintf(f, ",\n{\"name\":\"frame %u\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,"
+			"\"ts\":%.3f,\"dur\":%.3f}",
+			frame.index, frameTid,
+			ToMicros(frame.tBegin, m_tStart),
+			(frame.tEnd - frame.tBegin) * 1000.0);
+		for (const auto& counter : frame.counters)
+		{
+			fprintf(f, ",\n{\"name\":%s,\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,"
+				"\"args\":{\"value\":%.6g}}",
+				Quote(counter.first).c_str(),
+				ToMicros(frame.tEnd, m_tStart),
+				counter.second);
+		}
+	}
+	fprintf(f, "\n]}\n");
+
+	const bool ok = !ferror(f);
+	return (fclose(f) == 0) && ok;
+}
+
+
+bool CFrameTrace::WriteCsv(const char* szFilename) const
+{
+	FILE* f = fopen(szFilename, "w");
+	if (!f) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	// columns in the order of appearance; the names are literals, a
+	// pointer is matched by its text once
+	std::vector<const char*> zoneNames;
+	std::vector<const char*> counterNames;
+	std::unordered_map<const char*, std::size_t> zoneColumns;
+	std::unordered_map<const char*, std::size_t> counterColumns;
+	const auto Column = [](std::vector<const char*>& names,
+		std::unordered_map<const char*, std::size_t>& columns, const char* szName)
+	{
+		const auto it = columns.find(szName);
+		if (it != columns.end()) {
+			return it->second;
+		}
+		std::size_t k = 0;
+		while (k < names.size() && strcmp(names[k], szName)) {
+			++k;
+		}
+		if (k == names.size()) {
+			names.push_back(szName);
+		}
+		columns.emplace(szName, k);
+		return k;
+	};
+	for (const auto& thread : m_Threads) {
+		for (const SZone& zone : thread->zones) {
+			Column(zoneNames, zoneColumns, zone.szName);
+		}
+	}
+	for (const SFrame& frame : m_Frames) {
+		for (const auto& counter : frame.counters) {
+			Column(counterNames, counterColumns, counter.first);
+		}
+	}
+
+	// the zones of every frame, summed over the threads: by the frame
+	// id, else by the frame started before them
+	std::unordered_map<unsigned int, std::size_t> rows;
+	for (std::size_t k = 0; k < m_Frames.size(); ++k) {
+		for (unsigned int id : m_Frames[k].ids) {
+			rows.emplace(id, k);
+		}
+	}
+	const std::size_t nZoneColumns = zoneNames.size();
+	std::vector<double> zoneTimes(m_Frames.size() * nZoneColumns, 0.0);
+	for (const auto& thread : m_Threads)
+	{
+		for (const SZone& zone : thread->zones)
+		{
+			std::size_t row;
+			if (zone.frame != NO_FRAME)
+			{
+				const auto it = rows.find(zone.frame);
+				if (it == rows.end()) {
+					continue;
+				}
+				row = it->second;
+			}
+			else
+			{
+				const auto it = std::upper_bound(m_Frames.begin(), m_Frames.end(),
+					zone.tBegin, [](double t, const SFrame& frame) {
+						return t < frame.tBegin;
+					});
+				if (it == m_Frames.begin() || zone.tBegin >= (it - 1)->tEnd) {
+					continue;
+				}
+				row = (it - 1) - m_Frames.begin();
+			}
+			zoneTimes[row * nZoneColumns + zoneColumns[zone.szName]] +=
+				zone.tEnd - zone.tBegin;
+		}
+	}
+
+	fprintf(f, "frame,start ms,frame ms");
+	for (const char* szName : zoneNames) {
+		fprintf(f, ",%s", Quote((std::string(szName) + " ms").c_str()).c_str());
+	}
+	for (const char* szName : counterNames) {
+		fprintf(f, ",%s", Quote(szName).c_str());
+	}
+	fprintf(f, "\n");
+
+	std::vector<double> counters;
+	for (std::size_t k = 0; k < m_Frames.size(); ++k)
+	{
+		const SFrame& frame = m_Frames[k];
+		counters.assign(counterNames.size(), 0);
+		for (const auto& counter : frame.counters) {
+			counters[counterColumns[counter.first]] = counter.second;
+		}
+
+		fprintf(f, "%u,%.3f,%.3f", frame.index,
+			frame.tBegin - m_tStart, frame.tEnd - frame.tBegin);
+		for (std::size_t c = 0; c < nZoneColumns; ++c) {
+			fprintf(f, ",%.3f", zoneTimes[k * nZoneColumns + c]);
+		}
+		for (double v : counters) {
+			fprintf(f, ",%.6g", v);
+		}
+		fprintf(f, "\n");
+	}
+
+	const bool ok = !ferror(f);
+	return (fclose(f) == 0) && ok;
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "FrameBuffer.h"
+#include "../Timer.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+//! The zones are compiled in unless the build defines it as 0,
+//! then TRACE_ZONE() and TRACE_THREAD_NAME() are nothing.
+#ifndef SPHEREDATA_TRACE
+#define SPHEREDATA_TRACE 1
+#endif
+
+
+//! \brief Timeline of the frames: scoped zones of the stages on every
+//!        thread and counters of every frame.
+//! A thread appends its zones to its own buffer without locks, so the
+//! zones of the tiles on the workers cost two timer reads each. While
+//! the trace is off a zone is a test of a flag.
+//!
+//! The timeline is saved as Chrome trace events, for chrome://tracing
+//! or ui.perfetto.dev, and as CSV with a row per frame: the time of
+//! every zone name summed over the threads, and the counters.
+//!
+//! A zone belongs to the frame id of its thread when it ends, see
+//! SetThreadFrame(), else to the frame it starts in. The scheduler
+//! gives its workers the id of the caller of a loop.
+//! \warning Enable(), Clear() and the writers are not for the time
+//!          frames are drawn in other threads.
+class CFrameTrace
+{
+public:
+	//! Zones kept per thread, the later ones are dropped.
+	static constexpr std::size_t MAX_ZONES_PER_THREAD = 1 << 20;
+	//! Frame id of the zones outside of the frames.
+	static constexpr unsigned int NO_FRAME = ~0u;
+
+
+public:
+	//! The trace of the renderer.
+	static CFrameTrace& Get();
+
+	bool IsEnabled() const { return m_bEnabled.load(std::memory_order_relaxed); }
+	void Enable(bool v);
+	//! Drops the zones and frames, the time starts anew.
+	void Clear();
+
+	//! Name of the calling thread in the timeline.
+	void SetThreadName(const char* szName);
+
+	//! \brief Frame of the calling thread: zones started between the
+	//!        calls belong to it in the CSV.
+	//! The frame takes a new id for the zones of the calling thread.
+	void BeginFrame();
+	void EndFrame();
+
+	//! Id of a frame drawn by other threads, see AddFrameZones().
+	unsigned int NewFrameId();
+	//! \brief Frame id of the zones the calling thread ends from now on.
+	//! NO_FRAME puts them in the frame of their start.
+	void SetThreadFrame(unsigned int id);
+	unsigned int GetThreadFrame() const;
+	//! \brief The zones of the frame id belong to the last frame too,
+	//!        as those of a frame of CFramePipeline acquired in it.
+	void AddFrameZones(unsigned int id);
+	//! \brief Value of the last frame, also after its EndFrame().
+	//! \param szName A literal, kept by the pointer.
+	void Counter(const char* szName, double value);
+
+	//! \brief Counters of a frame: tile visits of the spheres, culled
+	//!        and drawn, pixels tested, shaded and written, overdraw and
+	//!        impostor hit rate.
+	//! A sphere visits every tile it covers, see SRasterStats.
+	//! Counts the drawn pixels of the frame buffer for the overdraw.
+	void RasterCounters(const CFrameBuffer&, const CFrameBuffer::SRasterStats&);
+
+	std::size_t GetFrameCount() const { return m_Frames.size(); }
+	std::size_t GetDroppedZones() const;
+
+	//! \return false when the file can't be written.
+	bool WriteChromeTrace(const char* szFilename) const;
+	bool WriteCsv(const char* szFilename) const;
+
+	//! \param szName A literal, kept by the pointer.
+	void AddZone(const char* szName, double tBegin, double tEnd);
+
+
+private:
+	CFrameTrace();
+
+	struct SZone
+	{
+		const char* szName;
+		double tBegin;
+		double tEnd;
+		unsigned int frame;
+	};
+
+	struct SThreadZones
+	{
+		std::string name;
+		std::vector<SZone> zones;
+		std::size_t dropped;
+	};
+
+	struct SFrame
+	{
+		unsigned int index;
+		//! Frame ids of its zones, its own first.
+		std::vector<unsigned int> ids;
+		double tBegin;
+		double tEnd;
+		std::vector< std::pair<const char*, double> > counters;
+	};
+
+	//! Buffer of the calling thread, made on its first zone.
+	SThreadZones& GetThreadZones();
+
+
+private:
+	std::atomic<bool> m_bEnabled;
+	double m_tStart;
+
+	//! Guards the list of the threads, not their zones.
+	mutable std::mutex m_Mutex;
+	std::vector< std::unique_ptr<SThreadZones> > m_Threads;
+
+	std::vector<SFrame> m_Frames;
+	bool m_bInFrame;
+	std::atomic<unsigned int> m_nNextFrameId;
+};
+
+
+
+
+//! \brief Zone of the scope, see TRACE_ZONE().
+class CTraceZone
+{
+public:
+	explicit CTraceZone(const char* szName) :
+		m_szName(szName),
+		m_tBegin(CFrameTrace::Get().IsEnabled() ? Timer::GetMillisFloat() : -1)
+	{
+	}
+
+	~CTraceZone()
+	{
+		if (m_tBegin >= 0) {
+			CFrameTrace::Get().AddZone(m_szName, m_tBegin, Timer::GetMillisFloat());
+		}
+	}
+
+	CTraceZone(const CTraceZone&) = delete;
+	CTraceZone& operator=(const CTraceZone&) = delete;
+
+
+private:
+	const char* m_szName;
+	double m_tBegin;
+};
+
+
+#if SPHEREDATA_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+//! Zone from here to the end of the scope, the name is a literal.
+#define TRACE_ZONE(szName) CTraceZone TRACE_CONCAT(traceZone, __LINE__)(szName)
+#define TRACE_THREAD_NAME(szName) CFrameTrace::Get().SetThreadName(szName)
+#else
+#define TRACE_ZONE(szName) ((void)0)
+#define TRACE_THREAD_NAME(szName) ((void)0)
+#endif
@@ -0,0 +1,133 @@
+#include "ImpostorCache.h"
+
+#include <math.h>
+#include <algorithm>
+
+
+namespace {
+
+//! The span kernels load whole registers, the tail of the last row
+//! reads this far past it.
+const int PADDING = 8;
+
+} // namespace
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+std::size_t CImpostorCache::SImpostor::Bytes() const
+{
+	return sizeof(*this) +
+		rowWidth.size() * sizeof(int) +
+		rowCenter.size() * sizeof(std::size_t) +
+		(dist.size() + nz.size()) * sizeof(float);
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+CImpostorCache::CImpostorCache(std::size_t budget) :
+	m_Table(MAX_RADIUS * STEPS_PER_PIXEL + 1),
+	m_nBytes(0),
+	m_nImpostors(0),
+	m_nBudget(budget)
+{
+}
+
+
+CImpostorCache::~CImpostorCache()
+{
+	for (auto& impostor : m_Table) {
+		delete impostor.load();
+	}
+}
+
+
+int CImpostorCache::Key(float radius)
+{
+	return std::max((int)ceilf(radius * STEPS_PER_PIXEL), 1);
+}
+
+
+const CImpostorCache::SImpostor* CImpostorCache::Find(float radius) const
+{
+	const int key = Key(radius);
+	if (key >= (int)m_Table.size()) {
+		return nullptr;
+	}
+	return m_Table[key].load(std::memory_order_acquire);
+}
+
+
+void CImpostorCache::Prebuild(float rMin, float rMax)
+{
+	if (rMin > rMax) {
+		return;
+	}
+
+	std::lock_guard< std::mutex > lock(m_Mutex);
+	const int last = std::min(Key(rMax), (int)m_Table.size() - 1);
+	for (int key = Key(rMin); key <= last; ++key)
+	{
+		if (m_Table[key].load(std::memory_order_relaxed)) {
+			continue;
+		}
+
+		SImpostor* impostor = Build(key);
+		const std::size_t bytes = impostor->Bytes();
+		if (m_nBytes + bytes > m_nBudget)
+		{
+			// the bigger ones don't fit too
+			delete impostor;
+			return;
+		}
+		m_nBytes += bytes;
+		++m_nImpostors;
+		m_Table[key].store(impostor, std::memory_order_release);
+	}
+}
+
+
+CImpostorCache::SImpostor* CImpostorCache::Build(int key)
+{
+	SImpostor* impostor = new SImpostor;
+	const float radius = (float)key / STEPS_PER_PIXEL;
+	// exact: the key fits in 10 bits
+	const float radius2 = radius * radius;
+	impostor->radius = radius;
+	impostor->invRadius = 1 / radius;
+	impostor->rows = (int)radius;
+
+	const int rows = impostor->rows;
+	impostor->rowWidth.resize(rows * 2 + 1);
+	impostor->rowCenter.resize(rows * 2 + 1);
+	std::size_t size = 0;
+	for (int dy = -rows; dy <= rows; ++dy)
+	{
+		int width = 0;
+		while ((width + 1) * (width + 1) + dy * dy <= radius2) {
+			++width;
+		}
+		impostor->rowWidth[dy + rows] = width;
+		impostor->rowCenter[dy + rows] = size + width;
+		size += width * 2 + 1;
+	}
+
+	impostor->dist.resize(size + PADDING, 0);
+	impostor->nz.resize(size + PADDING, 0);
+	for (int dy = -rows; dy <= rows; ++dy)
+	{
+		const int width = impostor->rowWidth[dy + rows];
+		const std::size_t center = impostor->rowCenter[dy + rows];
+		for (int dx = -width; dx <= width; ++dx)
+		{
+			const float d2 = (float)(dx * dx + dy * dy);
+			impostor->dist[center + dx] = sqrtf(d2);
+			impostor->nz[center + dx] = sqrtf(radius2 - d2) / radius;
+		}
+	}
+
+	return impostor;
+}
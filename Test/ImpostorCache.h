@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+
+//! \brief Circles of spheres precomputed by a quantized radius in pixels.
+//! An entry keeps the rows of the circle and, for every pixel, the
+//! distance to the center (the depth offset) and the z of the unit normal,
+//! so the span kernels don't compute sqrtf() and normalize per pixel.
+//! \warning Find() is lock-free and may run with Prebuild() in other
+//!          threads. The entries live until the cache is destroyed.
+class CImpostorCache
+{
+public:
+	//! Radius quantization, entries per pixel of radius.
+	static constexpr int STEPS_PER_PIXEL = 8;
+	//! Bigger spheres are drawn without an impostor.
+	static constexpr int MAX_RADIUS = 64;
+	//! Limit for all entries, bytes.
+	static constexpr std::size_t DEFAULT_MEMORY_BUDGET = 32u << 20;
+
+	struct SImpostor
+	{
+		//! Quantized up, not less than the radius of a sphere it draws.
+		float radius;
+		float invRadius;
+		//! Rows dy are [-rows..rows].
+		int rows;
+		//! The widest dx of a row: dx^2 + dy^2 <= radius^2.
+		//! Indexed by dy + rows as rowCenter.
+		std::vector< int > rowWidth;
+		//! Index of the pixel dx = 0 of a row in dist and nz.
+		std::vector< std::size_t > rowCenter;
+		//! sqrt(dx^2 + dy^2) of the pixels, row by row.
+		std::vector< float > dist;
+		//! sqrt(radius^2 - dx^2 - dy^2) / radius, the normal is
+		//! (dx / radius, dy / radius, nz).
+		std::vector< float > nz;
+
+		std::size_t Bytes() const;
+	};
+
+
+public:
+	explicit CImpostorCache(std::size_t budget = DEFAULT_MEMORY_BUDGET);
+	~CImpostorCache();
+
+	CImpostorCache(const CImpostorCache&) = delete;
+	CImpostorCache& operator=(const CImpostorCache&) = delete;
+
+	//! \return The entry for a sphere of the radius or nullptr when
+	//!         it isn't built.
+	const SImpostor* Find(float radius) const;
+
+	//! Builds the missing entries for the radii [rMin..rMax] while
+	//! the budget allows, from the small ones.
+	void Prebuild(float rMin, float rMax);
+
+	std::size_t GetMemoryUsed() const { return m_nBytes; }
+	std::size_t GetMemoryBudget() const { return m_nBudget; }
+	//! Built entries.
+	int Size() const { return m_nImpostors; }
+
+
+private:
+	//! Index of the smallest quantized radius >= radius.
+	static int Key(float radius);
+
+	static SImpostor* Build(int key);
+
+
+private:
+	//! Published with release, read with acquire by Find().
+	std::vector< std::atomic< const SImpostor* > > m_Table;
+	//! Serializes Prebuild().
+	std::mutex m_Mutex;
+	std::atomic< std::size_t > m_nBytes;
+	std::atomic< int > m_nImpostors;
+	std::size_t m_nBudget;
+};
@@ -0,0 +1,141 @@
+#include "Lighting.h"
+#include "FrameBuffer.h"
+#include "ShadingModels.h"
+
+#include <math.h>
+#include <algorithm>
+
+
+//! Points of [0..1] of MeasureSpecularError().
+static constexpr int ERROR_SAMPLES = 1 << 16;
+
+
+template <ESpecularPow POW>
+static float MaxSpecularError(const SLightSet& set)
+{
+	typedef SimdScalar::f f;
+	const f shininess = f::set1(set.shininess);
+	float error = 0;
+	for (int k = 0; k <= ERROR_SAMPLES; ++k)
+	{
+		const float x = (float)k / ERROR_SAMPLES;
+		const float v = SpecularPow<SimdScalar, POW>(set, shininess, f::set1(x)).v;
+		error = std::max(error, fabsf(v - powf(x, set.shininess)));
+	}
+	return error;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+CLighting::CLighting() :
+	m_Set()
+{
+	m_Set.count = 0;
+	m_Set.ambient = DEFAULT_AMBIENT;
+	m_Set.pow = ESpecularPow::Fast;
+	SetShininess(DEFAULT_SHININESS);
+}
+
+
+CLighting CLighting::MakeRig(int nLights)
+{
+	CLighting lighting;
+	nLights = std::min(std::max(nLights, 0), SLightSet::MAX_LIGHTS);
+	if (nLights == 0) {
+		return lighting;
+	}
+
+	float x, y, z;
+	CFrameBuffer::GetLight(x, y, z);
+	lighting.AddLight({ x, y, z, 0.8f });
+
+	// the fills turn the key around the view axis, they add up to 0.4
+	const float angle = atan2f(y, x);
+	const float side = sqrtf(x * x + y * y);
+	for (int k = 1; k < nLights; ++k)
+	{
+		const float a = angle + 6.2831853f * k / nLights;
+		lighting.AddLight({ side * cosf(a), side * sinf(a), z, 0.4f / (nLights - 1) });
+	}
+	return lighting;
+}
+
+
+void CLighting::SetAmbient(float v)
+{
+	m_Set.ambient = std::max(v, 0.f);
+}
+
+
+bool CLighting::AddLight(const SDirectionalLight& light)
+{
+	const float length = sqrtf(light.x * light.x + light.y * light.y + light.z * light.z);
+	if (m_Set.count >= SLightSet::MAX_LIGHTS || !(length > 0)) {
+		return false;
+	}
+
+	const int k = m_Set.count++;
+	m_Set.dirX[k] = light.x / length;
+	m_Set.dirY[k] = light.y / length;
+	m_Set.dirZ[k] = light.z / length;
+	m_Set.intensity[k] = light.intensity;
+
+	// half way to the view axis
+	const float hz = m_Set.dirZ[k] + 1;
+	const float halfLength = sqrtf(m_Set.dirX[k] * m_Set.dirX[k] +
+		m_Set.dirY[k] * m_Set.dirY[k] + hz * hz);
+	m_Set.halfX[k] = m_Set.dirX[k] / halfLength;
+	m_Set.halfY[k] = m_Set.dirY[k] / halfLength;
+	m_Set.halfZ[k] = hz / halfLength;
+	return true;
+}
+
+
+void CLighting::ClearLights()
+{
+	m_Set.count = 0;
+}
+
+
+void CLighting::SetShininess(float v)
+{
+	m_Set.shininess = std::max(v, 1.f);
+	for (int k = 0; k <= SLightSet::TABLE_SIZE; ++k) {
+		m_Set.table[k] = powf((float)k / SLightSet::TABLE_SIZE, m_Set.shininess);
+	}
+	m_Set.table[SLightSet::TABLE_SIZE + 1] = m_Set.table[SLightSet::TABLE_SIZE];
+}
+
+
+float CLighting::MeasureSpecularError() const
+{
+	switch (m_Set.pow)
+	{
+	case ESpecularPow::Exact:
+		return MaxSpecularError<ESpecularPow::Exact>(m_Set);
+
+	case ESpecularPow::Table:
+		return MaxSpecularError<ESpecularPow::Table>(m_Set);
+
+	case ESpecularPow::Fast:
+		break;
+	}
+	return MaxSpecularError<ESpecularPow::Fast>(m_Set);
+}
+
+
+const char* CLighting::GetSpecularPowName(ESpecularPow v)
+{
+	switch (v)
+	{
+	case ESpecularPow::Exact:
+		return "exact";
+
+	case ESpecularPow::Fast:
+		return "fast";
+
+	case ESpecularPow::Table:
+		return "table";
+	}
+	return "?";
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+
+//! Power of the specular of the lights model.
+enum class ESpecularPow
+{
+	//! powf() lane by lane, the reference.
+	Exact,
+	//! exp2(n * log2(x)) by polynomials over the bits of the floats.
+	Fast,
+	//! Linear between the entries of a table of x^n.
+	Table
+};
+
+
+struct SDirectionalLight
+{
+	//! Direction to the light, normalized by CLighting::AddLight().
+	float x, y, z;
+	float intensity;
+};
+
+
+//! \brief The lights as the span kernels read them.
+//! \see CLighting
+struct SLightSet
+{
+	static constexpr int MAX_LIGHTS = 8;
+	static constexpr int TABLE_SIZE = 1024;
+
+	int count;
+	float ambient;
+	//! Normalized directions of the lights.
+	float dirX[MAX_LIGHTS];
+	float dirY[MAX_LIGHTS];
+	float dirZ[MAX_LIGHTS];
+	//! Normalized half vectors of the lights and the view axis.
+	float halfX[MAX_LIGHTS];
+	float halfY[MAX_LIGHTS];
+	float halfZ[MAX_LIGHTS];
+	float intensity[MAX_LIGHTS];
+	float shininess;
+	ESpecularPow pow;
+	//! x^shininess at x = k / TABLE_SIZE. The last entry is there twice,
+	//! so x = 1 interpolates inside the table.
+	float table[TABLE_SIZE + 2];
+};
+
+
+//! \brief Directional lights and an ambient term of EShadingModel::Lights.
+//! A pixel is ambient plus intensity * (N.L + (N.H)^shininess) of every
+//! light in front of it, clamped to 1. The half vectors are of the view
+//! axis, so a light costs the same on every sphere and the kernels take
+//! the lights V::N pixels at a time with no per-sphere setup.
+//!
+//! The specular power is exact, fast or by the table. The error of the
+//! table is below shininess * (shininess - 1) / (8 * TABLE_SIZE^2), of
+//! the fast one about 1e-3 up to shininess 64.
+//! \see MeasureSpecularError()
+class CLighting
+{
+public:
+	static constexpr float DEFAULT_AMBIENT = 0.1f;
+	static constexpr float DEFAULT_SHININESS = 12;
+
+
+public:
+	//! No lights, the default ambient, shininess and the fast power.
+	CLighting();
+
+	//! \brief A key light along CFrameBuffer::GetLight() and
+	//!        nLights - 1 dimmer fills around the view axis.
+	static CLighting MakeRig(int nLights);
+
+	void SetAmbient(float);
+	float GetAmbient() const { return m_Set.ambient; }
+
+	//! \return false when there are MAX_LIGHTS already.
+	bool AddLight(const SDirectionalLight&);
+	void ClearLights();
+	int GetLightCount() const { return m_Set.count; }
+
+	//! Rebuilds the table, 1 and more.
+	void SetShininess(float);
+	float GetShininess() const { return m_Set.shininess; }
+
+	void SetSpecularPow(ESpecularPow v) { m_Set.pow = v; }
+	ESpecularPow GetSpecularPow() const { return m_Set.pow; }
+
+	//! \brief Max |specular - powf()| of the power over [0..1], by the
+	//!        scalar code of the kernels.
+	float MeasureSpecularError() const;
+
+	const SLightSet& GetLightSet() const { return m_Set; }
+
+	static const char* GetSpecularPowName(ESpecularPow);
+
+
+private:
+	SLightSet m_Set;
+};
@@ -0,0 +1,113 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+// Exclude rarely-used stuff from Windows headers
+#define WIN32_LEAN_AND_MEAN
+
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////
+CMappedFile::CMappedFile() :
+	m_pData(nullptr),
+	m_nBytes(0)
+#ifdef _WIN32
+	,
+	m_hFile(INVALID_HANDLE_VALUE),
+	m_hMapping(nullptr)
+#endif
+{
+}
+
+
+CMappedFile::~CMappedFile()
+{
+	Close();
+}
+
+
+bool CMappedFile::Open(const char* szFilename)
+{
+	Close();
+
+#ifdef _WIN32
+	m_hFile = CreateFileA(szFilename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_hFile == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+	m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_hMapping)
+	{
+		Close();
+		return false;
+	}
+	m_pData = static_cast<const unsigned char*>(
+		MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_pData)
+	{
+		Close();
+		return false;
+	}
+	m_nBytes = (std::size_t)size.QuadPart;
+#else
+	const int fd = open(szFilename, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+	void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps the file
+	close(fd);
+	if (p == MAP_FAILED) {
+		return false;
+	}
+	// the readers go from start to end
+	madvise(p, st.st_size, MADV_WILLNEED);
+	m_pData = static_cast<const unsigned char*>(p);
+	m_nBytes = (std::size_t)st.st_size;
+#endif
+
+	return true;
+}
+
+
+void CMappedFile::Close()
+{
+#ifdef _WIN32
+	if (m_pData) {
+		UnmapViewOfFile(m_pData);
+	}
+	if (m_hMapping) {
+		CloseHandle(m_hMapping);
+	}
+	if (m_hFile != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_hFile);
+	}
+	m_hMapping = nullptr;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if (m_pData) {
+		munmap(const_cast<unsigned char*>(m_pData), m_nBytes);
+	}
+#endif
+	m_pData = nullptr;
+	m_nBytes = 0;
+}
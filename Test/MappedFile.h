@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+
+
+//! \brief Read-only memory mapping of a whole file.
+class CMappedFile
+{
+public:
+	CMappedFile();
+	~CMappedFile();
+
+	CMappedFile(const CMappedFile&) = delete;
+	CMappedFile& operator=(const CMappedFile&) = delete;
+
+	//! \return false when the file can't be opened or is empty.
+	bool Open(const char* szFilename);
+	void Close();
+	bool IsOpen() const { return m_pData != nullptr; }
+
+	//! Valid until Close().
+	const unsigned char* GetData() const { return m_pData; }
+	std::size_t GetSize() const { return m_nBytes; }
+
+
+private:
+	const unsigned char* m_pData;
+	std::size_t m_nBytes;
+#ifdef _WIN32
+	void* m_hFile;
+	void* m_hMapping;
+#endif
+};
@@ -0,0 +1,119 @@
+#include "QualityController.h"
+#include "FrameBuffer.h"
+
+#include <algorithm>
+#include <iterator>
+
+
+namespace {
+
+//! From the full quality down. A level is about 3/4 of the pixels of
+//! the one above, the splats grow up to CFrameBuffer::MAX_SPLAT_RADIUS.
+const CQualityController::SQualityLevel LEVELS[] = {
+	{ 1.f, 1.f },
+	{ 0.875f, 1.25f },
+	{ 0.75f, 1.5f },
+	{ 0.625f, 1.75f },
+	{ 0.5f, 2.f },
+};
+
+} // namespace
+
+
+CQualityController::CQualityController(double targetMs) :
+	m_fTargetMs(targetMs)
+{
+	Reset();
+}
+
+
+void CQualityController::SetTarget(double ms)
+{
+	m_fTargetMs = ms;
+	m_nHistory = 0;
+	m_iNext = 0;
+}
+
+
+void CQualityController::Reset()
+{
+	m_iLevel = 0;
+	m_nHistory = 0;
+	m_iNext = 0;
+	m_nChanges = 0;
+}
+
+
+bool CQualityController::AddFrame(double ms)
+{
+	m_History[m_iNext] = ms;
+	m_iNext = (m_iNext + 1) % HISTORY;
+	m_nHistory = std::min(m_nHistory + 1, HISTORY);
+	if (m_nHistory < HISTORY) {
+		return false;
+	}
+
+	const double average = GetAverage();
+	if (average > m_fTargetMs * DOWN_RATIO && m_iLevel + 1 < GetLevelCount())
+	{
+		SetLevel(m_iLevel + 1);
+		return true;
+	}
+	if (m_iLevel > 0)
+	{
+		// as if all the time was of the pixels, more than it is
+		const float ratio = LEVELS[m_iLevel - 1].scale / LEVELS[m_iLevel].scale;
+		if (average * ratio * ratio < m_fTargetMs * UP_RATIO)
+		{
+			SetLevel(m_iLevel - 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+
+int CQualityController::GetLevelCount()
+{
+	return (int)std::size(LEVELS);
+}
+
+
+const CQualityController::SQualityLevel& CQualityController::GetQuality(int level)
+{
+	return LEVELS[std::min(std::max(level, 0), GetLevelCount() - 1)];
+}
+
+
+void CQualityController::GetRenderSize(
+	int iOutWidth, int iOutHeight, int& iWidth, int& iHeight) const
+{
+	const float scale = GetQuality().scale;
+	iWidth = std::max((int)(iOutWidth * scale + 0.5f), 1);
+	iHeight = std::max((int)(iOutHeight * scale + 0.5f), 1);
+}
+
+
+float CQualityController::GetSplatRadius(float fFullRadius) const
+{
+	return std::min(fFullRadius * GetQuality().splatScale, CFrameBuffer::MAX_SPLAT_RADIUS);
+}
+
+
+double CQualityController::GetAverage() const
+{
+	double sum = 0;
+	for (int k = 0; k < m_nHistory; ++k) {
+		sum += m_History[k];
+	}
+	return m_nHistory ? sum / m_nHistory : 0;
+}
+
+
+void CQualityController::SetLevel(int level)
+{
+	m_iLevel = level;
+	m_nHistory = 0;
+	m_iNext = 0;
+	++m_nChanges;
+}
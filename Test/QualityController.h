@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+
+
+//! \brief Holds a frame time by the render resolution and the splat
+//!        radius, the LOD threshold of CFrameBuffer.
+//! The frame time is the average of the last HISTORY frames. Over the
+//! target by DOWN_RATIO it drops a level; a level up is taken only when
+//! the average scaled by the pixels of the level stays under the target
+//! by UP_RATIO, so the level it would drop from again is out of reach.
+//! After a change the history restarts, the frames of the old level
+//! don't count. A frame is drawn at GetRenderSize() and scaled up to
+//! the output by UpscaleFrame().
+class CQualityController
+{
+public:
+	//! 60 frames per second.
+	static constexpr double DEFAULT_TARGET_MS = 1000.0 / 60;
+	//! Frames of the average, and at least as many after a change.
+	static constexpr int HISTORY = 16;
+	//! Average over target * DOWN_RATIO drops a level.
+	static constexpr double DOWN_RATIO = 1.1;
+	//! The cost of the level up under target * UP_RATIO takes it.
+	static constexpr double UP_RATIO = 0.8;
+
+	struct SQualityLevel
+	{
+		//! Render size by the output one.
+		float scale;
+		//! Splat radius by the one of full quality.
+		float splatScale;
+	};
+
+
+public:
+	explicit CQualityController(double targetMs = DEFAULT_TARGET_MS);
+
+	void SetTarget(double ms);
+	double GetTarget() const { return m_fTargetMs; }
+
+	//! Full quality and a new history.
+	void Reset();
+
+	//! \brief Adds the time of a frame drawn at the current level.
+	//! \return true when the level changed.
+	bool AddFrame(double ms);
+
+	//! 0 is the full quality.
+	int GetLevel() const { return m_iLevel; }
+	static int GetLevelCount();
+	static const SQualityLevel& GetQuality(int level);
+	const SQualityLevel& GetQuality() const { return GetQuality(m_iLevel); }
+
+	//! Size of the frame buffer for an output at the current level.
+	void GetRenderSize(int iOutWidth, int iOutHeight, int& iWidth, int& iHeight) const;
+	//! Splat radius of the level for the one of full quality, pixels.
+	float GetSplatRadius(float fFullRadius) const;
+
+	//! Average of the history, ms, 0 when it's empty.
+	double GetAverage() const;
+	//! Level changes since Reset().
+	std::size_t GetChanges() const { return m_nChanges; }
+
+
+private:
+	void SetLevel(int level);
+
+
+private:
+	double m_fTargetMs;
+	int m_iLevel;
+	double m_History[HISTORY];
+	int m_nHistory;
+	int m_iNext;
+	std::size_t m_nChanges;
+};
@@ -0,0 +1,307 @@
+#include "RasterKernel.h"
+#include "RasterKernelImpl.h"
+
+#include <math.h>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+// RasterKernelAVX2.cpp
+spanKernel_t GetSpanKernelAVX2(EShadingModel, ESpecularPow);
+visibilityKernel_t GetVisibilityKernelAVX2(EShadingModel, ESpecularPow);
+
+
+namespace {
+
+template <class TShading>
+void RasterSpanScalar(
+	const SSphereSetup& s,
+	int dx,
+	int dy,
+	int count,
+	bool testDepth,
+	const SImpostorSpan& impostor,
+	float* z,
+	unsigned int* color,
+	SSpanResult& result)
+{
+	RasterSpanT<SimdScalar, TShading, false>(
+		s, dx, dy, count, testDepth, impostor, z, color, 0, nullptr, result);
+}
+
+
+template <class TShading>
+void RasterSpanSSE41(
+	const SSphereSetup& s,
+	int dx,
+	int dy,
+	int count,
+	bool testDepth,
+	const SImpostorSpan& impostor,
+	float* z,
+	unsigned int* color,
+	SSpanResult& result)
+{
+	RasterSpanT<SimdSSE, TShading, false>(
+		s, dx, dy, count, testDepth, impostor, z, color, 0, nullptr, result);
+}
+
+
+template <class TShading>
+void RasterVisibilityScalar(
+	const SSphereSetup& s,
+	int dx,
+	int dy,
+	int count,
+	bool testDepth,
+	const SImpostorSpan& impostor,
+	unsigned int id,
+	float* z,
+	std::uint64_t* keys,
+	SSpanResult& result)
+{
+	RasterSpanT<SimdScalar, TShading, true>(
+		s, dx, dy, count, testDepth, impostor, z, nullptr, id, keys, result);
+}
+
+
+template <class TShading>
+void RasterVisibilitySSE41(
+	const SSphereSetup& s,
+	int dx,
+	int dy,
+	int count,
+	bool testDepth,
+	const SImpostorSpan& impostor,
+	unsigned int id,
+	float* z,
+	std::uint64_t* keys,
+	SSpanResult& result)
+{
+	RasterSpanT<SimdSSE, TShading, true>(
+		s, dx, dy, count, testDepth, impostor, z, nullptr, id, keys, result);
+}
+
+
+bool CpuHasSSE41()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 19)) != 0;
+#else
+	return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+
+bool CpuHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	// AVX and the OS saves YMM registers
+	__cpuid(info, 1);
+	const int osxsaveAvx = (1 << 27) | (1 << 28);
+	if ((info[2] & osxsaveAvx) != osxsaveAvx || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+
+template <class TShading>
+unsigned int ShadeSplatT(const SSphereSetup& s, bool quad)
+{
+	typedef SimdScalar::f f;
+	typedef SimdScalar::m m;
+
+	// unit normals (+-a, +-a, sqrt(1 - 2a^2)) half way to the rim
+	const float a = 0.35355339f;
+	const float az = sqrtf(1 - 2 * a * a);
+	const float normals[4][3] = {
+		{ -a, -a, az }, { a, -a, az }, { -a, a, az }, { a, a, az } };
+	const float center[1][3] = { { 0, 0, 1 } };
+	const float (*n)[3] = quad ? normals : center;
+	const int count = quad ? 4 : 1;
+
+	// as RasterSpanT()
+	const typename TShading::template SLanes<SimdScalar> shading(s);
+	float sum = 0;
+	for (int k = 0; k < count; ++k)
+	{
+		m lit = m::first(1);
+		const f alpha = shading.Shade(
+			f::set1(n[k][0]), f::set1(n[k][1]), f::set1(n[k][2]), lit);
+		if (lit.any()) {
+			sum += alpha.v;
+		}
+	}
+	const float alpha = quad ? sum / count : sum;
+
+	const unsigned int r = (unsigned int)(int)std::min(s.baseR * alpha, 255.f);
+	const unsigned int g = (unsigned int)(int)std::min(s.baseG * alpha, 255.f);
+	const unsigned int b = (unsigned int)(int)std::min(s.baseB * alpha, 255.f);
+	return (r << 16) | (g << 8) | b;
+}
+
+
+template <class TShading>
+bool IsSplatLitT(const SSphereSetup& s, bool quad)
+{
+	typedef SimdScalar::f f;
+	typedef SimdScalar::m m;
+
+	// the normals of ShadeSplatT()
+	const float a = 0.35355339f;
+	const float az = sqrtf(1 - 2 * a * a);
+	const float normals[4][3] = {
+		{ -a, -a, az }, { a, -a, az }, { -a, a, az }, { a, a, az } };
+	const float center[1][3] = { { 0, 0, 1 } };
+	const float (*n)[3] = quad ? normals : center;
+	const int count = quad ? 4 : 1;
+
+	const typename TShading::template SLanes<SimdScalar> shading(s);
+	for (int k = 0; k < count; ++k)
+	{
+		const m lit = shading.Lit(
+			f::set1(n[k][0]), f::set1(n[k][1]), f::set1(n[k][2]), m::first(1));
+		if (lit.any()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace
+
+
+
+
+unsigned int ShadeSplat(const SSphereSetup& s, bool quad, EShadingModel model)
+{
+	const ESpecularPow pow = s.lights ? s.lights->pow : ESpecularPow::Fast;
+	return WithShadingModel(model, pow, [&](auto shading) {
+		return ShadeSplatT<decltype(shading)>(s, quad);
+	});
+}
+
+
+bool IsSplatLit(const SSphereSetup& s, bool quad, EShadingModel model)
+{
+	const ESpecularPow pow = s.lights ? s.lights->pow : ESpecularPow::Fast;
+	return WithShadingModel(model, pow, [&](auto shading) {
+		return IsSplatLitT<decltype(shading)>(s, quad);
+	});
+}
+
+
+EKernelISA GetBestKernelISA()
+{
+	if (CpuHasAVX2()) {
+		return EKernelISA::AVX2;
+	}
+	if (CpuHasSSE41()) {
+		return EKernelISA::SSE41;
+	}
+	return EKernelISA::Scalar;
+}
+
+
+spanKernel_t GetSpanKernel(EKernelISA isa, EShadingModel model, ESpecularPow pow)
+{
+	switch (isa)
+	{
+	case EKernelISA::AVX2:
+		return CpuHasAVX2() ? GetSpanKernelAVX2(model, pow) : nullptr;
+
+	case EKernelISA::SSE41:
+		if (!CpuHasSSE41()) {
+			return nullptr;
+		}
+		return WithShadingModel(model, pow, [](auto shading) -> spanKernel_t {
+			return RasterSpanSSE41<decltype(shading)>;
+		});
+
+	case EKernelISA::Scalar:
+		return WithShadingModel(model, pow, [](auto shading) -> spanKernel_t {
+			return RasterSpanScalar<decltype(shading)>;
+		});
+	}
+	return nullptr;
+}
+
+
+visibilityKernel_t GetVisibilityKernel(
+	EKernelISA isa, EShadingModel model, ESpecularPow pow)
+{
+	switch (isa)
+	{
+	case EKernelISA::AVX2:
+		return CpuHasAVX2() ? GetVisibilityKernelAVX2(model, pow) : nullptr;
+
+	case EKernelISA::SSE41:
+		if (!CpuHasSSE41()) {
+			return nullptr;
+		}
+		return WithShadingModel(model, pow, [](auto shading) -> visibilityKernel_t {
+			return RasterVisibilitySSE41<decltype(shading)>;
+		});
+
+	case EKernelISA::Scalar:
+		return WithShadingModel(model, pow, [](auto shading) -> visibilityKernel_t {
+			return RasterVisibilityScalar<decltype(shading)>;
+		});
+	}
+	return nullptr;
+}
+
+
+const char* GetKernelISAName(EKernelISA isa)
+{
+	switch (isa)
+	{
+	case EKernelISA::AVX2:
+		return "avx2";
+
+	case EKernelISA::SSE41:
+		return "sse4.1";
+
+	case EKernelISA::Scalar:
+		return "scalar";
+	}
+	return "?";
+}
+
+
+const char* GetShadingModelName(EShadingModel model)
+{
+	switch (model)
+	{
+	case EShadingModel::Direct:
+		return "direct";
+
+	case EShadingModel::Lambert:
+		return "lambert";
+
+	case EShadingModel::Phong:
+		return "phong";
+
+	case EShadingModel::BlinnPhong:
+		return "blinn-phong";
+
+	case EShadingModel::Lights:
+		return "lights";
+	}
+	return "?";
+}
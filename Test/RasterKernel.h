@@ -0,0 +1,164 @@
+#pragma once
+
+#include "Lighting.h"
+
+#include <cstdint>
+#include <cstring>
+
+
+//! \brief Invariants of a sphere for the span kernels.
+//! \see CFrameBuffer::RasterSphere()
+struct SSphereSetup
+{
+	float screenZ;
+	float halfWidth;
+	//! Radius in pixels, squared.
+	float radius2;
+	//! 1 / radius of the impostor.
+	//! \see SImpostorSpan
+	float invRadius;
+	//! Normalized light direction.
+	float lightX, lightY, lightZ;
+	//! Normalized half vector of the specular, see ShadingModels.h.
+	float halfX, halfY, halfZ;
+	//! Channels of the base color.
+	float baseR, baseG, baseB;
+	//! Lights of EShadingModel::Lights.
+	const SLightSet* lights;
+};
+
+
+//! Pixels written by a span kernel and the nearest depth of them.
+struct SSpanResult
+{
+	int written;
+	//! Pixels shaded, they passed the depth test.
+	int shaded;
+	float zMin;
+};
+
+
+//! \brief Precomputed pixels of a span from CImpostorCache, aligned
+//!        with the first pixel. nullptr when the sphere has no impostor.
+struct SImpostorSpan
+{
+	//! Distance to the center, pixels.
+	const float* dist;
+	//! z of the unit normal.
+	const float* nz;
+};
+
+
+//! \brief Draws `count` pixels of one row of a sphere: shading by
+//!        the model of the kernel, depth test and masked store.
+//! \param dx, dy Offset of the first pixel from the center of the sphere.
+//! \param testDepth false when every pixel is known to pass.
+//! \param z, color The first pixel in the frame buffer.
+typedef void (*spanKernel_t)(
+	const SSphereSetup&,
+	int dx,
+	int dy,
+	int count,
+	bool testDepth,
+	const SImpostorSpan&,
+	float* z,
+	unsigned int* color,
+	SSpanResult&);
+
+
+//! \brief Lighting models of the span kernels.
+//! \see ShadingModels.h
+enum class EShadingModel
+{
+	Direct,
+	Lambert,
+	Phong,
+	BlinnPhong,
+	//! Ambient and several lights, see CLighting.
+	Lights
+};
+
+
+const char* GetShadingModelName(EShadingModel);
+
+
+//! \brief Color of a sphere drawn as a splat, the same shading as the spans.
+//! \param quad Average of 4 normals around the center for a 2x2 splat,
+//!        else the normal of the center: a 1 pixel splat is the same
+//!        pixel as the span would draw.
+//! \return The undefined color (black) when unlit.
+unsigned int ShadeSplat(
+	const SSphereSetup&, bool quad, EShadingModel = EShadingModel::Phong);
+
+//! \brief Coverage of a splat in the depth pass of the deferred shading:
+//!        any of the normals of ShadeSplat() is lit, nothing is shaded.
+bool IsSplatLit(
+	const SSphereSetup&, bool quad, EShadingModel = EShadingModel::Phong);
+
+
+//! \brief Key of a pixel of the visibility buffer: the bits of the depth
+//!        above the index of the sphere. Positive floats order as their
+//!        bits, so the least key is the nearest sphere and, at the same
+//!        depth, the first one of the list, as the depth test keeps it.
+inline std::uint64_t MakeVisibilityKey(float depth, unsigned int id)
+{
+	std::uint32_t bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	return ((std::uint64_t)bits << 32) | id;
+}
+
+
+inline float GetVisibilityDepth(std::uint64_t key)
+{
+	const std::uint32_t bits = (std::uint32_t)(key >> 32);
+	float depth;
+	memcpy(&depth, &bits, sizeof(depth));
+	return depth;
+}
+
+
+//! Key of a pixel of no sphere.
+constexpr std::uint64_t EMPTY_VISIBILITY_KEY = ~0ull;
+
+
+//! \brief Depth pass of the deferred shading: the span kernel which
+//!        writes the visibility keys of the element `id` instead of colors.
+//! A pixel passes the depth test and the lit test of the model, N.L > 0,
+//! but isn't shaded: CFrameBuffer::ShadeVisible() shades the visible
+//! pixels once. The z buffer and Hi-Z go as in the forward raster but
+//! for a lit pixel shaded to black, which hides the spheres behind it.
+typedef void (*visibilityKernel_t)(
+	const SSphereSetup&,
+	int dx,
+	int dy,
+	int count,
+	bool testDepth,
+	const SImpostorSpan&,
+	unsigned int id,
+	float* z,
+	std::uint64_t* keys,
+	SSpanResult&);
+
+
+//! Instruction sets of the span kernels.
+enum class EKernelISA
+{
+	Scalar,
+	SSE41,
+	AVX2
+};
+
+
+//! The best instruction set of this CPU.
+EKernelISA GetBestKernelISA();
+
+//! \param pow Specular power of EShadingModel::Lights, one kernel each.
+//! \return The kernel or nullptr when the CPU doesn't support the set.
+spanKernel_t GetSpanKernel(EKernelISA, EShadingModel = EShadingModel::Phong,
+	ESpecularPow pow = ESpecularPow::Fast);
+
+//! \return The kernel or nullptr when the CPU doesn't support the set.
+visibilityKernel_t GetVisibilityKernel(EKernelISA,
+	EShadingModel = EShadingModel::Phong, ESpecularPow pow = ESpecularPow::Fast);
+
+const char* GetKernelISAName(EKernelISA);
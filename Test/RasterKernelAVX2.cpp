@@ -0,0 +1,59 @@
+//! \warning Compiled with AVX2 enabled, called only after the CPU check.
+//! \see RasterKernel.cpp
+
+#include "RasterKernelImpl.h"
+
+
+namespace {
+
+template <class TShading>
+void RasterSpanAVX2(
+	const SSphereSetup& s,
+	int dx,
+	int dy,
+	int count,
+	bool testDepth,
+	const SImpostorSpan& impostor,
+	float* z,
+	unsigned int* color,
+	SSpanResult& result)
+{
+	RasterSpanT<SimdAVX2, TShading, false>(
+		s, dx, dy, count, testDepth, impostor, z, color, 0, nullptr, result);
+}
+
+
+template <class TShading>
+void RasterVisibilityAVX2(
+	const SSphereSetup& s,
+	int dx,
+	int dy,
+	int count,
+	bool testDepth,
+	const SImpostorSpan& impostor,
+	unsigned int id,
+	float* z,
+	std::uint64_t* keys,
+	SSpanResult& result)
+{
+	RasterSpanT<SimdAVX2, TShading, true>(
+		s, dx, dy, count, testDepth, impostor, z, nullptr, id, keys, result);
+}
+
+} // namespace
+
+
+spanKernel_t GetSpanKernelAVX2(EShadingModel model, ESpecularPow pow)
+{
+	return WithShadingModel(model, pow, [](auto shading) -> spanKernel_t {
+		return RasterSpanAVX2<decltype(shading)>;
+	});
+}
+
+
+visibilityKernel_t GetVisibilityKernelAVX2(EShadingModel model, ESpecularPow pow)
+{
+	return WithShadingModel(model, pow, [](auto shading) -> visibilityKernel_t {
+		return RasterVisibilityAVX2<decltype(shading)>;
+	});
+}
@@ -0,0 +1,154 @@
+//! \brief The span kernels written once over SimdLanes.h.
+//! Included by the translation units of every instruction set.
+//! All of them do the same operations in the same order, so the image
+//! doesn't depend on the set picked at runtime.
+
+#pragma once
+
+#include "RasterKernel.h"
+#include "ShadingModels.h"
+#include "SimdLanes.h"
+
+#include <float.h>
+
+
+namespace {
+
+
+//! \tparam TShading Policy of ShadingModels.h.
+//! \tparam bKeys Writes the visibility keys of `id` instead of
+//!         the colors, see visibilityKernel_t.
+template <class V, class TShading, bool bKeys>
+void RasterSpanT(
+	const SSphereSetup& s,
+	int dx,
+	int dy,
+	int count,
+	bool testDepth,
+	const SImpostorSpan& impostor,
+	float* z,
+	unsigned int* color,
+	unsigned int id,
+	std::uint64_t* keys,
+	SSpanResult& result)
+{
+	typedef typename V::f f;
+	typedef typename V::i i;
+	typedef typename V::m m;
+
+	const f zero = f::set1(0);
+	const f one = f::set1(1);
+	const f channelMax = f::set1(255);
+	const f screenZ = f::set1(s.screenZ);
+	const f halfWidth = f::set1(s.halfWidth);
+	const f radius2 = f::set1(s.radius2);
+	const f invRadius = f::set1(s.invRadius);
+	const typename TShading::template SLanes<V> shading(s);
+	const f baseR = f::set1(s.baseR);
+	const f baseG = f::set1(s.baseG);
+	const f baseB = f::set1(s.baseB);
+	const f fdy = f::set1((float)dy);
+	const f dy2 = f::set1((float)(dy * dy));
+
+	for (int k = 0; k < count; k += V::N)
+	{
+		const int n = std::min(V::N, count - k);
+
+		// a tail goes through the stack, so loads and stores stay full width
+		alignas(32) float zTail[V::N];
+		alignas(32) unsigned int colorTail[V::N];
+		float* pz = z + k;
+		unsigned int* pc = bKeys ? colorTail : color + k;
+		if (n < V::N)
+		{
+			std::copy(pz, pz + n, zTail);
+			if (!bKeys) {
+				std::copy(pc, pc + n, colorTail);
+			}
+			pz = zTail;
+			pc = colorTail;
+		}
+
+		// smooth a 2D circle to 3D
+		const f fdx = f::ramp((float)(dx + k));
+		const f d2 = fdx * fdx + dy2;
+		const f dist = impostor.dist ? f::load(impostor.dist + k) : sqrt(d2);
+		const f zPixel = screenZ + dist / halfWidth;
+		const f zOld = f::load(pz);
+		m mask = m::first(n);
+		if (testDepth) {
+			mask = mask & (zOld > zPixel);
+		}
+		if (!mask.any())
+			continue;
+
+		// the unit normal, when the model needs it
+		f ux = zero;
+		f uy = zero;
+		f uz = one;
+		if (TShading::NORMALS && impostor.nz)
+		{
+			ux = fdx * invRadius;
+			uy = fdy * invRadius;
+			uz = f::load(impostor.nz + k);
+		}
+		else if (TShading::NORMALS)
+		{
+			const f nz = sqrt(radius2 - d2);
+			const f len = sqrt((fdx * fdx + fdy * fdy) + nz * nz);
+			ux = fdx / len;
+			uy = fdy / len;
+			uz = nz / len;
+		}
+
+		if (bKeys)
+		{
+			// depth and coverage, the visible pixels are shaded once later
+			mask = shading.Lit(ux, uy, uz, mask);
+			if (!mask.any())
+				continue;
+
+			// the lanes of the mask, a key is wider than a lane
+			alignas(32) float zLanes[V::N];
+			alignas(32) unsigned int written[V::N];
+			zPixel.store(zLanes);
+			select(mask, i::set1(1), i::set1(0)).store(written);
+			for (int lane = 0; lane < n; ++lane)
+			{
+				if (written[lane]) {
+					keys[k + lane] = MakeVisibilityKey(zLanes[lane], id);
+				}
+			}
+		}
+		else
+		{
+			result.shaded += mask.count();
+			const f alpha = shading.Shade(ux, uy, uz, mask);
+			if (!mask.any())
+				continue;
+
+			const i r = i::cvt(min(baseR * alpha, channelMax));
+			const i g = i::cvt(min(baseG * alpha, channelMax));
+			const i b = i::cvt(min(baseB * alpha, channelMax));
+			const i c = r.template shl<16>() | g.template shl<8>() | b;
+
+			// black is the undefined color, it isn't drawn
+			mask = mask & c.nonzero();
+			select(mask, c, i::load(pc)).store(pc);
+		}
+		select(mask, zPixel, zOld).store(pz);
+		result.written += mask.count();
+		result.zMin = hmin(mask, zPixel, result.zMin);
+
+		if (n < V::N)
+		{
+			std::copy(zTail, zTail + n, z + k);
+			if (!bKeys) {
+				std::copy(colorTail, colorTail + n, color + k);
+			}
+		}
+	}
+}
+
+
+} // namespace
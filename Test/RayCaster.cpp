@@ -0,0 +1,327 @@
+#include "RayCaster.h"
+#include "FrameBuffer.h"
+#include "FrameTrace.h"
+#include "SimdLanes.h"
+#include "TaskScheduler.h"
+
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+
+namespace {
+
+//! Rays of a packet: SSE4.1 is the base instruction set of the core.
+typedef SimdSSE V;
+
+//! Deeper than any median split tree of 32-bit indices.
+static constexpr int MAX_DEPTH = 64;
+
+} // namespace
+
+
+//! Invariants of a frame for the tiles.
+struct CRayCaster::SRayFrame
+{
+	float s, c;
+	//! Camera in the scene space.
+	float ox, oy, oz;
+	float halfWidth;
+	float lightX, lightY, lightZ;
+};
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+CRayCaster::SRayStats& CRayCaster::SRayStats::operator+=(const SRayStats& b)
+{
+	rays += b.rays;
+	hits += b.hits;
+	nodeTests += b.nodeTests;
+	sphereTests += b.sphereTests;
+	return *this;
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+CRayCaster::CRayCaster() :
+	m_Stats()
+{
+}
+
+
+CRayCaster::~CRayCaster()
+{
+}
+
+
+void CRayCaster::Build(const SSphereView& spheres)
+{
+	std::vector<unsigned int> order;
+	CSphereData::BuildClusterTree(spheres, LEAF_SIZE, m_Nodes, order);
+
+	// a leaf reads its spheres in a row
+	m_Spheres.resize(order.size());
+	for (std::size_t i = 0; i < order.size(); ++i)
+	{
+		const unsigned int k = order[i];
+		m_Spheres.x[i] = spheres.x[k];
+		m_Spheres.y[i] = spheres.y[k];
+		m_Spheres.z[i] = spheres.z[k];
+		m_Spheres.r[i] = spheres.r[k];
+		m_Spheres.dwARGB[i] = spheres.dwARGB[k];
+	}
+}
+
+
+void CRayCaster::Render(CFrameBuffer& fb, float wi)
+{
+	TRACE_ZONE("ray cast");
+
+	// the camera is at z = -CAMERA_DISTANCE of its space, turned back
+	// to the scene: x = X * s + Z * c, z = -X * c + Z * s
+	SRayFrame frame;
+	frame.s = sin(wi);
+	frame.c = cos(wi);
+	frame.ox = -CSphereData::CAMERA_DISTANCE * frame.c;
+	frame.oy = 0;
+	frame.oz = -CSphereData::CAMERA_DISTANCE * frame.s;
+	frame.halfWidth = (float)(fb.m_iWidth / 2);
+	CFrameBuffer::GetLight(frame.lightX, frame.lightY, frame.lightZ);
+
+	m_TileStats.assign(fb.m_tileIds.size(), {});
+	if (IsBuilt())
+	{
+		CTaskScheduler::Get().ParallelFor(
+			fb.m_tileIds.size(),
+			1,
+			[this, &fb, &frame](std::size_t i) {
+				const int t = fb.m_tileIds[i];
+				TraceTile(fb, frame, t, m_TileStats[t]);
+			});
+	}
+
+	m_Stats = {};
+	for (const SRayStats& stats : m_TileStats) {
+		m_Stats += stats;
+	}
+	fb.m_Stats = {};
+	fb.m_Stats.pixelsTested = m_Stats.rays;
+	fb.m_Stats.pixelsShaded = m_Stats.hits;
+	fb.m_Stats.pixelsWritten = m_Stats.hits;
+}
+
+
+void CRayCaster::TraceTile(
+	CFrameBuffer& fb, const SRayFrame& frame, int t, SRayStats& stats) const
+{
+	TRACE_ZONE("ray tile");
+	typedef V::f f;
+	typedef V::i i;
+	typedef V::m m;
+
+	const int tx = t % fb.m_nTilesX;
+	const int ty = t / fb.m_nTilesX;
+	const CFrameBuffer::SRect rect = {
+		tx * fb.m_iTileSize,
+		ty * fb.m_iTileSize,
+		std::min((tx + 1) * fb.m_iTileSize, fb.m_iWidth),
+		std::min((ty + 1) * fb.m_iTileSize, fb.m_iHeight) };
+
+	const SClusterNode* nodes = std::data(m_Nodes);
+	const float* px = std::data(m_Spheres.x);
+	const float* py = std::data(m_Spheres.y);
+	const float* pz = std::data(m_Spheres.z);
+	const float* pr = std::data(m_Spheres.r);
+	const unsigned int* pARGB = std::data(m_Spheres.dwARGB);
+
+	const f zero = f::set1(0);
+	const f one = f::set1(1);
+	const f channelMax = f::set1(255);
+	const f nearZ = f::set1(CSphereData::NEAR_Z);
+	const f farZ = f::set1(FLT_MAX);
+	const f s = f::set1(frame.s);
+	const f c = f::set1(frame.c);
+	const f halfWidth = f::set1(frame.halfWidth);
+	const f lx = f::set1(frame.lightX);
+	const f ly = f::set1(frame.lightY);
+	const f lz = f::set1(frame.lightZ);
+
+	std::size_t written = 0;
+	unsigned int stack[MAX_DEPTH];
+	for (int y = rect.y0; y < rect.y1; ++y)
+	{
+		float* zRow = std::data(fb.m_ZBuffer) + y * fb.m_iWidth;
+		CFrameBuffer::color_t* colorRow =
+			std::data(fb.m_FramebufferArray) + y * fb.m_iWidth;
+		const float sy = (y - frame.halfWidth) / frame.halfWidth;
+
+		for (int x = rect.x0; x < rect.x1; x += V::N)
+		{
+			const int n = std::min(V::N, rect.x1 - x);
+			stats.rays += n;
+
+			// rays of the packet in the scene space, z of the camera space
+			// is 1, so the distance along a ray is the depth of the raster
+			const m active = m::first(n);
+			const f sx = (f::ramp((float)x) - halfWidth) / halfWidth;
+			const f fsy = f::set1(sy);
+			const f dx = sx * s + c;
+			const f dy = fsy;
+			const f dz = s - sx * c;
+			const f a = (dx * dx + dy * dy) + dz * dz;
+			const f invA = one / a;
+			// the middle ray orders the children
+			const float mx = (x + n * 0.5f - frame.halfWidth) / frame.halfWidth;
+			const float mdx = mx * frame.s + frame.c;
+			const float mdz = frame.s - mx * frame.c;
+
+			f tBest = farZ;
+			i hit = i::set1(0);
+			int top = 0;
+			stack[top++] = 0;
+			while (top > 0)
+			{
+				const SClusterNode& node = nodes[stack[--top]];
+				++stats.nodeTests;
+
+				// any ray between the near plane and its nearest hit
+				const float ocx = frame.ox - node.x;
+				const float ocy = frame.oy - node.y;
+				const float ocz = frame.oz - node.z;
+				const f cc = f::set1(
+					(ocx * ocx + ocy * ocy) + ocz * ocz - node.radius * node.radius);
+				const f b = (dx * f::set1(ocx) + dy * f::set1(ocy)) + dz * f::set1(ocz);
+				const f disc = b * b - a * cc;
+				const f root = sqrt(max(disc, zero));
+				const m enter = active &
+					(disc > zero) &
+					((root - b) > nearZ * a) &
+					((zero - b - root) < tBest * a);
+				if (!enter.any())
+					continue;
+
+				if (node.count == 0)
+				{
+					// the nearer child is popped first
+					const SClusterNode& c0 = nodes[node.first];
+					const SClusterNode& c1 = nodes[node.first + 1];
+					const float d0 = (c0.x - frame.ox) * mdx + (c0.y - frame.oy) * sy +
+						(c0.z - frame.oz) * mdz;
+					const float d1 = (c1.x - frame.ox) * mdx + (c1.y - frame.oy) * sy +
+						(c1.z - frame.oz) * mdz;
+					const bool firstNear = d0 <= d1;
+					stack[top++] = node.first + (firstNear ? 1 : 0);
+					stack[top++] = node.first + (firstNear ? 0 : 1);
+					continue;
+				}
+
+				for (unsigned int k = node.first; k < node.first + node.count; ++k)
+				{
+					++stats.sphereTests;
+					const float scx = frame.ox - px[k];
+					const float scy = frame.oy - py[k];
+					const float scz = frame.oz - pz[k];
+					const f sc = f::set1(
+						(scx * scx + scy * scy) + scz * scz - pr[k] * pr[k]);
+					const f sb = (dx * f::set1(scx) + dy * f::set1(scy)) + dz * f::set1(scz);
+					const f sdisc = sb * sb - a * sc;
+					m front = sdisc > zero;
+					if (!front.any())
+						continue;
+
+					// the nearer root, a camera inside a sphere doesn't see it
+					const f tHit = (zero - sb - sqrt(max(sdisc, zero))) * invA;
+					front = front & (tHit > nearZ) & (tHit < tBest);
+					tBest = select(front, tHit, tBest);
+					hit = select(front, i::set1(k), hit);
+				}
+			}
+
+			const m found = active & (tBest < farZ);
+			if (!found.any())
+				continue;
+
+			// exact normal of the hit, turned to the camera space
+			alignas(16) unsigned int index[V::N];
+			hit.store(index);
+			alignas(16) float cx[V::N], cy[V::N], cz[V::N], invR[V::N];
+			alignas(16) unsigned int argb[V::N];
+			for (int k = 0; k < V::N; ++k)
+			{
+				cx[k] = px[index[k]];
+				cy[k] = py[index[k]];
+				cz[k] = pz[index[k]];
+				invR[k] = 1 / pr[index[k]];
+				argb[k] = pARGB[index[k]];
+			}
+			const f tHit = select(found, tBest, one);
+			const f ir = f::load(invR);
+			const f nx = (f::set1(frame.ox) + tHit * dx - f::load(cx)) * ir;
+			const f ny = (f::set1(frame.oy) + tHit * dy - f::load(cy)) * ir;
+			const f nz = (f::set1(frame.oz) + tHit * dz - f::load(cz)) * ir;
+			// the raster's normal looks at the viewer: z of the camera space negated
+			const f ux = nx * s - nz * c;
+			const f uy = ny;
+			const f uz = zero - (nz * s + nx * c);
+
+			// Phong as the span kernels, the eye of the pixel
+			const f ex = lx + sx;
+			const f ey = ly + fsy;
+			const f ez = lz + one;
+			const f eLen = sqrt((ex * ex + ey * ey) + ez * ez);
+			const f NdotL = (lx * ux + ly * uy) + lz * uz;
+			const f NdotHV = ((ex * ux + ey * uy) + ez * uz) / eLen;
+			m lit = found & (NdotL > zero);
+
+			// shininess 12
+			const f p2 = NdotHV * NdotHV;
+			const f p4 = p2 * p2;
+			const f p8 = p4 * p4;
+			const f specular = p8 * p4;
+			const f alpha = min(NdotL + specular, one);
+
+			const i base = i::load(argb);
+			const f baseR = tofloat((base.shr<16>()) & i::set1(0xFF));
+			const f baseG = tofloat((base.shr<8>()) & i::set1(0xFF));
+			const f baseB = tofloat(base & i::set1(0xFF));
+			const i r = i::cvt(min(baseR * alpha, channelMax));
+			const i g = i::cvt(min(baseG * alpha, channelMax));
+			const i b = i::cvt(min(baseB * alpha, channelMax));
+			const i color = r.shl<16>() | g.shl<8>() | b;
+
+			// black is the undefined color, it isn't drawn
+			lit = lit & color.nonzero();
+			if (!lit.any())
+				continue;
+
+			alignas(16) float depth[V::N];
+			alignas(16) unsigned int shaded[V::N];
+			alignas(16) float mask[V::N];
+			tHit.store(depth);
+			color.store(shaded);
+			select(lit, one, zero).store(mask);
+			for (int k = 0; k < n; ++k)
+			{
+				if (mask[k] != 0 && depth[k] < zRow[x + k])
+				{
+					zRow[x + k] = depth[k];
+					colorRow[x + k] = shaded[k];
+					++written;
+				}
+			}
+		}
+	}
+
+	stats.hits += written;
+	if (written > 0)
+	{
+		fb.m_TileDrawn[t] = true;
+		if (fb.m_bHiZ) {
+			fb.UpdateHiZ(rect);
+		}
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "SphereData.h"
+
+#include <cstddef>
+#include <vector>
+
+
+class CFrameBuffer;
+
+
+//! \brief Hidden surfaces by rays instead of the raster.
+//! A ray per pixel walks a bounding sphere hierarchy of the scene, the
+//! nearest hit is exact: its depth and normal come from the ray-sphere
+//! intersection and go to the same Phong as the span kernels.
+//!
+//! The hierarchy is built once in the scene space, a frame only turns
+//! the rays, so there is no per-frame transform and sort. Tiles of the
+//! frame buffer are traced in parallel, a tile by packets of the SIMD
+//! lanes: neighbouring pixels of a row walk the tree together and a
+//! node is opened when any ray of the packet hits it.
+//!
+//! The cost is the pixels times the depth of the tree, not the spheres,
+//! so the rays win on big dense scenes and lose on sparse small ones.
+//! \see CSphereData::SetRenderEngine()
+class CRayCaster
+{
+public:
+	//! Spheres per leaf of the hierarchy, at most.
+	static constexpr unsigned int LEAF_SIZE = 4;
+
+	//! Counters of the last Render().
+	struct SRayStats
+	{
+		std::size_t rays;
+		std::size_t hits;
+		//! Packet tests of the bounding spheres of the nodes.
+		std::size_t nodeTests;
+		//! Packet tests of the spheres of the leaves.
+		std::size_t sphereTests;
+
+		SRayStats& operator+=(const SRayStats&);
+	};
+
+
+public:
+	CRayCaster();
+	~CRayCaster();
+
+	//! \brief Builds the hierarchy and copies the spheres in its leaf
+	//!        order, 20 bytes per sphere.
+	void Build(const SSphereView&);
+	bool IsBuilt() const { return !m_Nodes.empty(); }
+	int GetNodeCount() const { return (int)m_Nodes.size(); }
+
+	//! \brief Draws the scene at the turntable angle into the cleared
+	//!        frame buffer. The depth is the camera space z of the hit,
+	//!        as FrameRenderElement::screenZ of the raster.
+	//! \note The shading model, the lighting and the deferred mode of
+	//!       fb are not used.
+	void Render(CFrameBuffer& fb, float wi);
+
+	const SRayStats& GetStats() const { return m_Stats; }
+
+
+private:
+	struct SRayFrame;
+
+	//! Traces the rays of the tile, the packets row by row.
+	void TraceTile(CFrameBuffer&, const SRayFrame&, int tile, SRayStats&) const;
+
+
+private:
+	//! Nodes of CSphereData::BuildClusterTree(), the root first.
+	std::vector<SClusterNode> m_Nodes;
+	//! Spheres of the leaves one by one, a leaf is
+	//! [first .. first + count[ of every column.
+	SSphereColumns m_Spheres;
+
+	SRayStats m_Stats;
+	std::vector<SRayStats> m_TileStats;
+};
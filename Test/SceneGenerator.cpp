@@ -0,0 +1,231 @@
+#include "SceneGenerator.h"
+#include "SphereData.h"
+#include "TaskScheduler.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+
+namespace {
+
+//! Spheres generated by one task.
+static constexpr std::size_t BLOCK_SIZE = 1 << 16;
+
+static const float PI = 3.14159265f;
+
+static const char* const DISTRIBUTION_NAMES[] = {
+	"uniform", "clustered", "shell", "dense" };
+
+
+//! \brief SplitMix64, a stream per sphere seeded by its index.
+//! Only integer math, so the values are the same everywhere.
+struct SSplitMix64
+{
+	std::uint64_t state;
+
+	SSplitMix64(std::uint32_t seed, std::uint64_t index) :
+		state(((std::uint64_t)seed << 32) ^ (index * 0xD1B54A32D192ED03ull))
+	{
+	}
+
+	std::uint64_t Next()
+	{
+		std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	//! [0, 1), 24 bits are exact in a float.
+	float NextFloat()
+	{
+		return (float)(Next() >> 40) * (1.0f / 16777216.0f);
+	}
+
+	//! [-1, 1)
+	float NextSigned()
+	{
+		return NextFloat() * 2 - 1;
+	}
+
+	//! Sum of 3 uniforms, bell-shaped in [-1, 1), no transcendentals.
+	float NextBell()
+	{
+		return (NextSigned() + NextSigned() + NextSigned()) * (1.0f / 3);
+	}
+};
+
+
+//! Streams of the blobs start past any sphere index.
+static constexpr std::uint64_t CLUSTER_STREAM = 1ull << 48;
+
+
+//! Half side of the cube of the centers.
+float GetCubeExtent(const SSceneParams& params)
+{
+	return params.distribution == ESceneDistribution::Dense ?
+		params.extent * 0.25f : params.extent;
+}
+
+
+//! Mean square of a radius uniform in the range.
+float GetMeanRadius2(float a, float b)
+{
+	return (a * a + a * b + b * b) / 3;
+}
+
+
+//! Scale of the radius range for params.depthComplexity.
+float GetRadiusScale(const SSceneParams& params)
+{
+	if (params.depthComplexity <= 0) {
+		return 1;
+	}
+	const float estimate = params.EstimateDepthComplexity();
+	return estimate > 0 ? sqrtf(params.depthComplexity / estimate) : 1;
+}
+
+} // namespace
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+float SSceneParams::EstimateDepthComplexity() const
+{
+	// density * mean cross-section * length of the ray in the volume
+	const float e = GetCubeExtent(*this);
+	float volume = 8 * e * e * e;
+	float depth = 2 * e;
+	if (distribution == ESceneDistribution::Shell)
+	{
+		const float inner = e * (1 - shellThickness);
+		volume = 4.0f / 3 * PI * (e * e * e - inner * inner * inner);
+		depth = 2 * (e - inner);
+	}
+	return volume > 0 ?
+		count / volume * PI * GetMeanRadius2(radiusMin, radiusMax) * depth : 0;
+}
+
+
+const char* GetSceneDistributionName(ESceneDistribution distribution)
+{
+	return DISTRIBUTION_NAMES[(int)distribution];
+}
+
+
+bool ParseSceneDistribution(const char* sz, ESceneDistribution& distribution)
+{
+	for (int i = 0; i < (int)std::size(DISTRIBUTION_NAMES); ++i)
+	{
+		if (!strcmp(sz, DISTRIBUTION_NAMES[i]))
+		{
+			distribution = (ESceneDistribution)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+bool GenerateScene(const SSceneParams& params, SSphereColumns& spheres)
+{
+	if (params.count == 0 ||
+		params.extent <= 0 ||
+		params.radiusMin <= 0 ||
+		params.radiusMax < params.radiusMin ||
+		params.nClusters <= 0 ||
+		params.shellThickness <= 0 || params.shellThickness > 1)
+	{
+		return false;
+	}
+
+	const float e = GetCubeExtent(params);
+	const float scale = GetRadiusScale(params);
+	const float radiusMin = params.radiusMin * scale;
+	const float radiusRange = (params.radiusMax - params.radiusMin) * scale;
+
+	// centers and tints of the blobs
+	std::vector<float> clusters;
+	std::vector<unsigned int> tints;
+	if (params.distribution == ESceneDistribution::Clustered)
+	{
+		clusters.resize(params.nClusters * 3);
+		tints.resize(params.nClusters);
+		for (int k = 0; k < params.nClusters; ++k)
+		{
+			SSplitMix64 rng(params.seed, CLUSTER_STREAM + k);
+			clusters[k * 3 + 0] = rng.NextSigned() * e;
+			clusters[k * 3 + 1] = rng.NextSigned() * e;
+			clusters[k * 3 + 2] = rng.NextSigned() * e;
+			tints[k] = (unsigned int)rng.Next() & 0xE0E0E0;
+		}
+	}
+
+	spheres.resize(params.count);
+	float* px = std::data(spheres.x);
+	float* py = std::data(spheres.y);
+	float* pz = std::data(spheres.z);
+	float* pr = std::data(spheres.r);
+	unsigned int* pARGB = std::data(spheres.dwARGB);
+
+	const std::size_t n = params.count;
+	CTaskScheduler::Get().ParallelFor(
+		(n + BLOCK_SIZE - 1) / BLOCK_SIZE,
+		1,
+		[&](std::size_t block) {
+			const std::size_t end = std::min(n, (block + 1) * BLOCK_SIZE);
+			for (std::size_t i = block * BLOCK_SIZE; i < end; ++i)
+			{
+				SSplitMix64 rng(params.seed, i);
+				float x, y, z;
+				unsigned int rgb = (unsigned int)rng.Next() & 0xFFFFFF;
+				switch (params.distribution)
+				{
+				case ESceneDistribution::Clustered:
+				{
+					const std::uint64_t k = rng.Next() % params.nClusters;
+					x = clusters[k * 3 + 0] + rng.NextBell() * params.clusterSpread;
+					y = clusters[k * 3 + 1] + rng.NextBell() * params.clusterSpread;
+					z = clusters[k * 3 + 2] + rng.NextBell() * params.clusterSpread;
+					rgb = tints[k] | (rgb & 0x1F1F1F);
+					break;
+				}
+
+				case ESceneDistribution::Shell:
+				{
+					// a direction by rejection, the depth in the thin shell
+					// is uniform, so no cbrt()
+					float l2;
+					do {
+						x = rng.NextSigned();
+						y = rng.NextSigned();
+						z = rng.NextSigned();
+						l2 = x * x + y * y + z * z;
+					} while (l2 > 1 || l2 < 1e-6f);
+					const float l = e * (1 - params.shellThickness * rng.NextFloat()) / sqrtf(l2);
+					x *= l;
+					y *= l;
+					z *= l;
+					break;
+				}
+
+				default:
+					x = rng.NextSigned() * e;
+					y = rng.NextSigned() * e;
+					z = rng.NextSigned() * e;
+					break;
+				}
+
+				px[i] = x;
+				py[i] = y;
+				pz[i] = z;
+				pr[i] = radiusMin + radiusRange * rng.NextFloat();
+				pARGB[i] = rgb;
+			}
+		});
+
+	return true;
+}
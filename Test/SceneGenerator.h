@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+struct SSphereColumns;
+
+
+//! How the centers of a synthetic scene are placed.
+enum class ESceneDistribution
+{
+	//! Uniform in the cube of the extent.
+	Uniform,
+	//! Gaussian-like blobs around centers uniform in the cube.
+	Clustered,
+	//! Between two spheres, the outer one of the extent.
+	Shell,
+	//! Uniform in a cube of a quarter of the extent, overlapping a lot.
+	Dense
+};
+
+
+//! \brief Parameters of GenerateScene(), in scene units: the camera
+//! looks at the origin from CSphereData::CAMERA_DISTANCE.
+struct SSceneParams
+{
+	ESceneDistribution distribution = ESceneDistribution::Uniform;
+	std::size_t count = 100000;
+	std::uint32_t seed = 1;
+	//! Half the side of the cube holding the centers.
+	float extent = 0.8f;
+	//! Radii are uniform in the range.
+	float radiusMin = 0.002f;
+	float radiusMax = 0.006f;
+	//! Clustered: blobs and their size.
+	int nClusters = 64;
+	float clusterSpread = 0.05f;
+	//! Shell: part of the extent between the spheres.
+	float shellThickness = 0.05f;
+	//! \brief Spheres crossed by a ray through the volume, 0 keeps
+	//! the radii. Otherwise the radius range is scaled for it, the
+	//! ratio of min to max stays.
+	float depthComplexity = 0;
+
+	//! \brief Mean spheres crossed by a ray through the center of the
+	//! volume. Clustered counts the cube, blobs cross more.
+	float EstimateDepthComplexity() const;
+};
+
+
+const char* GetSceneDistributionName(ESceneDistribution);
+//! \return false for an unknown name.
+bool ParseSceneDistribution(const char* sz, ESceneDistribution&);
+
+
+//! \brief Fills the spheres on all cores by a counter-based PRNG:
+//! a sphere depends only on the seed and its index, so the scene is
+//! the same for any thread count, platform and compiler.
+//! Colors have zero alpha like the made-up ones of the text datasets.
+//! \return false when the parameters are out of range.
+bool GenerateScene(const SSceneParams&, SSphereColumns&);
@@ -0,0 +1,426 @@
+//! \brief Lighting models of the span kernels as compile-time policies.
+//! A model hoists the invariants of a sphere once in Setup(), then
+//! SLanes<V> broadcasts them to the registers once per span and Shade()
+//! lights the pixels of the span V::N at a time. RasterSpanT() is
+//! instantiated per model, so picking one is a kernel pointer per frame
+//! and a new model costs nothing to the others.
+//! \warning In an anonymous namespace as SimdLanes.h, see there.
+
+#pragma once
+
+#include "Lighting.h"
+#include "RasterKernel.h"
+#include "SimdLanes.h"
+
+#include <float.h>
+#include <math.h>
+
+
+namespace {
+
+
+//////////////////////////////////////////////////////////////////////////
+//! x^n by powf(), lane by lane.
+template <class V>
+typename V::f PowExact(typename V::f x, float n)
+{
+	alignas(32) float lanes[V::N];
+	x.store(lanes);
+	for (int k = 0; k < V::N; ++k) {
+		lanes[k] = powf(lanes[k], n);
+	}
+	return V::f::load(lanes);
+}
+
+
+//! \brief x^n, x in [0..1], as exp2(n * log2(x)): the exponent of x
+//!        plus a polynomial of its mantissa, and back. The polynomials
+//!        are fitted to 1.5e-5 for log2 and 3e-6 for exp2.
+template <class V>
+typename V::f PowFast(typename V::f x, typename V::f n)
+{
+	typedef typename V::f f;
+	typedef typename V::i i;
+
+	const f one = f::set1(1);
+	// x = 2^e * (1 + t), t in [0..1[
+	const i bits = i::bits(min(max(x, f::set1(FLT_MIN)), one));
+	const f e = tofloat(bits.template shr<23>()) - f::set1(127);
+	const f t = asfloat((bits & i::set1(0x007FFFFF)) | i::set1(0x3F800000)) - one;
+	const f log2x = e + t * (f::set1(1.44196558f) + t * (f::set1(-0.709662676f) +
+		t * (f::set1(0.417595387f) + t * (f::set1(-0.196269169f) +
+		t * f::set1(0.0463851616f)))));
+
+	// 2^y = 2^k * 2^r, k is y truncated, r in ]-1..0]
+	const f y = max(n * log2x, f::set1(-126));
+	const i k = i::cvt(y);
+	const f r = y - tofloat(k);
+	const f p = one + r * (f::set1(0.693063557f) + r * (f::set1(0.239456758f) +
+		r * (f::set1(0.0532235950f) + r * f::set1(0.00683190301f))));
+	return asfloat(i::bits(p) + k.template shl<23>());
+}
+
+
+//! x^n, x in [0..1], linear in SLightSet::table.
+template <class V>
+typename V::f PowTable(typename V::f x, const float* table)
+{
+	typedef typename V::f f;
+	typedef typename V::i i;
+
+	const f at = min(max(x, f::set1(0)), f::set1(1)) *
+		f::set1((float)SLightSet::TABLE_SIZE);
+	const i k = i::cvt(at);
+	const f r = at - tofloat(k);
+	const f a = gather(table, k);
+	const f b = gather(table + 1, k);
+	return a + (b - a) * r;
+}
+
+
+//! \brief The specular power POW of the set.
+//! \param shininess SLightSet::shininess in all the lanes.
+template <class V, ESpecularPow POW>
+typename V::f SpecularPow(const SLightSet& set, typename V::f shininess, typename V::f x)
+{
+	if constexpr (POW == ESpecularPow::Exact) {
+		return PowExact<V>(x, set.shininess);
+	}
+	else if constexpr (POW == ESpecularPow::Table) {
+		return PowTable<V>(x, set.table);
+	}
+	else {
+		return PowFast<V>(x, shininess);
+	}
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+//! The base color, no light: flat discs.
+struct SDirectShading
+{
+	static constexpr EShadingModel MODEL = EShadingModel::Direct;
+	//! The kernel computes the normals for Shade().
+	static constexpr bool NORMALS = false;
+
+	//! \brief Invariants of the sphere at (screenX, screenY) into the setup.
+	//! \param light Normalized, already in the setup.
+	template <class Vec>
+	static void Setup(const Vec&, float, float, SSphereSetup& s)
+	{
+		s.halfX = s.halfY = s.halfZ = 0;
+	}
+
+	template <class V>
+	struct SLanes
+	{
+		typedef typename V::f f;
+		typedef typename V::m m;
+
+		explicit SLanes(const SSphereSetup&) {}
+
+		//! \brief Intensity of the pixels of the unit normals u.
+		//! \param mask Narrowed to the lit pixels.
+		f Shade(f, f, f, m&) const { return f::set1(1); }
+
+		//! \brief The mask of Shade() by N.L alone, for the depth pass of
+		//!        the deferred shading.
+		m Lit(f, f, f, m mask) const { return mask; }
+	};
+};
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+//! Diffuse only: N.L.
+struct SLambertShading
+{
+	static constexpr EShadingModel MODEL = EShadingModel::Lambert;
+	static constexpr bool NORMALS = true;
+
+	template <class Vec>
+	static void Setup(const Vec&, float, float, SSphereSetup& s)
+	{
+		s.halfX = s.halfY = s.halfZ = 0;
+	}
+
+	template <class V>
+	struct SLanes
+	{
+		typedef typename V::f f;
+		typedef typename V::m m;
+
+		f lx, ly, lz;
+
+		explicit SLanes(const SSphereSetup& s) :
+			lx(f::set1(s.lightX)),
+			ly(f::set1(s.lightY)),
+			lz(f::set1(s.lightZ))
+		{}
+
+		f Shade(f ux, f uy, f uz, m& mask) const
+		{
+			const f NdotL = (lx * ux + ly * uy) + lz * uz;
+			mask = mask & (NdotL > f::set1(0));
+			return NdotL;
+		}
+
+		m Lit(f ux, f uy, f uz, m mask) const
+		{
+			return mask & (((lx * ux + ly * uy) + lz * uz) > f::set1(0));
+		}
+	};
+};
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+//! \brief N.L + (N.H)^12 of the original viewer, the default.
+//! H is the light plus the eye of the sphere center, so it changes
+//! over the screen.
+struct SPhongShading
+{
+	static constexpr EShadingModel MODEL = EShadingModel::Phong;
+	static constexpr bool NORMALS = true;
+
+	template <class Vec>
+	static void Setup(const Vec& light, float screenX, float screenY, SSphereSetup& s)
+	{
+		const Vec eye = { light.x + screenX, light.y + screenY, light.z + 1.f };
+		const Vec half = eye.normalizeCopy();
+		s.halfX = half.x;
+		s.halfY = half.y;
+		s.halfZ = half.z;
+	}
+
+	template <class V>
+	struct SLanes
+	{
+		typedef typename V::f f;
+		typedef typename V::m m;
+
+		f lx, ly, lz;
+		f hx, hy, hz;
+
+		explicit SLanes(const SSphereSetup& s) :
+			lx(f::set1(s.lightX)),
+			ly(f::set1(s.lightY)),
+			lz(f::set1(s.lightZ)),
+			hx(f::set1(s.halfX)),
+			hy(f::set1(s.halfY)),
+			hz(f::set1(s.halfZ))
+		{}
+
+		f Shade(f ux, f uy, f uz, m& mask) const
+		{
+			const f NdotL = (lx * ux + ly * uy) + lz * uz;
+			mask = mask & (NdotL > f::set1(0));
+			if (!mask.any()) {
+				return NdotL;
+			}
+
+			// shininess 12
+			const f NdotHV = (hx * ux + hy * uy) + hz * uz;
+			const f p2 = NdotHV * NdotHV;
+			const f p4 = p2 * p2;
+			const f p8 = p4 * p4;
+			const f specular = p8 * p4;
+			return min(NdotL + specular, f::set1(1));
+		}
+
+		m Lit(f ux, f uy, f uz, m mask) const
+		{
+			return mask & (((lx * ux + ly * uy) + lz * uz) > f::set1(0));
+		}
+	};
+};
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+//! \brief N.L + (N.H)^48, H half way between the light and the view
+//!        axis: the same highlight on every sphere, 4x the shininess
+//!        of Phong for a highlight of about its size.
+struct SBlinnPhongShading
+{
+	static constexpr EShadingModel MODEL = EShadingModel::BlinnPhong;
+	static constexpr bool NORMALS = true;
+
+	template <class Vec>
+	static void Setup(const Vec& light, float, float, SSphereSetup& s)
+	{
+		const Vec eye = { light.x, light.y, light.z + 1.f };
+		const Vec half = eye.normalizeCopy();
+		s.halfX = half.x;
+		s.halfY = half.y;
+		s.halfZ = half.z;
+	}
+
+	template <class V>
+	struct SLanes
+	{
+		typedef typename V::f f;
+		typedef typename V::m m;
+
+		f lx, ly, lz;
+		f hx, hy, hz;
+
+		explicit SLanes(const SSphereSetup& s) :
+			lx(f::set1(s.lightX)),
+			ly(f::set1(s.lightY)),
+			lz(f::set1(s.lightZ)),
+			hx(f::set1(s.halfX)),
+			hy(f::set1(s.halfY)),
+			hz(f::set1(s.halfZ))
+		{}
+
+		f Shade(f ux, f uy, f uz, m& mask) const
+		{
+			const f NdotL = (lx * ux + ly * uy) + lz * uz;
+			mask = mask & (NdotL > f::set1(0));
+			if (!mask.any()) {
+				return NdotL;
+			}
+
+			// shininess 48 = 32 + 16
+			const f NdotH = max((hx * ux + hy * uy) + hz * uz, f::set1(0));
+			const f p2 = NdotH * NdotH;
+			const f p4 = p2 * p2;
+			const f p8 = p4 * p4;
+			const f p16 = p8 * p8;
+			const f specular = (p16 * p16) * p16;
+			return min(NdotL + specular, f::set1(1));
+		}
+
+		m Lit(f ux, f uy, f uz, m mask) const
+		{
+			return mask & (((lx * ux + ly * uy) + lz * uz) > f::set1(0));
+		}
+	};
+};
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+//! \brief Ambient and the directional lights of SSphereSetup::lights.
+//! The specular power is of the policy, SLightSet::pow picks it with
+//! the model in WithShadingModel().
+//! \see CLighting
+template <ESpecularPow POW>
+struct SLightsShading
+{
+	static constexpr EShadingModel MODEL = EShadingModel::Lights;
+	static constexpr bool NORMALS = true;
+
+	//! The half vectors are of the lights, nothing per sphere.
+	template <class Vec>
+	static void Setup(const Vec&, float, float, SSphereSetup& s)
+	{
+		s.halfX = s.halfY = s.halfZ = 0;
+	}
+
+	template <class V>
+	struct SLanes
+	{
+		typedef typename V::f f;
+		typedef typename V::m m;
+
+		const SLightSet& set;
+		f ambient;
+		f shininess;
+
+		explicit SLanes(const SSphereSetup& s) :
+			set(*s.lights),
+			ambient(f::set1(s.lights->ambient)),
+			shininess(f::set1(s.lights->shininess))
+		{}
+
+		f Shade(f ux, f uy, f uz, m& mask) const
+		{
+			const f zero = f::set1(0);
+			f alpha = ambient;
+			for (int k = 0; k < set.count; ++k)
+			{
+				const f NdotL = (f::set1(set.dirX[k]) * ux + f::set1(set.dirY[k]) * uy) +
+					f::set1(set.dirZ[k]) * uz;
+				const m facing = NdotL > zero;
+				if (!(mask & facing).any())
+					continue;
+
+				const f NdotH = max((f::set1(set.halfX[k]) * ux +
+					f::set1(set.halfY[k]) * uy) + f::set1(set.halfZ[k]) * uz, zero);
+				const f light = f::set1(set.intensity[k]) *
+					(NdotL + SpecularPow<V, POW>(set, shininess, NdotH));
+				alpha = alpha + select(facing, light, zero);
+			}
+			mask = mask & (alpha > zero);
+			return min(alpha, f::set1(1));
+		}
+
+		//! Lit by the ambient or facing a light.
+		m Lit(f ux, f uy, f uz, m mask) const
+		{
+			if (set.ambient > 0) {
+				return mask;
+			}
+			const f zero = f::set1(0);
+			m facing = m::first(0);
+			for (int k = 0; k < set.count; ++k)
+			{
+				facing = facing | (((f::set1(set.dirX[k]) * ux + f::set1(set.dirY[k]) * uy) +
+					f::set1(set.dirZ[k]) * uz) > zero);
+			}
+			return mask & facing;
+		}
+	};
+};
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+//! \brief Calls f(model) with the policy of the model, so the runtime
+//!        choice is made once, out of the per-pixel code.
+//! \param pow Specular power of EShadingModel::Lights.
+template <class F>
+auto WithShadingModel(EShadingModel model, ESpecularPow pow, F f)
+{
+	switch (model)
+	{
+	case EShadingModel::Direct:
+		return f(SDirectShading());
+
+	case EShadingModel::Lambert:
+		return f(SLambertShading());
+
+	case EShadingModel::BlinnPhong:
+		return f(SBlinnPhongShading());
+
+	case EShadingModel::Lights:
+		switch (pow)
+		{
+		case ESpecularPow::Exact:
+			return f(SLightsShading<ESpecularPow::Exact>());
+
+		case ESpecularPow::Table:
+			return f(SLightsShading<ESpecularPow::Table>());
+
+		case ESpecularPow::Fast:
+			break;
+		}
+		return f(SLightsShading<ESpecularPow::Fast>());
+
+	case EShadingModel::Phong:
+		break;
+	}
+	return f(SPhongShading());
+}
+
+
+} // namespace
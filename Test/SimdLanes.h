@@ -0,0 +1,298 @@
+//! \brief Thin wrappers over SIMD registers, so a kernel is written once
+//!        and instantiated for the scalar code, SSE4.1 and AVX2.
+//! \warning Everything is in an anonymous namespace: a translation unit
+//!          compiled with -mavx2 (/arch:AVX2) must not share inline code
+//!          with the others, or the linker could pick AVX2 code for them.
+
+#pragma once
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <smmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+
+namespace {
+
+
+//! Bits in a lane mask.
+inline int PopCount(int bits)
+{
+	int n = 0;
+	for (; bits; bits &= bits - 1) {
+		++n;
+	}
+	return n;
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+//! One lane: reference scalar code.
+struct SimdScalar
+{
+	static constexpr int N = 1;
+
+	struct m
+	{
+		bool v;
+
+		m operator&(m b) const { return { v && b.v }; }
+		m operator|(m b) const { return { v || b.v }; }
+		bool any() const { return v; }
+		bool all() const { return v; }
+		int count() const { return v ? 1 : 0; }
+		//! Lanes [0..n[ are on.
+		static m first(int n) { return { n > 0 }; }
+	};
+
+	struct f
+	{
+		float v;
+
+		static f set1(float a) { return { a }; }
+		static f load(const float* p) { return { *p }; }
+		void store(float* p) const { *p = v; }
+		//! a, a + 1, a + 2...
+		static f ramp(float a) { return { a }; }
+
+		f operator+(f b) const { return { v + b.v }; }
+		f operator-(f b) const { return { v - b.v }; }
+		f operator*(f b) const { return { v * b.v }; }
+		f operator/(f b) const { return { v / b.v }; }
+		m operator>(f b) const { return { v > b.v }; }
+		m operator<(f b) const { return { v < b.v }; }
+
+		friend f sqrt(f a) { return { sqrtf(a.v) }; }
+		friend f min(f a, f b) { return { a.v < b.v ? a.v : b.v }; }
+		friend f max(f a, f b) { return { a.v > b.v ? a.v : b.v }; }
+		friend f select(m k, f a, f b) { return k.v ? a : b; }
+		//! Min of the lanes which mask is on.
+		friend float hmin(m k, f a, float other) {
+			return k.v ? std::min(a.v, other) : other;
+		}
+	};
+
+	struct i
+	{
+		unsigned int v;
+
+		static i set1(unsigned int a) { return { a }; }
+		static i load(const unsigned int* p) { return { *p }; }
+		void store(unsigned int* p) const { *p = v; }
+		//! Truncation toward zero.
+		static i cvt(f a) { return { (unsigned int)(int)a.v }; }
+
+		i operator|(i b) const { return { v | b.v }; }
+		i operator&(i b) const { return { v & b.v }; }
+		//! Wraps around, so a negative int adds as its two's complement.
+		i operator+(i b) const { return { v + b.v }; }
+		template <int k> i shl() const { return { v << k }; }
+		template <int k> i shr() const { return { v >> k }; }
+		m nonzero() const { return { v != 0 }; }
+
+		friend i select(m k, i a, i b) { return k.v ? a : b; }
+		friend f tofloat(i a) { return { (float)(int)a.v }; }
+		//! The bits of the floats and back.
+		static i bits(f a) { i r; memcpy(&r.v, &a.v, sizeof(r.v)); return r; }
+		friend f asfloat(i a) { f r; memcpy(&r.v, &a.v, sizeof(r.v)); return r; }
+		//! p[index] of every lane.
+		friend f gather(const float* p, i index) { return { p[index.v] }; }
+	};
+};
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+//! Four lanes of SSE4.1.
+struct SimdSSE
+{
+	static constexpr int N = 4;
+
+	struct m
+	{
+		__m128 v;
+
+		m operator&(m b) const { return { _mm_and_ps(v, b.v) }; }
+		m operator|(m b) const { return { _mm_or_ps(v, b.v) }; }
+		bool any() const { return _mm_movemask_ps(v) != 0; }
+		bool all() const { return _mm_movemask_ps(v) == 0xF; }
+		int count() const { return PopCount(_mm_movemask_ps(v)); }
+		static m first(int n) {
+			return { _mm_castsi128_ps(_mm_cmplt_epi32(
+				_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(n))) };
+		}
+	};
+
+	struct f
+	{
+		__m128 v;
+
+		static f set1(float a) { return { _mm_set1_ps(a) }; }
+		static f load(const float* p) { return { _mm_loadu_ps(p) }; }
+		void store(float* p) const { _mm_storeu_ps(p, v); }
+		static f ramp(float a) {
+			return { _mm_add_ps(_mm_set1_ps(a), _mm_setr_ps(0, 1, 2, 3)) };
+		}
+
+		f operator+(f b) const { return { _mm_add_ps(v, b.v) }; }
+		f operator-(f b) const { return { _mm_sub_ps(v, b.v) }; }
+		f operator*(f b) const { return { _mm_mul_ps(v, b.v) }; }
+		f operator/(f b) const { return { _mm_div_ps(v, b.v) }; }
+		m operator>(f b) const { return { _mm_cmpgt_ps(v, b.v) }; }
+		m operator<(f b) const { return { _mm_cmplt_ps(v, b.v) }; }
+
+		friend f sqrt(f a) { return { _mm_sqrt_ps(a.v) }; }
+		friend f min(f a, f b) { return { _mm_min_ps(a.v, b.v) }; }
+		friend f max(f a, f b) { return { _mm_max_ps(a.v, b.v) }; }
+		friend f select(m k, f a, f b) { return { _mm_blendv_ps(b.v, a.v, k.v) }; }
+		friend float hmin(m k, f a, float other) {
+			__m128 t = _mm_blendv_ps(_mm_set1_ps(other), a.v, k.v);
+			t = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+			t = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_cvtss_f32(t);
+		}
+	};
+
+	struct i
+	{
+		__m128i v;
+
+		static i set1(unsigned int a) { return { _mm_set1_epi32((int)a) }; }
+		static i load(const unsigned int* p) {
+			return { _mm_loadu_si128((const __m128i*)p) };
+		}
+		void store(unsigned int* p) const { _mm_storeu_si128((__m128i*)p, v); }
+		static i cvt(f a) { return { _mm_cvttps_epi32(a.v) }; }
+
+		i operator|(i b) const { return { _mm_or_si128(v, b.v) }; }
+		i operator&(i b) const { return { _mm_and_si128(v, b.v) }; }
+		i operator+(i b) const { return { _mm_add_epi32(v, b.v) }; }
+		template <int k> i shl() const { return { _mm_slli_epi32(v, k) }; }
+		template <int k> i shr() const { return { _mm_srli_epi32(v, k) }; }
+		m nonzero() const {
+			return { _mm_castsi128_ps(_mm_xor_si128(
+				_mm_cmpeq_epi32(v, _mm_setzero_si128()), _mm_set1_epi32(-1))) };
+		}
+
+		friend i select(m k, i a, i b) {
+			return { _mm_castps_si128(_mm_blendv_ps(
+				_mm_castsi128_ps(b.v), _mm_castsi128_ps(a.v), k.v)) };
+		}
+		friend f tofloat(i a) { return { _mm_cvtepi32_ps(a.v) }; }
+		static i bits(f a) { return { _mm_castps_si128(a.v) }; }
+		friend f asfloat(i a) { return { _mm_castsi128_ps(a.v) }; }
+		//! No gather before AVX2, lane by lane.
+		friend f gather(const float* p, i index) {
+			return { _mm_setr_ps(
+				p[_mm_extract_epi32(index.v, 0)], p[_mm_extract_epi32(index.v, 1)],
+				p[_mm_extract_epi32(index.v, 2)], p[_mm_extract_epi32(index.v, 3)]) };
+		}
+	};
+};
+
+
+
+
+#ifdef __AVX2__
+//////////////////////////////////////////////////////////////////////////
+//! Eight lanes of AVX2.
+struct SimdAVX2
+{
+	static constexpr int N = 8;
+
+	struct m
+	{
+		__m256 v;
+
+		m operator&(m b) const { return { _mm256_and_ps(v, b.v) }; }
+		m operator|(m b) const { return { _mm256_or_ps(v, b.v) }; }
+		bool any() const { return _mm256_movemask_ps(v) != 0; }
+		bool all() const { return _mm256_movemask_ps(v) == 0xFF; }
+		int count() const { return PopCount(_mm256_movemask_ps(v)); }
+		static m first(int n) {
+			return { _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+				_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))) };
+		}
+	};
+
+	struct f
+	{
+		__m256 v;
+
+		static f set1(float a) { return { _mm256_set1_ps(a) }; }
+		static f load(const float* p) { return { _mm256_loadu_ps(p) }; }
+		void store(float* p) const { _mm256_storeu_ps(p, v); }
+		static f ramp(float a) {
+			return { _mm256_add_ps(
+				_mm256_set1_ps(a), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)) };
+		}
+
+		f operator+(f b) const { return { _mm256_add_ps(v, b.v) }; }
+		f operator-(f b) const { return { _mm256_sub_ps(v, b.v) }; }
+		f operator*(f b) const { return { _mm256_mul_ps(v, b.v) }; }
+		f operator/(f b) const { return { _mm256_div_ps(v, b.v) }; }
+		m operator>(f b) const { return { _mm256_cmp_ps(v, b.v, _CMP_GT_OQ) }; }
+		m operator<(f b) const { return { _mm256_cmp_ps(v, b.v, _CMP_LT_OQ) }; }
+
+		friend f sqrt(f a) { return { _mm256_sqrt_ps(a.v) }; }
+		friend f min(f a, f b) { return { _mm256_min_ps(a.v, b.v) }; }
+		friend f max(f a, f b) { return { _mm256_max_ps(a.v, b.v) }; }
+		friend f select(m k, f a, f b) {
+			return { _mm256_blendv_ps(b.v, a.v, k.v) };
+		}
+		friend float hmin(m k, f a, float other) {
+			const __m256 t = _mm256_blendv_ps(_mm256_set1_ps(other), a.v, k.v);
+			__m128 h = _mm_min_ps(
+				_mm256_castps256_ps128(t), _mm256_extractf128_ps(t, 1));
+			h = _mm_min_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(1, 0, 3, 2)));
+			h = _mm_min_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_cvtss_f32(h);
+		}
+	};
+
+	struct i
+	{
+		__m256i v;
+
+		static i set1(unsigned int a) { return { _mm256_set1_epi32((int)a) }; }
+		static i load(const unsigned int* p) {
+			return { _mm256_loadu_si256((const __m256i*)p) };
+		}
+		void store(unsigned int* p) const {
+			_mm256_storeu_si256((__m256i*)p, v);
+		}
+		static i cvt(f a) { return { _mm256_cvttps_epi32(a.v) }; }
+
+		i operator|(i b) const { return { _mm256_or_si256(v, b.v) }; }
+		i operator&(i b) const { return { _mm256_and_si256(v, b.v) }; }
+		i operator+(i b) const { return { _mm256_add_epi32(v, b.v) }; }
+		template <int k> i shl() const { return { _mm256_slli_epi32(v, k) }; }
+		template <int k> i shr() const { return { _mm256_srli_epi32(v, k) }; }
+		m nonzero() const {
+			return { _mm256_castsi256_ps(_mm256_xor_si256(
+				_mm256_cmpeq_epi32(v, _mm256_setzero_si256()),
+				_mm256_set1_epi32(-1))) };
+		}
+
+		friend i select(m k, i a, i b) {
+			return { _mm256_castps_si256(_mm256_blendv_ps(
+				_mm256_castsi256_ps(b.v), _mm256_castsi256_ps(a.v), k.v)) };
+		}
+		friend f tofloat(i a) { return { _mm256_cvtepi32_ps(a.v) }; }
+		static i bits(f a) { return { _mm256_castps_si256(a.v) }; }
+		friend f asfloat(i a) { return { _mm256_castsi256_ps(a.v) }; }
+		friend f gather(const float* p, i index) {
+			return { _mm256_i32gather_ps(p, index.v, 4) };
+		}
+	};
+};
+#endif // __AVX2__
+
+
+} // namespace
@@ -1,119 +1,642 @@
+#define _USE_MATH_DEFINES
+
 #include "SphereData.h"
 #include "FrameBuffer.h"
-#include <stdio.h>
+#include "RayCaster.h"
+#include "FrameTrace.h"
+#include "TaskScheduler.h"
 #include <math.h>
+#include <string.h>
 #include <algorithm>
-#include <execution>
+#include <limits>
+#include <numeric>
+
+
+namespace {
 
+//! The same order for any input, ties by index.
+bool DepthLess(const SDepthKey& k1, const SDepthKey& k2)
+{
+	return k1.screenZ < k2.screenZ ||
+		(k1.screenZ == k2.screenZ && k1.index < k2.index);
+}
 
-CSphereData::CSphereData(const char* szFilename)
+//! \brief Depth as an unsigned key of the same order: the sign bit is
+//!        set for the positive floats, all the bits are flipped for the
+//!        negative ones.
+unsigned int DepthBits(float screenZ)
 {
-	FILE* in;
-	fopen_s(&in, szFilename, "rb");
+	unsigned int bits;
+	memcpy(&bits, &screenZ, sizeof(bits));
+	return bits ^ ((unsigned int)((int)bits >> 31) | 0x80000000u);
+}
+
+//! Elements per fix-up chunk of turntable sort.
+static constexpr size_t FIXUP_CHUNK = 1 << 16;
+//! Insertion moves per element of a chunk, the rest stays nearly sorted.
+static constexpr size_t FIXUP_MOVES_PER_ELEMENT = 8;
+//! Spheres per chunk of the per-sphere loops on the scheduler.
+static constexpr size_t SPHERE_GRAIN = 1 << 14;
+//! Clusters per chunk, a cluster is up to CLUSTER_SIZE spheres.
+static constexpr size_t CLUSTER_GRAIN = 16;
+
+} // namespace
 
-	int num = 0;
-	srand(1);
-	for (;;)
+
+CSphereData::CSphereData(const char* szFilename, const STextLayout* textLayout) :
+	m_Spheres(),
+	m_TextStats(),
+	m_DepthSort(EDepthSort::Sort),
+	m_nTurntableSectors(0),
+	m_fViewAspect(1),
+	m_fScreenRadiusMin(0),
+	m_fScreenRadiusMax(0),
+	m_RenderEngine(ERenderEngine::Raster)
+{
+	SSphereFileHeader header;
+	if (CSphereFile::IsSphereFile(szFilename))
 	{
-		SSphereElement el;
-		el.sphere = new SSphere;
-		if (fscanf_s(in, "%f %f %f",
-			&el.sphere->x, &el.sphere->y, &el.sphere->z) != 3)
-		{
-			break;
+		if (!m_File.Open(szFilename)) {
+			return;
 		}
+		m_Spheres = m_File.GetView();
+		header = m_File.GetHeader();
+	}
+	else
+	{
+		LoadSphereText(szFilename, textLayout, m_Loaded, m_TextStats);
+		m_Spheres = m_Loaded.View();
+		if (m_Spheres.size() == 0) {
+			return;
+		}
+		header = CSphereFile::MakeHeader(m_Spheres, false);
+	}
+
+	GetScreenRadii(header, m_fScreenRadiusMin, m_fScreenRadiusMax);
+
+	m_DepthOrder.resize(m_Spheres.size());
+	for (size_t i = 0; i < m_DepthOrder.size(); ++i) {
+		m_DepthOrder[i] = { 0, (unsigned int)i };
+	}
+}
+
 
-		el.sphere->y -= 60;
-		el.sphere->z -= 50;
+CSphereData::~CSphereData()
+{
+}
 
-		el.sphere->x *= 0.01f;
-		el.sphere->y *= 0.01f;
-		el.sphere->z *= 0.01f;
 
-		el.sphere->r = 5.0f + 5.0f * (rand() % 1024) / 1024.0f;
-		el.sphere->r *= 0.004f;
+std::size_t CSphereData::GetFileSize() const
+{
+	return m_File.IsOpen() ? m_File.GetSize() : m_TextStats.bytes;
+}
 
-		el.sphere->dwARGB = rand() & 0xff;
-		el.sphere->dwARGB = (el.sphere->dwARGB << 8) | (rand() & 0xff);
-		el.sphere->dwARGB = (el.sphere->dwARGB << 8) | (rand() & 0xff);
 
-		/* test
-		if (num == 0) {
-			// red
-			el.sphere->dwARGB = 0xFFFF0000;
+void CSphereData::SetDepthSort(EDepthSort v)
+{
+	// the clusters leave only the visible spheres
+	if (m_DepthSort == EDepthSort::Clusters && v != EDepthSort::Clusters)
+	{
+		m_DepthOrder.resize(m_Spheres.size());
+		for (size_t i = 0; i < m_DepthOrder.size(); ++i) {
+			m_DepthOrder[i] = { 0, (unsigned int)i };
 		}
-		else if (num == 1) {
-			// green
-			el.sphere->dwARGB = 0xFF00FF00;
+	}
+
+	m_DepthSort = v;
+	if (m_DepthSort == EDepthSort::Turntable && m_nTurntableSectors == 0) {
+		PrepareTurntable();
+	}
+	if (m_DepthSort == EDepthSort::Clusters && m_ClusterNodes.empty()) {
+		PrepareClusters();
+	}
+}
+
+
+void CSphereData::SetRenderEngine(ERenderEngine v)
+{
+	m_RenderEngine = v;
+	if (m_RenderEngine == ERenderEngine::RayCast && !m_RayCaster)
+	{
+		m_RayCaster = std::make_unique<CRayCaster>();
+		m_RayCaster->Build(m_Spheres);
+	}
+}
+
+
+void CSphereData::PrepareTurntable(int nSectors)
+{
+	const size_t n = m_Spheres.size();
+	const size_t maxSectors = std::max<size_t>(
+		TURNTABLE_MEMORY_BUDGET / (sizeof(unsigned int) * std::max<size_t>(n, 1)),
+		1);
+	m_nTurntableSectors = (int)std::min<size_t>(std::max(nSectors, 1), maxSectors);
+	m_TurntableOrders.resize(m_nTurntableSectors * n);
+
+	std::vector<SDepthKey> keys(n);
+	for (int k = 0; k < m_nTurntableSectors; ++k)
+	{
+		const float wi = (float)(k * M_PI / m_nTurntableSectors);
+		const float s = sin(wi);
+		const float c = cos(wi);
+		for (size_t i = 0; i < n; ++i) {
+			keys[i] = { m_Spheres.z[i] * s + m_Spheres.x[i] * c, (unsigned int)i };
 		}
-		else if (num == 2) {
-			// blue
-			el.sphere->dwARGB = 0xFF0000FF;
+		CTaskScheduler::Get().ParallelSort(
+			std::data(keys), std::data(keys) + n, DepthLess);
+
+		unsigned int* order = std::data(m_TurntableOrders) + k * n;
+		for (size_t i = 0; i < n; ++i) {
+			order[i] = keys[i].index;
 		}
-		*/
+	}
+}
+
+
+void CSphereData::PrepareClusters()
+{
+	BuildClusterTree(m_Spheres, CLUSTER_SIZE, m_ClusterNodes, m_ClusterOrder);
+}
 
-		m_SphereData.push_back(el);
 
-		++num;
-		//if (num > 100) break;
+void CSphereData::BuildClusterTree(
+	const SSphereView& spheres,
+	unsigned int leafSize,
+	std::vector<SClusterNode>& nodes,
+	std::vector<unsigned int>& order)
+{
+	const size_t n = spheres.size();
+	nodes.clear();
+	order.resize(n);
+	std::iota(std::begin(order), std::end(order), 0);
+	if (n == 0) {
+		return;
 	}
 
-	fclose(in);
+	const float* px = spheres.x;
+	const float* py = spheres.y;
+	const float* pz = spheres.z;
+	const float* pr = spheres.r;
+
+	// node and its spheres [begin .. end[ of the order
+	struct SItem
+	{
+		unsigned int node;
+		unsigned int begin;
+		unsigned int end;
+	};
+	std::vector<SItem> stack;
+	nodes.push_back({});
+	stack.push_back({ 0, 0, (unsigned int)n });
+	while (!stack.empty())
+	{
+		const SItem item = stack.back();
+		stack.pop_back();
+		unsigned int* first = std::data(order) + item.begin;
+		unsigned int* last = std::data(order) + item.end;
+
+		// bounding sphere around the center of the box
+		float lo[3] = {
+			std::numeric_limits<float>::max(),
+			std::numeric_limits<float>::max(),
+			std::numeric_limits<float>::max() };
+		float hi[3] = { -lo[0], -lo[1], -lo[2] };
+		for (const unsigned int* it = first; it < last; ++it)
+		{
+			const float p[3] = { px[*it], py[*it], pz[*it] };
+			for (int k = 0; k < 3; ++k)
+			{
+				lo[k] = std::min(lo[k], p[k]);
+				hi[k] = std::max(hi[k], p[k]);
+			}
+		}
+		const float cx = (lo[0] + hi[0]) / 2;
+		const float cy = (lo[1] + hi[1]) / 2;
+		const float cz = (lo[2] + hi[2]) / 2;
+		float radius = 0;
+		for (const unsigned int* it = first; it < last; ++it)
+		{
+			const float dx = px[*it] - cx;
+			const float dy = py[*it] - cy;
+			const float dz = pz[*it] - cz;
+			radius = std::max(radius, sqrtf(dx * dx + dy * dy + dz * dz) + pr[*it]);
+		}
+
+		SClusterNode node = { cx, cy, cz, radius, item.begin, item.end - item.begin };
+		if (node.count > leafSize)
+		{
+			// median by the longest axis
+			int axis = 0;
+			for (int k = 1; k < 3; ++k)
+			{
+				if (hi[k] - lo[k] > hi[axis] - lo[axis]) {
+					axis = k;
+				}
+			}
+			const float* p = (axis == 0) ? px : (axis == 1) ? py : pz;
+			unsigned int* middle = first + (last - first) / 2;
+			std::nth_element(first, middle, last,
+				[p](unsigned int a, unsigned int b) {
+					return p[a] < p[b] || (p[a] == p[b] && a < b);
+				});
+
+			node.first = (unsigned int)nodes.size();
+			node.count = 0;
+			const unsigned int split = item.begin + (unsigned int)(middle - first);
+			nodes.push_back({});
+			nodes.push_back({});
+			stack.push_back({ node.first, item.begin, split });
+			stack.push_back({ node.first + 1, split, item.end });
+		}
+		nodes[item.node] = node;
+	}
 }
 
 
-CSphereData::~CSphereData()
+void CSphereData::GetScreenRadii(
+	const SSphereFileHeader& header, float& fScreenRadiusMin, float& fScreenRadiusMax)
 {
-	for (auto&& el : m_SphereData) {
-		delete el.sphere;
+	// the depth z*sin(wi) + x*cos(wi) is within the distance to the axis
+	const float xMax = std::max(-header.boundsMin[0], header.boundsMax[0]);
+	const float zMax = std::max(-header.boundsMin[2], header.boundsMax[2]);
+	const float axisMax = sqrtf(xMax * xMax + zMax * zMax);
+	fScreenRadiusMin = header.radiusMin / (axisMax + CAMERA_DISTANCE);
+	fScreenRadiusMax = header.radiusMax / std::max(CAMERA_DISTANCE - axisMax, NEAR_Z);
+}
+
+
+bool CSphereData::IsSphereInView(
+	float x, float y, float z, float radius, float yMax, bool& inside)
+{
+	const float invSqrt2 = 0.70710678f;
+	const float invLenY = 1 / sqrtf(1 + yMax * yMax);
+	// distances to the planes, positive outside
+	const float d[5] = {
+		(x - z) * invSqrt2,
+		(-x - z) * invSqrt2,
+		(y - yMax * z) * invLenY,
+		(-y - z) * invSqrt2,
+		NEAR_Z - z };
+	inside = true;
+	for (const float di : d)
+	{
+		if (di > radius) {
+			return false;
+		}
+		inside = inside && (di < -radius);
 	}
+	return true;
 }
 
 
 void CSphereData::Render(CFrameBuffer& fb, float wi)
 {
+	SetViewAspect((float)fb.GetHeight() / fb.GetWidth());
+	Transform(wi);
+	Sort();
+	Rasterize(fb, wi);
+
+	// pause
+	//std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+}
+
+
+void CSphereData::Transform(float wi)
+{
+	TRACE_ZONE("transform");
+	if (m_RenderEngine == ERenderEngine::RayCast) {
+		return;
+	}
+
 	const float s = sin(wi);
 	const float c = cos(wi);
+	const float* px = m_Spheres.x;
+	const float* pz = m_Spheres.z;
 
-	std::for_each(
-		std::execution::par,
-		std::begin(m_SphereData),
-		std::end(m_SphereData),
-		[this, &fb, s, c](SSphereElement& ref) {
-			ref.screenZ = ref.sphere->z * s + ref.sphere->x * c;
-		});
+	if (m_DepthSort == EDepthSort::Clusters && !m_ClusterNodes.empty())
+	{
+		// screen y is [-1 .. 2 * height / width - 1]
+		const float yMax = 2 * m_fViewAspect - 1;
+		m_VisibleClusters.clear();
+		size_t nKeys = 0;
+		// a node and whether its parent is in the view entirely
+		std::vector< std::pair<unsigned int, bool> >& stack = m_ClusterStack;
+		stack.clear();
+		stack.push_back({ 0, false });
+		while (!stack.empty())
+		{
+			const auto [k, parentInside] = stack.back();
+			stack.pop_back();
+			const SClusterNode& node = m_ClusterNodes[k];
+			const float depth = node.z * s + node.x * c;
+			bool inside = parentInside;
+			if (!inside &&
+				!IsSphereInView(
+					node.x * s - node.z * c,
+					node.y,
+					depth + CAMERA_DISTANCE,
+					node.radius,
+					yMax,
+					inside))
+			{
+				continue;
+			}
+
+			if (node.count == 0)
+			{
+				stack.push_back({ node.first + 1, inside });
+				stack.push_back({ node.first, inside });
+				continue;
+			}
+			m_VisibleClusters.push_back({ depth - node.radius, k, nKeys });
+			nKeys += node.count;
+		}
+
+		m_ClusterKeys.resize(nKeys);
+		const unsigned int* order = std::data(m_ClusterOrder);
+		CTaskScheduler::Get().ParallelFor(
+			m_VisibleClusters.size(),
+			CLUSTER_GRAIN,
+			[this, px, pz, s, c, order](size_t k) {
+				const SVisibleCluster& cluster = m_VisibleClusters[k];
+				const SClusterNode& node = m_ClusterNodes[cluster.node];
+				SDepthKey* keys = std::data(m_ClusterKeys) + cluster.offset;
+				for (unsigned int j = 0; j < node.count; ++j)
+				{
+					const unsigned int i = order[node.first + j];
+					keys[j] = { pz[i] * s + px[i] * c, i };
+				}
+			});
+		return;
+	}
 
-	std::sort(
-		std::execution::par,
-		m_SphereData.begin(),
-		m_SphereData.end(),
-		[](const SSphereElement& s1, const SSphereElement& s2)
+	if (m_DepthSort == EDepthSort::Turntable && m_nTurntableSectors > 0)
+	{
+		// nearest sector, the second half turn reverses the first one
+		const double halfTurn = M_PI;
+		double a = fmod((double)wi, 2 * halfTurn);
+		if (a < 0) {
+			a += 2 * halfTurn;
+		}
+		bool reversed = (a >= halfTurn);
+		if (reversed) {
+			a -= halfTurn;
+		}
+		int k = (int)(a / halfTurn * m_nTurntableSectors + 0.5);
+		if (k == m_nTurntableSectors)
 		{
-			return s1.screenZ < s2.screenZ;
+			k = 0;
+			reversed = !reversed;
+		}
+
+		const size_t n = m_DepthOrder.size();
+		const unsigned int* order = std::data(m_TurntableOrders) + k * n;
+		SDepthKey* keys = std::data(m_DepthOrder);
+		CTaskScheduler::Get().ParallelFor(
+			n,
+			SPHERE_GRAIN,
+			[px, pz, s, c, n, order, keys, reversed](size_t j) {
+				SDepthKey& key = keys[j];
+				key.index = order[reversed ? n - 1 - j : j];
+				key.screenZ = pz[key.index] * s + px[key.index] * c;
+			});
+		return;
+	}
+
+	SDepthKey* keys = std::data(m_DepthOrder);
+	CTaskScheduler::Get().ParallelFor(
+		m_DepthOrder.size(),
+		SPHERE_GRAIN,
+		[px, pz, s, c, keys](size_t j) {
+			SDepthKey& key = keys[j];
+			key.screenZ = pz[key.index] * s + px[key.index] * c;
 		});
+}
+
+
+void CSphereData::Sort()
+{
+	TRACE_ZONE("sort");
+	if (m_RenderEngine == ERenderEngine::RayCast) {
+		return;
+	}
 
-	std::for_each(
-		std::execution::par,
-		std::begin(m_SphereData),
-		std::end(m_SphereData),
-		[this, &fb, s, c](const SSphereElement& ref) {
-			const float fX = ref.sphere->x * s - ref.sphere->z * c;
-			const float fY = ref.sphere->y;
-			float fZ = ref.screenZ;
-			fZ += 1.5f;
-			if (fZ < 0.001f)
-				return;
-
-			const FrameRenderElement fre{
-				fX / fZ,
-				fY / fZ,
-				fZ,
-				ref.sphere->r / fZ,
-				ref.sphere->dwARGB
-			};
-			fb.RenderSphere2(fre);
+	if (m_DepthSort == EDepthSort::Clusters && !m_ClusterNodes.empty())
+	{
+		// clusters front to back, the same order for any input
+		std::sort(
+			std::begin(m_VisibleClusters),
+			std::end(m_VisibleClusters),
+			[](const SVisibleCluster& a, const SVisibleCluster& b) {
+				return a.screenZ < b.screenZ ||
+					(a.screenZ == b.screenZ && a.node < b.node);
+			});
+
+		m_ClusterOffsets.resize(m_VisibleClusters.size());
+		size_t offset = 0;
+		for (size_t k = 0; k < m_VisibleClusters.size(); ++k)
+		{
+			m_ClusterOffsets[k] = offset;
+			offset += m_ClusterNodes[m_VisibleClusters[k].node].count;
+		}
+
+		m_DepthOrder.resize(m_ClusterKeys.size());
+		CTaskScheduler::Get().ParallelFor(
+			m_VisibleClusters.size(),
+			CLUSTER_GRAIN,
+			[this](size_t k) {
+				const SVisibleCluster& cluster = m_VisibleClusters[k];
+				const size_t count = m_ClusterNodes[cluster.node].count;
+				const SDepthKey* from = std::data(m_ClusterKeys) + cluster.offset;
+				SDepthKey* to = std::data(m_DepthOrder) + m_ClusterOffsets[k];
+				std::copy(from, from + count, to);
+				std::sort(to, to + count, DepthLess);
+			});
+		return;
+	}
+
+	if (m_DepthSort == EDepthSort::Turntable && m_nTurntableSectors > 0)
+	{
+		// The keys come in the order of a near angle, so an element is
+		// out of place only among spheres closer in depth than the change
+		// of depth in half a sector. Insertion sort by chunks repairs that
+		// in O(n) for usual scenes. A dense scene has O(n^2 / sectors)
+		// swaps, then a chunk stops at the budget and stays nearly sorted:
+		// it's still front to back within that error and the Z-buffer
+		// resolves the visibility exactly.
+		const size_t n = m_DepthOrder.size();
+		SDepthKey* keys = std::data(m_DepthOrder);
+		CTaskScheduler::Get().ParallelFor(
+			(n + FIXUP_CHUNK - 1) / FIXUP_CHUNK,
+			1,
+			[keys, n](size_t chunk) {
+				SDepthKey* first = keys + chunk * FIXUP_CHUNK;
+				SDepthKey* last = keys + std::min(n, (chunk + 1) * FIXUP_CHUNK);
+				size_t budget = FIXUP_MOVES_PER_ELEMENT * (last - first);
+				for (SDepthKey* it = first + 1; it < last; ++it)
+				{
+					const SDepthKey key = *it;
+					SDepthKey* hole = it;
+					for (; hole > first && budget > 0 && DepthLess(key, hole[-1]);
+						--hole, --budget)
+					{
+						*hole = hole[-1];
+					}
+					*hole = key;
+					if (budget == 0) {
+						return;
+					}
+				}
+			});
+		return;
+	}
+
+	if (m_DepthSort == EDepthSort::Radix || m_DepthSort == EDepthSort::Bucket)
+	{
+		m_SortTemp.resize(m_DepthOrder.size());
+		if (m_DepthSort == EDepthSort::Radix) {
+			RadixSort(std::data(m_DepthOrder), m_DepthOrder.size(), std::data(m_SortTemp));
+		}
+		else {
+			BucketSort(std::data(m_DepthOrder), m_DepthOrder.size(), std::data(m_SortTemp));
+		}
+		return;
+	}
+	if (m_DepthSort == EDepthSort::None) {
+		return;
+	}
+
+	CTaskScheduler::Get().ParallelSort(
+		std::data(m_DepthOrder),
+		std::data(m_DepthOrder) + m_DepthOrder.size(),
+		DepthLess);
+}
+
+
+void CSphereData::RadixSort(SDepthKey* keys, std::size_t n, SDepthKey* temp)
+{
+	CTaskScheduler::Get().ParallelRadixSort(keys, keys + n, temp,
+		[](const SDepthKey& key) { return DepthBits(key.screenZ); });
+}
+
+
+void CSphereData::BucketSort(SDepthKey* keys, std::size_t n, SDepthKey* temp)
+{
+	if (n == 0) {
+		return;
+	}
+
+	// the depth range by chunks
+	const size_t nChunks = (n + SPHERE_GRAIN - 1) / SPHERE_GRAIN;
+	std::vector< std::pair<float, float> > ranges(nChunks);
+	CTaskScheduler::Get().ParallelFor(
+		nChunks,
+		1,
+		[keys, n, &ranges](size_t chunk) {
+			const size_t last = std::min(n, (chunk + 1) * SPHERE_GRAIN);
+			float zMin = keys[chunk * SPHERE_GRAIN].screenZ;
+			float zMax = zMin;
+			for (size_t i = chunk * SPHERE_GRAIN + 1; i < last; ++i)
+			{
+				zMin = std::min(zMin, keys[i].screenZ);
+				zMax = std::max(zMax, keys[i].screenZ);
+			}
+			ranges[chunk] = { zMin, zMax };
 		});
+	float zMin = ranges[0].first;
+	float zMax = ranges[0].second;
+	for (const auto& range : ranges)
+	{
+		zMin = std::min(zMin, range.first);
+		zMax = std::max(zMax, range.second);
+	}
 
-	// pause
-	//std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+	const unsigned int maxBucket = (1u << DEPTH_BUCKET_BITS) - 1;
+	const float scale = zMax > zMin ? maxBucket / (zMax - zMin) : 0.f;
+	CTaskScheduler::Get().ParallelRadixSort(keys, keys + n, temp,
+		[zMin, scale, maxBucket](const SDepthKey& key) {
+			return std::min((unsigned int)((key.screenZ - zMin) * scale), maxBucket);
+		},
+		DEPTH_BUCKET_BITS);
+}
+
+
+void CSphereData::Rasterize(CFrameBuffer& fb, float wi)
+{
+	if (m_RenderEngine == ERenderEngine::RayCast)
+	{
+		m_RayCaster->Render(fb, wi);
+		return;
+	}
+
+	MakeRenderList(wi, m_RenderList);
+	Rasterize(fb, m_RenderList);
+}
+
+
+void CSphereData::MakeRenderList(float wi, std::vector<FrameRenderElement>& list) const
+{
+	TRACE_ZONE("project");
+	list.resize(m_DepthOrder.size());
+	Project(m_Spheres, std::data(m_DepthOrder), m_DepthOrder.size(), wi, std::data(list));
+}
+
+
+void CSphereData::Rasterize(
+	CFrameBuffer& fb, const std::vector<FrameRenderElement>& list) const
+{
+	fb.PrebuildImpostors(m_fScreenRadiusMin, m_fScreenRadiusMax);
+	fb.RenderSpheres(list);
+}
+
+
+unsigned int CSphereData::PickSphere(const CFrameBuffer& fb, int x, int y) const
+{
+	// the elements of the list are the keys of the depth order
+	const unsigned int element = fb.GetElementAt(x, y);
+	if (m_RenderEngine != ERenderEngine::Raster || element >= m_DepthOrder.size()) {
+		return NO_SPHERE;
+	}
+	return m_DepthOrder[element].index;
+}
+
+
+void CSphereData::Project(
+	const SSphereView& spheres,
+	const SDepthKey* keys,
+	size_t n,
+	float wi,
+	FrameRenderElement* list)
+{
+	const float s = sin(wi);
+	const float c = cos(wi);
+	const float* px = spheres.x;
+	const float* py = spheres.y;
+	const float* pz = spheres.z;
+	const float* pr = spheres.r;
+	const unsigned int* pARGB = spheres.dwARGB;
+
+	const auto ProjectKey = [px, py, pz, pr, pARGB, s, c](const SDepthKey& key) {
+		const unsigned int i = key.index;
+		const float fX = px[i] * s - pz[i] * c;
+		const float fY = py[i];
+		float fZ = key.screenZ;
+		fZ += CAMERA_DISTANCE;
+		if (fZ < NEAR_Z) {
+			// behind the camera, skipped by the frame buffer
+			return FrameRenderElement{ 0, 0, 0, 0, 0 };
+		}
+
+		return FrameRenderElement{
+			fX / fZ,
+			fY / fZ,
+			fZ,
+			pr[i] / fZ,
+			pARGB[i]
+		};
+	};
+	CTaskScheduler::Get().ParallelFor(
+		n,
+		SPHERE_GRAIN,
+		[keys, list, &ProjectKey](size_t k) { list[k] = ProjectKey(keys[k]); });
 }
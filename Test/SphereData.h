@@ -1,33 +1,320 @@
 #pragma once
 
+#include "SphereFile.h"
+#include "SphereText.h"
+
+#include <cstddef>
+#include <memory>
+#include <utility>
 #include <vector>
 
 
-__declspec(align(32)) struct SSphere
+//! \brief Read-only columns of spheres, owned by SSphereColumns
+//!        or by a mapped CSphereFile.
+struct SSphereView
+{
+	const float* x;
+	const float* y;
+	const float* z;
+	const float* r;
+	const unsigned int* dwARGB;
+	std::size_t n;
+
+	std::size_t size() const { return n; }
+};
+
+
+//! \brief Spheres stored by columns.
+//! Every stage reads only the columns it needs and the data is
+//! a few big allocations whatever the number of spheres.
+struct SSphereColumns
 {
-	float x, y, z, r;
-	unsigned int dwARGB;
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> r;
+	std::vector<unsigned int> dwARGB;
+
+	std::size_t size() const { return x.size(); }
+
+	void resize(std::size_t n)
+	{
+		x.resize(n);
+		y.resize(n);
+		z.resize(n);
+		r.resize(n);
+		dwARGB.resize(n);
+	}
+
+	void push_back(float sx, float sy, float sz, float sr, unsigned int argb)
+	{
+		x.push_back(sx);
+		y.push_back(sy);
+		z.push_back(sz);
+		r.push_back(sr);
+		dwARGB.push_back(argb);
+	}
+
+	SSphereView View() const
+	{
+		return {
+			std::data(x), std::data(y), std::data(z), std::data(r),
+			std::data(dwARGB), size() };
+	}
 };
 
 
-__declspec(align(32)) struct SSphereElement
+//! \brief Depth of a sphere for sorting.
+//! An array of the keys is a permutation of the spheres.
+struct SDepthKey
 {
 	float screenZ;
-	SSphere* sphere;
+	unsigned int index;
 };
 
 
 class CFrameBuffer;
+class CRayCaster;
+struct FrameRenderElement;
+
+
+//! How CSphereData puts spheres in depth order.
+enum class EDepthSort
+{
+	//! Full sort every frame.
+	Sort,
+	//! Orders precomputed for the turntable angles plus a local fix-up.
+	//! Exact for usual scenes, nearly sorted for very dense ones.
+	//! \see CSphereData::PrepareTurntable()
+	Turntable,
+	//! Spheres of the clusters in the view only. The clusters are sorted
+	//! by their nearest point, the spheres inside a cluster by depth.
+	//! \see CSphereData::PrepareClusters()
+	Clusters,
+	//! Full radix sort every frame, the order of Sort but equal depths
+	//! keep the order of the previous frame.
+	//! \see CSphereData::RadixSort()
+	Radix,
+	//! Spheres by 2^DEPTH_BUCKET_BITS slices of depth, the order inside
+	//! a slice is of the previous frame. The Z-buffer resolves the visibility exactly,
+	//! the order only helps the depth test to reject early.
+	//! \see CSphereData::BucketSort()
+	Bucket,
+	//! The order of the previous frame as it is.
+	None
+};
+
+
+//! How CSphereData removes hidden surfaces.
+enum class ERenderEngine
+{
+	//! Spheres in depth order drawn by the tiles of the frame buffer.
+	Raster,
+	//! A ray per pixel through a sphere hierarchy, no depth order.
+	//! \see CRayCaster
+	RayCast
+};
+
+
+//! \brief Node of the cluster tree of CSphereData.
+//! A leaf keeps up to CLUSTER_SIZE spheres, an inner node has two children.
+struct SClusterNode
+{
+	//! Bounding sphere of the spheres of the node, their radii included.
+	float x, y, z, radius;
+	//! Leaf: spheres [first .. first + count[ of the cluster order.
+	//! Inner: children first and first + 1, count is 0.
+	unsigned int first;
+	unsigned int count;
+};
 
 
 class CSphereData
 {
 public:
-	explicit CSphereData(const char* szFilename);
+	//! Turntable orders per half turn, the other half is the same reversed.
+	static constexpr int DEFAULT_TURNTABLE_SECTORS = 32;
+	//! Limit for the turntable orders, bytes.
+	static constexpr std::size_t TURNTABLE_MEMORY_BUDGET = 256u << 20;
+	//! Spheres per leaf of the cluster tree, at most.
+	static constexpr unsigned int CLUSTER_SIZE = 128;
+	//! Distance from the camera to the axis of rotation.
+	static constexpr float CAMERA_DISTANCE = 1.5f;
+	//! Nearest depth drawn, see Project().
+	static constexpr float NEAR_Z = 0.001f;
+	//! Pixel of no sphere, see PickSphere().
+	static constexpr unsigned int NO_SPHERE = 0xFFFFFFFF;
+	//! Depth buckets of EDepthSort::Bucket, as bits.
+	static constexpr int DEPTH_BUCKET_BITS = 16;
+
+
+public:
+	//! \param szFilename Binary CSphereFile, mapped without parsing,
+	//!        or text parsed by LoadSphereText().
+	//! \param textLayout Fields of a text line, detected when nullptr.
+	explicit CSphereData(
+		const char* szFilename, const STextLayout* textLayout = nullptr);
 	~CSphereData();
 
+	EDepthSort GetDepthSort() const { return m_DepthSort; }
+	//! Turntable and Clusters build their data when it isn't there.
+	void SetDepthSort(EDepthSort);
+
+	ERenderEngine GetRenderEngine() const { return m_RenderEngine; }
+	//! \brief RayCast builds its hierarchy when it isn't there.
+	//! Transform() and Sort() do nothing for it, Rasterize(fb, wi) traces
+	//! the rays. The render lists of MakeRenderList() are the raster's.
+	void SetRenderEngine(ERenderEngine);
+	//! nullptr until RayCast is set.
+	const CRayCaster* GetRayCaster() const { return m_RayCaster.get(); }
+
+	//! \brief Precomputes the depth orders for Y-axis rotation.
+	//! The depth z*sin(wi) + x*cos(wi) of a sphere is a sinusoid, so
+	//! a frame starts from the order of the nearest sector angle and
+	//! fixes it up in O(n) with a bounded number of moves. The orders take
+	//! 4 bytes per sphere per sector, the sectors are cut down to the budget.
+	//! \param nSectors Per half turn: order at wi + pi is a reversed
+	//!        order at wi.
+	void PrepareTurntable(int nSectors = DEFAULT_TURNTABLE_SECTORS);
+	int GetTurntableSectors() const { return m_nTurntableSectors; }
+
+	//! \brief Builds the cluster tree: median splits by the longest axis
+	//! down to CLUSTER_SIZE spheres. Transform() then skips the subtrees
+	//! which bounding spheres are out of the view.
+	void PrepareClusters();
+	int GetClusterCount() const { return (int)m_ClusterNodes.size(); }
+
+	//! \brief Height of the frame by its width for the view culling.
+	//! Render() takes it from the frame buffer.
+	void SetViewAspect(float fHeightByWidth) { m_fViewAspect = fHeightByWidth; }
+
+	//! Shortcut for Transform(), Sort() and Rasterize().
 	void Render(CFrameBuffer& fb, float wi);
 
+	//! \brief Stages of Render(). Called one by one when every stage
+	//!        should be measured separately.
+	//! \see SphereDataHeadless.cpp
+	void Transform(float wi);
+	void Sort();
+	void Rasterize(CFrameBuffer& fb, float wi);
+
+	//! \brief Rasterize() in two halves, so the projected spheres of a
+	//!        frame can be drawn while the next one is sorted.
+	//! MakeRenderList() projects the order of the last Sort(), the other
+	//! one only reads the spheres and may run on another thread.
+	//! \see CFramePipeline
+	void MakeRenderList(float wi, std::vector<FrameRenderElement>& list) const;
+	void Rasterize(CFrameBuffer& fb, const std::vector<FrameRenderElement>& list) const;
+
+	//! \brief Sphere seen at the pixel after Rasterize(fb, wi) of
+	//!        the raster into a deferred frame buffer, O(1).
+	//! Valid until the next Transform(), the pipeline keeps its own orders.
+	//! \return Index in GetSpheres() or NO_SPHERE.
+	//! \see CFrameBuffer::GetElementAt()
+	unsigned int PickSphere(const CFrameBuffer& fb, int x, int y) const;
+
+	//! \brief Median splits by the longest axis down to leafSize spheres.
+	//! \param order Sphere indices grouped by the leaves.
+	static void BuildClusterTree(
+		const SSphereView&,
+		unsigned int leafSize,
+		std::vector<SClusterNode>& nodes,
+		std::vector<unsigned int>& order);
+
+	//! \brief Tests a sphere in the camera space against the view:
+	//! x / z in [-1..1], y / z in [-1..yMax], z >= NEAR_Z.
+	//! \return false when the sphere is out of the view.
+	//! \param inside Set when the sphere is in the view entirely.
+	static bool IsSphereInView(
+		float x, float y, float z, float radius, float yMax, bool& inside);
+
+	//! \brief Sorts the keys by depth in O(n): the bits of the floats
+	//!        by CTaskScheduler::ParallelRadixSort(). Stable, the same
+	//!        order as std::sort by depth and the input order of ties.
+	//! \param temp n keys.
+	static void RadixSort(SDepthKey* keys, std::size_t n, SDepthKey* temp);
+
+	//! \brief Groups the keys by 2^DEPTH_BUCKET_BITS even slices of their
+	//!        depth range, half the passes of RadixSort(). Stable.
+	//! \param temp n keys.
+	static void BucketSort(SDepthKey* keys, std::size_t n, SDepthKey* temp);
+
+	//! \brief Projects the spheres of the keys in their order.
+	//! Spheres behind the camera get fScreenRadius 0.
+	static void Project(
+		const SSphereView&,
+		const SDepthKey* keys,
+		std::size_t n,
+		float wi,
+		FrameRenderElement* list);
+
+	//! Screen radii of the spheres of a header at any turntable angle.
+	//! \see CFrameBuffer::PrebuildImpostors()
+	static void GetScreenRadii(
+		const SSphereFileHeader&, float& fScreenRadiusMin, float& fScreenRadiusMax);
+
+	std::size_t Size() const { return m_Spheres.size(); }
+	const SSphereView& GetSpheres() const { return m_Spheres; }
+	bool IsMapped() const { return m_File.IsOpen(); }
+	//! Size of the loaded file, bytes.
+	std::size_t GetFileSize() const;
+	//! Counters of a text file.
+	const STextLoadStats& GetTextLoadStats() const { return m_TextStats; }
+
+
 private:
-	std::vector<SSphereElement> m_SphereData;
+	//! Columns of m_Loaded or m_File.
+	SSphereView m_Spheres;
+	SSphereColumns m_Loaded;
+	STextLoadStats m_TextStats;
+	CSphereFile m_File;
+
+	//! Spheres in depth order after Sort().
+	//! Transform() keeps the order of the previous frame or takes
+	//! the nearest turntable order.
+	std::vector<SDepthKey> m_DepthOrder;
+
+	EDepthSort m_DepthSort;
+	//! Second buffer of RadixSort() and BucketSort().
+	std::vector<SDepthKey> m_SortTemp;
+
+	//! Sphere indices sorted by depth at angles k * pi / m_nTurntableSectors,
+	//! sector after sector.
+	std::vector<unsigned int> m_TurntableOrders;
+	int m_nTurntableSectors;
+
+	//! Tree of the clusters, the root first.
+	std::vector<SClusterNode> m_ClusterNodes;
+	//! Sphere indices grouped by the leaves.
+	std::vector<unsigned int> m_ClusterOrder;
+	//! Leaves in the view after Transform().
+	struct SVisibleCluster
+	{
+		//! Depth of the nearest point.
+		float screenZ;
+		unsigned int node;
+		//! Keys of the spheres in m_ClusterKeys.
+		std::size_t offset;
+	};
+	std::vector<SVisibleCluster> m_VisibleClusters;
+	//! Offsets of m_VisibleClusters in m_DepthOrder after Sort().
+	std::vector<std::size_t> m_ClusterOffsets;
+	//! Nodes to visit by Transform(), kept between frames.
+	std::vector< std::pair<unsigned int, bool> > m_ClusterStack;
+	//! Keys of the visible clusters one by one, Sort() orders them
+	//! into m_DepthOrder.
+	std::vector<SDepthKey> m_ClusterKeys;
+	float m_fViewAspect;
+
+	//! Screen radii of the spheres at any angle, for the impostors.
+	//! \see CFrameBuffer::PrebuildImpostors()
+	float m_fScreenRadiusMin;
+	float m_fScreenRadiusMax;
+
+	//! Projected spheres in depth order.
+	//! \see Rasterize()
+	std::vector<FrameRenderElement> m_RenderList;
+
+	ERenderEngine m_RenderEngine;
+	std::unique_ptr<CRayCaster> m_RayCaster;
 };
@@ -0,0 +1,180 @@
+// fopen() is portable, skip MSVC's *_s() advice
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "SphereFile.h"
+#include "SphereData.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+
+
+//////////////////////////////////////////////////////////////////////////
+bool CSphereFile::IsSphereFile(const char* szFilename)
+{
+	FILE* in = fopen(szFilename, "rb");
+	if (!in) {
+		return false;
+	}
+	char magic[sizeof(MAGIC)];
+	const bool r = fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+		!memcmp(magic, MAGIC, sizeof(magic));
+	fclose(in);
+	return r;
+}
+
+
+bool CSphereFile::Open(const char* szFilename)
+{
+	if (!m_File.Open(szFilename)) {
+		return false;
+	}
+
+	const SSphereFileHeader& header = GetHeader();
+	if (m_File.GetSize() < sizeof(SSphereFileHeader) ||
+		memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		header.version != SSphereFileHeader::VERSION ||
+		header.count > std::numeric_limits<unsigned int>::max() ||
+		m_File.GetSize() < GetFileSize(header.count))
+	{
+		m_File.Close();
+		return false;
+	}
+
+	return true;
+}
+
+
+void CSphereFile::Close()
+{
+	m_File.Close();
+}
+
+
+const SSphereFileHeader& CSphereFile::GetHeader() const
+{
+	return *reinterpret_cast<const SSphereFileHeader*>(m_File.GetData());
+}
+
+
+SSphereView CSphereFile::GetView() const
+{
+	const std::uint64_t n = GetHeader().count;
+	const auto Column = [this, n](int column) {
+		return m_File.GetData() + GetColumnOffset(n, column);
+	};
+	return {
+		reinterpret_cast<const float*>(Column(COLUMN_X)),
+		reinterpret_cast<const float*>(Column(COLUMN_Y)),
+		reinterpret_cast<const float*>(Column(COLUMN_Z)),
+		reinterpret_cast<const float*>(Column(COLUMN_R)),
+		reinterpret_cast<const unsigned int*>(Column(COLUMN_ARGB)),
+		(std::size_t)n };
+}
+
+
+bool CSphereFile::VerifyChecksum() const
+{
+	const SSphereFileHeader& header = GetHeader();
+	if (!(header.flags & SSphereFileHeader::FLAG_CHECKSUM)) {
+		return true;
+	}
+	return Checksum(GetView()) == header.checksum;
+}
+
+
+std::uint64_t CSphereFile::GetColumnOffset(std::uint64_t count, int column)
+{
+	const std::uint64_t bytes =
+		(count * 4 + COLUMN_ALIGN - 1) / COLUMN_ALIGN * COLUMN_ALIGN;
+	return sizeof(SSphereFileHeader) + bytes * column;
+}
+
+
+std::uint64_t CSphereFile::GetFileSize(std::uint64_t count)
+{
+	return GetColumnOffset(count, COLUMN_COUNT);
+}
+
+
+std::uint64_t CSphereFile::Checksum(const SSphereView& spheres)
+{
+	std::uint64_t hash = 14695981039346656037ull;
+	const auto Hash = [&hash, &spheres](const void* column) {
+		const std::uint32_t* p = static_cast<const std::uint32_t*>(column);
+		for (std::size_t i = 0; i < spheres.size(); ++i)
+		{
+			hash ^= p[i];
+			hash *= 1099511628211ull;
+		}
+	};
+	Hash(spheres.x);
+	Hash(spheres.y);
+	Hash(spheres.z);
+	Hash(spheres.r);
+	Hash(spheres.dwARGB);
+	return hash;
+}
+
+
+SSphereFileHeader CSphereFile::MakeHeader(const SSphereView& spheres, bool checksum)
+{
+	SSphereFileHeader header = {};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = SSphereFileHeader::VERSION;
+	header.count = spheres.size();
+
+	std::fill(header.boundsMin, header.boundsMin + 3, std::numeric_limits<float>::max());
+	std::fill(header.boundsMax, header.boundsMax + 3, -std::numeric_limits<float>::max());
+	header.radiusMin = std::numeric_limits<float>::max();
+	header.radiusMax = 0;
+	for (std::size_t i = 0; i < spheres.size(); ++i)
+	{
+		const float p[3] = { spheres.x[i], spheres.y[i], spheres.z[i] };
+		for (int k = 0; k < 3; ++k)
+		{
+			header.boundsMin[k] = std::min(header.boundsMin[k], p[k]);
+			header.boundsMax[k] = std::max(header.boundsMax[k], p[k]);
+		}
+		header.radiusMin = std::min(header.radiusMin, spheres.r[i]);
+		header.radiusMax = std::max(header.radiusMax, spheres.r[i]);
+	}
+
+	if (checksum)
+	{
+		header.flags |= SSphereFileHeader::FLAG_CHECKSUM;
+		header.checksum = Checksum(spheres);
+	}
+	return header;
+}
+
+
+bool CSphereFile::Write(const char* szFilename, const SSphereView& spheres, bool checksum)
+{
+	if (spheres.size() == 0) {
+		return false;
+	}
+
+	FILE* out = fopen(szFilename, "wb");
+	if (!out) {
+		return false;
+	}
+
+	const SSphereFileHeader header = MakeHeader(spheres, checksum);
+	bool r = fwrite(&header, sizeof(header), 1, out) == 1;
+
+	const std::uint64_t n = spheres.size();
+	const void* columns[COLUMN_COUNT] = {
+		spheres.x, spheres.y, spheres.z, spheres.r, spheres.dwARGB };
+	static const unsigned char padding[COLUMN_ALIGN] = {};
+	for (int column = 0; r && column < COLUMN_COUNT; ++column)
+	{
+		const std::size_t pad = (std::size_t)(
+			GetColumnOffset(n, column + 1) - GetColumnOffset(n, column) - n * 4);
+		r = fwrite(columns[column], 4, n, out) == n &&
+			fwrite(padding, 1, pad, out) == pad;
+	}
+
+	return (fclose(out) == 0) && r;
+}
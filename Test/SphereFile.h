@@ -0,0 +1,93 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+
+
+struct SSphereView;
+
+
+//! \brief Header of a binary sphere file, 64 bytes, little-endian.
+//! The columns x, y, z, r (float) and ARGB (uint32) of `count` spheres
+//! follow it, every column starts at a multiple of COLUMN_ALIGN.
+//! \see CSphereFile::GetColumnOffset()
+struct SSphereFileHeader
+{
+	static constexpr std::uint32_t VERSION = 1;
+	//! The checksum is set.
+	static constexpr std::uint32_t FLAG_CHECKSUM = 1;
+
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t flags;
+	std::uint64_t count;
+	//! Box of the centers.
+	float boundsMin[3];
+	float boundsMax[3];
+	float radiusMin;
+	float radiusMax;
+	//! FNV-1a over the 32-bit words of the columns, padding excluded.
+	std::uint64_t checksum;
+};
+
+static_assert(sizeof(SSphereFileHeader) == 64, "The header is a part of the format");
+
+
+//! \brief Read-only memory mapping of a binary sphere file.
+//! Opening doesn't parse or copy anything, the columns are
+//! read straight from the page cache.
+class CSphereFile
+{
+public:
+	static constexpr char MAGIC[8] = { 'S', 'P', 'H', 'E', 'R', 'E', 'S', 0 };
+	static constexpr std::size_t COLUMN_ALIGN = 64;
+
+	enum EColumn
+	{
+		COLUMN_X,
+		COLUMN_Y,
+		COLUMN_Z,
+		COLUMN_R,
+		COLUMN_ARGB,
+		COLUMN_COUNT
+	};
+
+
+public:
+	//! \return true when the file starts with MAGIC.
+	static bool IsSphereFile(const char* szFilename);
+
+	//! \return false when the file can't be mapped, has another version
+	//!         or is shorter than its columns.
+	bool Open(const char* szFilename);
+	void Close();
+	bool IsOpen() const { return m_File.IsOpen(); }
+	std::size_t GetSize() const { return m_File.GetSize(); }
+
+	const SSphereFileHeader& GetHeader() const;
+	//! The columns of the mapping, valid until Close().
+	SSphereView GetView() const;
+
+	//! \brief Reads every column and compares with the header.
+	//! \return true when the file has no checksum.
+	bool VerifyChecksum() const;
+
+	//! \brief Header with the bounds of the spheres, not empty.
+	static SSphereFileHeader MakeHeader(const SSphereView&, bool checksum);
+
+	//! \brief Writes the spheres with bounds and an optional checksum.
+	static bool Write(const char* szFilename, const SSphereView&, bool checksum);
+
+	static std::uint64_t GetColumnOffset(std::uint64_t count, int column);
+	static std::uint64_t GetFileSize(std::uint64_t count);
+
+
+private:
+	static std::uint64_t Checksum(const SSphereView&);
+
+
+private:
+	CMappedFile m_File;
+};
@@ -0,0 +1,392 @@
+// fopen() is portable, skip MSVC's *_s() advice
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "SphereStream.h"
+#include "FrameTrace.h"
+#include "TaskScheduler.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+
+namespace {
+
+//! fseek() past 2 GB.
+bool Seek(FILE* f, std::uint64_t offset)
+{
+#ifdef _MSC_VER
+	return _fseeki64(f, (long long)offset, SEEK_SET) == 0;
+#else
+	return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+} // namespace
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+CSphereStream::CSphereStream() :
+	m_File(nullptr),
+	m_Header(),
+	m_fScreenRadiusMin(0),
+	m_fScreenRadiusMax(0),
+	m_nSlots(0),
+	m_Stats(),
+	m_iNextRead(0),
+	m_bReading(false),
+	m_bStop(false)
+{
+}
+
+
+CSphereStream::~CSphereStream()
+{
+	Close();
+}
+
+
+bool CSphereStream::IsStreamFile(const char* szFilename)
+{
+	FILE* in = fopen(szFilename, "rb");
+	if (!in) {
+		return false;
+	}
+	char magic[sizeof(MAGIC)];
+	const bool r = fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+		!memcmp(magic, MAGIC, sizeof(magic));
+	fclose(in);
+	return r;
+}
+
+
+std::size_t CSphereStream::GetChunkBytes(std::uint32_t count)
+{
+	return (std::size_t)count * (4 * sizeof(float) + sizeof(unsigned int));
+}
+
+
+bool CSphereStream::Write(
+	const char* szFilename, const SSphereView& spheres, unsigned int chunkSpheres)
+{
+	if (spheres.size() == 0 || chunkSpheres == 0) {
+		return false;
+	}
+
+	std::vector< SClusterNode > nodes;
+	std::vector< unsigned int > order;
+	CSphereData::BuildClusterTree(spheres, chunkSpheres, nodes, order);
+
+	SSphereStreamHeader header = {};
+	header.spheres = CSphereFile::MakeHeader(spheres, false);
+	memcpy(header.spheres.magic, MAGIC, sizeof(MAGIC));
+	header.spheres.version = SSphereStreamHeader::VERSION;
+
+	std::vector< SSphereChunk > chunks;
+	std::uint64_t offset = sizeof(header);
+	for (const SClusterNode& node : nodes)
+	{
+		if (node.count > 0) {
+			chunks.push_back({ node.x, node.y, node.z, node.radius, 0, node.count, 0 });
+			header.chunkSpheres = std::max(header.chunkSpheres, node.count);
+		}
+	}
+	header.chunkCount = chunks.size();
+	offset += chunks.size() * sizeof(SSphereChunk);
+	for (SSphereChunk& chunk : chunks)
+	{
+		offset = (offset + COLUMN_ALIGN - 1) / COLUMN_ALIGN * COLUMN_ALIGN;
+		chunk.offset = offset;
+		offset += GetChunkBytes(chunk.count);
+	}
+
+	FILE* out = fopen(szFilename, "wb");
+	if (!out) {
+		return false;
+	}
+	bool r =
+		fwrite(&header, sizeof(header), 1, out) == 1 &&
+		fwrite(std::data(chunks), sizeof(SSphereChunk), chunks.size(), out) == chunks.size();
+
+	// the leaves in the order of the nodes, as the chunks
+	std::vector< unsigned char > data(GetChunkBytes(header.chunkSpheres));
+	static const unsigned char padding[COLUMN_ALIGN] = {};
+	std::uint64_t written = sizeof(header) + chunks.size() * sizeof(SSphereChunk);
+	std::size_t k = 0;
+	for (const SClusterNode& node : nodes)
+	{
+		if (!r) {
+			break;
+		}
+		if (node.count == 0) {
+			continue;
+		}
+
+		const SSphereChunk& chunk = chunks[k++];
+		const unsigned int n = chunk.count;
+		float* x = reinterpret_cast<float*>(std::data(data));
+		float* y = x + n;
+		float* z = y + n;
+		float* radius = z + n;
+		unsigned int* argb = reinterpret_cast<unsigned int*>(radius + n);
+		for (unsigned int j = 0; j < n; ++j)
+		{
+			const unsigned int i = order[node.first + j];
+			x[j] = spheres.x[i];
+			y[j] = spheres.y[i];
+			z[j] = spheres.z[i];
+			radius[j] = spheres.r[i];
+			argb[j] = spheres.dwARGB[i];
+		}
+
+		const std::size_t pad = (std::size_t)(chunk.offset - written);
+		const std::size_t bytes = GetChunkBytes(n);
+		r = fwrite(padding, 1, pad, out) == pad &&
+			fwrite(std::data(data), 1, bytes, out) == bytes;
+		written = chunk.offset + bytes;
+	}
+
+	return (fclose(out) == 0) && r;
+}
+
+
+bool CSphereStream::Open(const char* szFilename, std::size_t budget)
+{
+	Close();
+
+	m_File = fopen(szFilename, "rb");
+	if (!m_File) {
+		return false;
+	}
+	if (fread(&m_Header, sizeof(m_Header), 1, m_File) != 1 ||
+		memcmp(m_Header.spheres.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		m_Header.spheres.version != SSphereStreamHeader::VERSION ||
+		m_Header.chunkCount == 0 ||
+		m_Header.chunkSpheres == 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_Chunks.resize((std::size_t)m_Header.chunkCount);
+	if (fread(std::data(m_Chunks), sizeof(SSphereChunk), m_Chunks.size(), m_File) !=
+		m_Chunks.size())
+	{
+		Close();
+		return false;
+	}
+	for (const SSphereChunk& chunk : m_Chunks)
+	{
+		if (chunk.count > m_Header.chunkSpheres)
+		{
+			Close();
+			return false;
+		}
+	}
+
+	// one slot is drawn while the next one is read, more than
+	// the chunks are never filled
+	const std::size_t slotBytes = GetChunkBytes(m_Header.chunkSpheres);
+	m_nSlots = (int)std::min< std::size_t >(
+		std::max< std::size_t >(budget / slotBytes, 2), m_Chunks.size());
+	m_SlotMemory.resize(slotBytes * m_nSlots);
+	m_Keys.resize(m_Header.chunkSpheres);
+	m_RenderList.reserve(m_Header.chunkSpheres);
+	m_Visible.reserve(m_Chunks.size());
+	m_iNextRead = 0;
+	m_Reader = std::thread(&CSphereStream::ReaderThread, this);
+
+	CSphereData::GetScreenRadii(m_Header.spheres, m_fScreenRadiusMin, m_fScreenRadiusMax);
+	return true;
+}
+
+
+void CSphereStream::Close()
+{
+	StopReader();
+	if (m_File) {
+		fclose(m_File);
+	}
+	m_File = nullptr;
+	m_Chunks.clear();
+	m_nSlots = 0;
+	// give the memory back
+	std::vector< unsigned char >().swap(m_SlotMemory);
+	std::vector< SDepthKey >().swap(m_Keys);
+	std::vector< FrameRenderElement >().swap(m_RenderList);
+}
+
+
+std::size_t CSphereStream::GetMemoryUsed() const
+{
+	return
+		m_Chunks.capacity() * sizeof(SSphereChunk) +
+		m_Visible.capacity() * sizeof(m_Visible[0]) +
+		m_SlotMemory.capacity() +
+		m_Keys.capacity() * sizeof(SDepthKey) +
+		m_RenderList.capacity() * sizeof(FrameRenderElement);
+}
+
+
+bool CSphereStream::ReadChunk(const SSphereChunk& chunk, unsigned char* slot)
+{
+	const std::size_t bytes = GetChunkBytes(chunk.count);
+	return Seek(m_File, chunk.offset) && fread(slot, 1, bytes, m_File) == bytes;
+}
+
+
+void CSphereStream::ReaderThread()
+{
+	TRACE_THREAD_NAME("reader");
+	const std::size_t slotBytes = GetChunkBytes(m_Header.chunkSpheres);
+	std::unique_lock< std::mutex > lock(m_Mutex);
+	for (;;)
+	{
+		m_Changed.wait(lock, [this]() {
+			return m_bStop || (m_iNextRead < m_Visible.size() && !m_FreeSlots.empty());
+		});
+		if (m_bStop) {
+			return;
+		}
+		const int slot = m_FreeSlots.front();
+		m_FreeSlots.pop_front();
+		const SSphereChunk& chunk = m_Chunks[m_Visible[m_iNextRead++].second];
+		m_bReading = true;
+		lock.unlock();
+
+		bool ok;
+		{
+			TRACE_ZONE("read");
+			ok = ReadChunk(chunk, std::data(m_SlotMemory) + slot * slotBytes);
+		}
+
+		lock.lock();
+		m_bReading = false;
+		m_ReadySlots.push_back(ok ? slot : -1);
+		m_Changed.notify_all();
+	}
+}
+
+
+void CSphereStream::StopReader()
+{
+	if (!m_Reader.joinable()) {
+		return;
+	}
+	{
+		std::lock_guard< std::mutex > lock(m_Mutex);
+		m_bStop = true;
+	}
+	m_Changed.notify_all();
+	m_Reader.join();
+	m_bStop = false;
+}
+
+
+bool CSphereStream::Render(CFrameBuffer& fb, float wi)
+{
+	m_Stats = {};
+	if (!m_File) {
+		return false;
+	}
+
+	// visible chunks front to back, the reader is idle between frames
+	const float s = sin(wi);
+	const float c = cos(wi);
+	const float yMax = 2.f * fb.GetHeight() / fb.GetWidth() - 1;
+	std::unique_lock< std::mutex > frameLock(m_Mutex);
+	m_Visible.clear();
+	for (std::uint32_t k = 0; k < (std::uint32_t)m_Chunks.size(); ++k)
+	{
+		const SSphereChunk& chunk = m_Chunks[k];
+		const float depth = chunk.z * s + chunk.x * c;
+		bool inside;
+		if (CSphereData::IsSphereInView(
+			chunk.x * s - chunk.z * c,
+			chunk.y,
+			depth + CSphereData::CAMERA_DISTANCE,
+			chunk.radius,
+			yMax,
+			inside))
+		{
+			m_Visible.push_back({ depth - chunk.radius, k });
+		}
+	}
+	std::sort(std::begin(m_Visible), std::end(m_Visible));
+	m_Stats.chunksVisible = m_Visible.size();
+
+	// the reader fills free slots in the order of m_Visible
+	m_FreeSlots.clear();
+	m_ReadySlots.clear();
+	for (int slot = 0; slot < m_nSlots; ++slot) {
+		m_FreeSlots.push_back(slot);
+	}
+	m_iNextRead = 0;
+	frameLock.unlock();
+	m_Changed.notify_all();
+
+	fb.PrebuildImpostors(m_fScreenRadiusMin, m_fScreenRadiusMax);
+	const std::size_t slotBytes = GetChunkBytes(m_Header.chunkSpheres);
+
+	bool ok = true;
+	for (const auto& visible : m_Visible)
+	{
+		int slot;
+		{
+			TRACE_ZONE("wait");
+			const auto t0 = std::chrono::steady_clock::now();
+			std::unique_lock< std::mutex > lock(m_Mutex);
+			m_Changed.wait(lock, [this]() { return !m_ReadySlots.empty(); });
+			slot = m_ReadySlots.front();
+			m_ReadySlots.pop_front();
+			m_Stats.waitMs += std::chrono::duration< double, std::milli >(
+				std::chrono::steady_clock::now() - t0).count();
+		}
+		if (slot < 0)
+		{
+			ok = false;
+			break;
+		}
+
+		const SSphereChunk& chunk = m_Chunks[visible.second];
+		const unsigned int n = chunk.count;
+		const float* x = reinterpret_cast<const float*>(
+			std::data(m_SlotMemory) + slot * slotBytes);
+		const SSphereView spheres = {
+			x, x + n, x + 2 * n, x + 3 * n,
+			reinterpret_cast<const unsigned int*>(x + 4 * n),
+			n };
+		m_Stats.bytesRead += GetChunkBytes(n);
+		m_Stats.spheresDrawn += n;
+
+		for (unsigned int i = 0; i < n; ++i) {
+			m_Keys[i] = { spheres.z[i] * s + spheres.x[i] * c, i };
+		}
+		CTaskScheduler::Get().ParallelSort(
+			std::data(m_Keys),
+			std::data(m_Keys) + n,
+			[](const SDepthKey& a, const SDepthKey& b) {
+				return a.screenZ < b.screenZ ||
+					(a.screenZ == b.screenZ && a.index < b.index);
+			});
+		m_RenderList.resize(n);
+		CSphereData::Project(spheres, std::data(m_Keys), n, wi, std::data(m_RenderList));
+		fb.RenderSpheres(m_RenderList);
+		m_Stats.raster += fb.GetStats();
+
+		{
+			std::lock_guard< std::mutex > lock(m_Mutex);
+			m_FreeSlots.push_back(slot);
+		}
+		m_Changed.notify_all();
+	}
+
+	// after a failed read the rest isn't read, the slots are of the next frame
+	frameLock.lock();
+	m_iNextRead = m_Visible.size();
+	m_Changed.wait(frameLock, [this]() { return !m_bReading; });
+	return ok;
+}
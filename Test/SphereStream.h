@@ -0,0 +1,157 @@
+#pragma once
+
+#include "SphereData.h"
+#include "FrameBuffer.h"
+
+#include <stdio.h>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//! \brief Header of a chunked sphere file, 128 bytes, little-endian.
+//! The chunk table follows it, then the chunks: x, y, z, r, ARGB
+//! of the spheres of a chunk one column after another.
+struct SSphereStreamHeader
+{
+	static constexpr std::uint32_t VERSION = 1;
+
+	//! Magic CSphereStream::MAGIC, count, bounds and radii of all spheres.
+	SSphereFileHeader spheres;
+	std::uint64_t chunkCount;
+	//! Spheres of the biggest chunk.
+	std::uint32_t chunkSpheres;
+	std::uint32_t reserved[13];
+};
+
+static_assert(sizeof(SSphereStreamHeader) == 128, "The header is a part of the format");
+
+
+//! \brief Spatially coherent part of a chunked sphere file.
+struct SSphereChunk
+{
+	//! Bounding sphere, the radii included.
+	float x, y, z, radius;
+	//! From the start of the file, a multiple of COLUMN_ALIGN.
+	std::uint64_t offset;
+	std::uint32_t count;
+	std::uint32_t reserved;
+};
+
+static_assert(sizeof(SSphereChunk) == 32, "The chunk is a part of the format");
+
+
+//! \brief Renders a chunked sphere file bigger than the memory.
+//! Only the chunk table stays in memory. A frame culls the chunks by
+//! their bounding spheres and the reader thread, started by Open(),
+//! loads the visible ones front to back into a fixed number of slots,
+//! while the calling thread sorts and draws the loaded ones into the
+//! frame buffer. The Z-buffer composes the chunks into the image of the
+//! whole set but for the pixels where spheres of two chunks are at the
+//! same depth: the order of the chunks decides those, not the sort of
+//! the whole set.
+class CSphereStream
+{
+public:
+	static constexpr char MAGIC[8] = { 'S', 'P', 'H', 'S', 'T', 'R', 'M', 0 };
+	static constexpr std::size_t COLUMN_ALIGN = 64;
+	//! 5 MB per chunk.
+	static constexpr unsigned int DEFAULT_CHUNK_SPHERES = 1 << 18;
+	//! For the chunk slots, the key and render lists of a chunk are extra.
+	static constexpr std::size_t DEFAULT_MEMORY_BUDGET = 64u << 20;
+
+	//! Counters of the last Render().
+	struct SStreamStats
+	{
+		std::size_t chunksVisible;
+		std::size_t spheresDrawn;
+		std::size_t bytesRead;
+		//! Time the drawing waited for the reader, ms.
+		double waitMs;
+		//! Sum of the chunks.
+		CFrameBuffer::SRasterStats raster;
+	};
+
+
+public:
+	CSphereStream();
+	~CSphereStream();
+
+	CSphereStream(const CSphereStream&) = delete;
+	CSphereStream& operator=(const CSphereStream&) = delete;
+
+	//! \return true when the file starts with MAGIC.
+	static bool IsStreamFile(const char* szFilename);
+
+	//! \brief Splits the spheres into chunks of up to chunkSpheres by
+	//! the cluster tree and writes them.
+	static bool Write(
+		const char* szFilename, const SSphereView&, unsigned int chunkSpheres);
+
+	//! \param budget Bytes for the chunk slots, at least 2 slots are taken
+	//! but no more than the chunks.
+	bool Open(const char* szFilename, std::size_t budget = DEFAULT_MEMORY_BUDGET);
+	void Close();
+	bool IsOpen() const { return m_File != nullptr; }
+
+	const SSphereStreamHeader& GetHeader() const { return m_Header; }
+	int GetSlotCount() const { return m_nSlots; }
+	//! All memory of the stream, bytes. Doesn't depend on the file size
+	//! but for the chunk table.
+	std::size_t GetMemoryUsed() const;
+
+	//! \brief Draws the frame of the turntable angle, fb isn't cleared.
+	//! \warning Not for the deferred shading of fb: a chunk is a list of
+	//!          its own and the keys of the chunks before would be shaded
+	//!          by it.
+	//! \return false when a chunk can't be read.
+	bool Render(CFrameBuffer& fb, float wi);
+
+	const SStreamStats& GetStats() const { return m_Stats; }
+
+
+private:
+	//! Reads the chunk into the slot memory.
+	bool ReadChunk(const SSphereChunk&, unsigned char* slot);
+
+	static std::size_t GetChunkBytes(std::uint32_t count);
+
+	//! Reads the chunks of m_Visible from m_iNextRead into free slots.
+	void ReaderThread();
+	void StopReader();
+
+
+private:
+	FILE* m_File;
+	SSphereStreamHeader m_Header;
+	std::vector< SSphereChunk > m_Chunks;
+	float m_fScreenRadiusMin;
+	float m_fScreenRadiusMax;
+
+	//! Slots of chunkSpheres each, allocated by Open().
+	std::vector< unsigned char > m_SlotMemory;
+	int m_nSlots;
+
+	//! Visible chunks front to back: nearest depth and index.
+	std::vector< std::pair< float, std::uint32_t > > m_Visible;
+	std::vector< SDepthKey > m_Keys;
+	std::vector< FrameRenderElement > m_RenderList;
+
+	SStreamStats m_Stats;
+
+	//! Slots move free -> read -> ready -> drawn -> free, a failed read
+	//! is a ready slot of -1.
+	std::mutex m_Mutex;
+	std::condition_variable m_Changed;
+	std::deque< int > m_FreeSlots;
+	std::deque< int > m_ReadySlots;
+	//! Next chunk of m_Visible to read, m_Visible.size() when done.
+	std::size_t m_iNextRead;
+	bool m_bReading;
+	bool m_bStop;
+	std::thread m_Reader;
+};
@@ -0,0 +1,381 @@
+#include "SphereText.h"
+#include "SphereData.h"
+#include "MappedFile.h"
+#include "TaskScheduler.h"
+
+#include <string.h>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+
+namespace {
+
+//! A part of a file parsed by one task is not smaller.
+static constexpr std::size_t MIN_CHUNK_BYTES = 1 << 20;
+//! Parts per thread of the scheduler, evens out lines of different lengths.
+static constexpr std::size_t CHUNKS_PER_THREAD = 4;
+
+
+bool IsSeparator(char c)
+{
+	return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+
+//! The same value for an index on every platform, unlike rand().
+std::uint32_t HashIndex(std::uint32_t i, std::uint32_t seed)
+{
+	std::uint32_t h = i * 0x9E3779B9u + seed;
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h;
+}
+
+
+//! Fields of a line, 0 when the first one isn't a number.
+int CountFields(const char* p, const char* end)
+{
+	while (p < end && IsSeparator(*p)) {
+		++p;
+	}
+	float v;
+	if (std::from_chars(p, end, v).ec != std::errc()) {
+		return 0;
+	}
+
+	int n = 0;
+	while (p < end)
+	{
+		while (p < end && IsSeparator(*p)) {
+			++p;
+		}
+		if (p == end) {
+			break;
+		}
+		++n;
+		while (p < end && !IsSeparator(*p)) {
+			++p;
+		}
+	}
+	return n;
+}
+
+
+//! A sphere of a line in the units of the file.
+struct SParsedLine
+{
+	float x, y, z, r;
+	std::uint32_t argb;
+};
+
+
+//! \return false when a field is missing or isn't a number.
+bool ParseLine(
+	const char* p, const char* end, const STextLayout& layout, SParsedLine& out)
+{
+	for (int f = 0; f < layout.nFields; ++f)
+	{
+		while (p < end && IsSeparator(*p)) {
+			++p;
+		}
+		if (p == end) {
+			return false;
+		}
+
+		std::from_chars_result r = { p, std::errc() };
+		switch (layout.fields[f])
+		{
+		case ETextField::Skip:
+			while (r.ptr < end && !IsSeparator(*r.ptr)) {
+				++r.ptr;
+			}
+			break;
+
+		case ETextField::X:
+			r = std::from_chars(p, end, out.x);
+			break;
+
+		case ETextField::Y:
+			r = std::from_chars(p, end, out.y);
+			break;
+
+		case ETextField::Z:
+			r = std::from_chars(p, end, out.z);
+			break;
+
+		case ETextField::R:
+			r = std::from_chars(p, end, out.r);
+			break;
+
+		case ETextField::ARGB:
+			if (*p == '#') {
+				++p;
+			}
+			else if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+				p += 2;
+			}
+			r = std::from_chars(p, end, out.argb, 16);
+			break;
+		}
+		if (r.ec != std::errc() || (r.ptr < end && !IsSeparator(*r.ptr))) {
+			return false;
+		}
+		p = r.ptr;
+	}
+	return true;
+}
+
+} // namespace
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+bool STextLayout::Parse(const char* sz)
+{
+	static const struct
+	{
+		const char* szName;
+		ETextField field;
+	} NAMES[] = {
+		{ "_", ETextField::Skip },
+		{ "x", ETextField::X },
+		{ "y", ETextField::Y },
+		{ "z", ETextField::Z },
+		{ "r", ETextField::R },
+		{ "argb", ETextField::ARGB },
+	};
+
+	nFields = 0;
+	while (*sz)
+	{
+		const std::size_t len = strcspn(sz, ",");
+		if (nFields == MAX_FIELDS) {
+			return false;
+		}
+		bool known = false;
+		for (const auto& name : NAMES)
+		{
+			if (strlen(name.szName) == len && !strncmp(sz, name.szName, len))
+			{
+				if (name.field != ETextField::Skip && Has(name.field)) {
+					return false;
+				}
+				fields[nFields++] = name.field;
+				known = true;
+			}
+		}
+		if (!known) {
+			return false;
+		}
+		sz += len;
+		if (*sz == ',') {
+			++sz;
+		}
+	}
+
+	return Has(ETextField::X) && Has(ETextField::Y) && Has(ETextField::Z);
+}
+
+
+STextLayout STextLayout::ForFields(int n)
+{
+	STextLayout layout = {
+		{ ETextField::X, ETextField::Y, ETextField::Z, ETextField::R, ETextField::ARGB },
+		std::min(std::max(n, 3), 5) };
+	return layout;
+}
+
+
+bool STextLayout::Has(ETextField field) const
+{
+	return std::find(fields, fields + nFields, field) != fields + nFields;
+}
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+float SceneToText(float v, float origin)
+{
+	return (float)((double)v * TEXT_SCALE + origin);
+}
+
+
+float TextToScene(float t, float origin)
+{
+	return (t - origin) * 0.01f;
+}
+
+
+void SnapToText(SSphereColumns& spheres)
+{
+	const auto Snap = [](std::vector<float>& v, float origin) {
+		for (float& x : v) {
+			x = TextToScene(SceneToText(x, origin), origin);
+		}
+	};
+	Snap(spheres.x, 0);
+	Snap(spheres.y, TEXT_ORIGIN_Y);
+	Snap(spheres.z, TEXT_ORIGIN_Z);
+	Snap(spheres.r, 0);
+}
+
+
+bool LoadSphereText(
+	const char* szFilename,
+	const STextLayout* layout,
+	SSphereColumns& spheres,
+	STextLoadStats& stats)
+{
+	stats = {};
+	spheres.resize(0);
+
+	CMappedFile file;
+	if (!file.Open(szFilename)) {
+		return false;
+	}
+	const char* data = reinterpret_cast<const char*>(file.GetData());
+	const std::size_t size = file.GetSize();
+	stats.bytes = size;
+	const char* const dataEnd = data + size;
+
+	// the first data line tells the layout
+	stats.layout = STextLayout::ForFields(3);
+	if (layout) {
+		stats.layout = *layout;
+	}
+	else
+	{
+		for (const char* line = data; line < dataEnd; )
+		{
+			const char* eol = std::find(line, dataEnd, '\n');
+			const int n = (*line == '#') ? 0 : CountFields(line, eol);
+			if (n > 0)
+			{
+				stats.layout = STextLayout::ForFields(n);
+				break;
+			}
+			line = eol + 1;
+		}
+	}
+	const STextLayout& fields = stats.layout;
+
+	// parts split at line boundaries
+	const std::size_t nThreads = (std::size_t)CTaskScheduler::Get().GetThreadCount();
+	const std::size_t nChunks = std::max<std::size_t>(
+		std::min(size / MIN_CHUNK_BYTES, nThreads * CHUNKS_PER_THREAD), 1);
+	std::vector< const char* > bounds(nChunks + 1);
+	bounds[0] = data;
+	bounds[nChunks] = dataEnd;
+	for (std::size_t k = 1; k < nChunks; ++k)
+	{
+		const char* p = std::max(data + size / nChunks * k, bounds[k - 1]);
+		p = std::find(p, dataEnd, '\n');
+		bounds[k] = (p < dataEnd) ? p + 1 : dataEnd;
+	}
+
+	// a line is at most a sphere, so the parts get slots by their lines
+	std::vector< std::size_t > first(nChunks + 1, 0);
+	CTaskScheduler::Get().ParallelFor(
+		nChunks,
+		1,
+		[&bounds, &first](std::size_t k) {
+			const char* b = bounds[k];
+			const char* e = bounds[k + 1];
+			std::size_t n = std::count(b, e, '\n');
+			if (b < e && e[-1] != '\n') {
+				++n;
+			}
+			first[k + 1] = n;
+		});
+	std::partial_sum(std::begin(first), std::end(first), std::begin(first));
+	spheres.resize(first[nChunks]);
+
+	std::vector< std::size_t > parsed(nChunks, 0);
+	std::vector< std::size_t > skipped(nChunks, 0);
+	float* px = std::data(spheres.x);
+	float* py = std::data(spheres.y);
+	float* pz = std::data(spheres.z);
+	float* pr = std::data(spheres.r);
+	unsigned int* pARGB = std::data(spheres.dwARGB);
+	CTaskScheduler::Get().ParallelFor(
+		nChunks,
+		1,
+		[&](std::size_t k) {
+			std::size_t i = first[k];
+			for (const char* line = bounds[k]; line < bounds[k + 1]; )
+			{
+				const char* eol = std::find(line, bounds[k + 1], '\n');
+				SParsedLine s = {};
+				if (*line == '#' || line == eol || (eol - line == 1 && *line == '\r')) {
+					// comment or empty
+				}
+				else if (ParseLine(line, eol, fields, s))
+				{
+					px[i] = TextToScene(s.x, 0);
+					py[i] = TextToScene(s.y, TEXT_ORIGIN_Y);
+					pz[i] = TextToScene(s.z, TEXT_ORIGIN_Z);
+					pr[i] = TextToScene(s.r, 0);
+					pARGB[i] = s.argb;
+					++i;
+				}
+				else {
+					++skipped[k];
+				}
+				line = eol + 1;
+			}
+			parsed[k] = i - first[k];
+		});
+
+	// close the gaps of the skipped lines
+	std::size_t n = 0;
+	for (std::size_t k = 0; k < nChunks; ++k)
+	{
+		const std::size_t b = first[k];
+		const std::size_t e = b + parsed[k];
+		if (n != b)
+		{
+			std::copy(px + b, px + e, px + n);
+			std::copy(py + b, py + e, py + n);
+			std::copy(pz + b, pz + e, pz + n);
+			std::copy(pr + b, pr + e, pr + n);
+			std::copy(pARGB + b, pARGB + e, pARGB + n);
+		}
+		n += parsed[k];
+		stats.linesSkipped += skipped[k];
+	}
+	spheres.resize(n);
+	stats.lines = n + stats.linesSkipped;
+
+	// made-up radius and color by the index
+	const bool hasR = fields.Has(ETextField::R);
+	const bool hasARGB = fields.Has(ETextField::ARGB);
+	if (!hasR || !hasARGB)
+	{
+		CTaskScheduler::Get().ParallelFor(
+			nChunks,
+			1,
+			[=](std::size_t k) {
+				for (std::size_t i = n * k / nChunks; i < n * (k + 1) / nChunks; ++i)
+				{
+					if (!hasR)
+					{
+						const std::uint32_t h = HashIndex((std::uint32_t)i, 1);
+						pr[i] = (5.0f + 5.0f * (h % 1024) / 1024.0f) * 0.004f;
+					}
+					if (!hasARGB) {
+						pARGB[i] = HashIndex((std::uint32_t)i, 2) & 0xFFFFFF;
+					}
+				}
+			});
+	}
+
+	return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+
+
+struct SSphereColumns;
+
+
+//! Meaning of a field of a text line.
+enum class ETextField
+{
+	Skip,
+	X,
+	Y,
+	Z,
+	//! Radius in the units of the coordinates.
+	R,
+	//! Hexadecimal, "0x" or "#" in front is allowed.
+	ARGB
+};
+
+
+//! \brief Fields of a line of a text dataset.
+//! The fields are split by spaces, tabs or commas. The lines starting
+//! with '#' and the lines which don't parse are skipped.
+struct STextLayout
+{
+	static constexpr int MAX_FIELDS = 16;
+
+	ETextField fields[MAX_FIELDS];
+	int nFields;
+
+	//! \param sz Names split by commas: "x,y,z,r,argb", "_" skips a field.
+	//! \return false for an unknown name, a name twice or no x, y, z.
+	bool Parse(const char* sz);
+
+	//! "x y z", "x y z r" or "x y z r argb" by the number of fields.
+	static STextLayout ForFields(int n);
+
+	bool Has(ETextField) const;
+};
+
+
+//! \brief Units of the text datasets: the scene times TEXT_SCALE, the
+//!        scene origin at (0, TEXT_ORIGIN_Y, TEXT_ORIGIN_Z).
+//! The scene convention of the sample dataset.
+static constexpr float TEXT_SCALE = 100;
+static constexpr float TEXT_ORIGIN_Y = 60;
+static constexpr float TEXT_ORIGIN_Z = 50;
+
+//! The float a scene value is written as, the origin of its axis added.
+float SceneToText(float v, float origin);
+
+//! The scene value LoadSphereText() makes of a text one.
+float TextToScene(float t, float origin);
+
+//! \brief Rounds the spheres to the values LoadSphereText() makes of
+//!        SceneToText(), so a scene and its text have one image.
+void SnapToText(SSphereColumns& spheres);
+
+
+//! Counters of LoadSphereText().
+struct STextLoadStats
+{
+	std::size_t bytes;
+	std::size_t lines;
+	std::size_t linesSkipped;
+	//! The layout used, detected by the first line when not given.
+	STextLayout layout;
+};
+
+
+//! \brief Parses a text dataset on all cores.
+//! The file is mapped and split at line boundaries, every part is parsed
+//! right into the columns, so there are no allocations per sphere.
+//! A missing radius or color is made up from the index of the sphere,
+//! the same on every platform.
+//! \param layout nullptr detects the layout by the first data line.
+//! \return false when the file can't be read.
+bool LoadSphereText(
+	const char* szFilename,
+	const STextLayout* layout,
+	SSphereColumns& spheres,
+	STextLoadStats& stats);
@@ -0,0 +1,304 @@
+#include "TaskScheduler.h"
+#include "FrameTrace.h"
+
+#ifdef _WIN32
+// Exclude rarely-used stuff from Windows headers
+#define WIN32_LEAN_AND_MEAN
+
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace {
+
+//! The thread runs a chunk of the pool, its loops run on it alone.
+thread_local bool g_bInLoop = false;
+
+std::uint64_t PackChunks(std::uint32_t begin, std::uint32_t end)
+{
+	return ((std::uint64_t)begin << 32) | end;
+}
+
+std::uint32_t ChunksBegin(std::uint64_t chunks)
+{
+	return (std::uint32_t)(chunks >> 32);
+}
+
+std::uint32_t ChunksEnd(std::uint64_t chunks)
+{
+	return (std::uint32_t)chunks;
+}
+
+int DefaultThreadCount()
+{
+	return (int)std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+bool PinThread(std::thread& thread, int core)
+{
+	const int nCores = DefaultThreadCount();
+#ifdef _WIN32
+	const DWORD_PTR mask = (DWORD_PTR)1 << (core % std::min(nCores, 64));
+	return SetThreadAffinityMask(thread.native_handle(), mask) != 0;
+#else
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(core % nCores, &cpus);
+	return pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) == 0;
+#endif
+}
+
+} // namespace
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+CTaskScheduler::CTaskScheduler(int nThreads) :
+	m_nThreads(0),
+	m_bAffinity(false),
+	m_Func(nullptr),
+	m_Ctx(nullptr),
+	m_nCount(0),
+	m_nGrain(1),
+	m_iTraceFrame(CFrameTrace::NO_FRAME),
+	m_nGeneration(0),
+	m_nBusy(0),
+	m_bStop(false),
+	m_nLoops(0),
+	m_nInlineLoops(0),
+	m_nChunks(0),
+	m_nSteals(0)
+{
+	SetThreadCount(nThreads);
+}
+
+
+CTaskScheduler::~CTaskScheduler()
+{
+	StopWorkers();
+}
+
+
+CTaskScheduler& CTaskScheduler::Get()
+{
+	static CTaskScheduler scheduler;
+	return scheduler;
+}
+
+
+void CTaskScheduler::SetThreadCount(int nThreads)
+{
+	StopWorkers();
+	m_nThreads = (nThreads > 0) ? nThreads : DefaultThreadCount();
+	m_Slots.reset(new SSlot[m_nThreads]);
+	for (int k = 0; k < m_nThreads; ++k) {
+		m_Slots[k].chunks = 0;
+	}
+	StartWorkers();
+}
+
+
+bool CTaskScheduler::SetAffinity(bool bPin)
+{
+	m_bAffinity = bPin;
+	StopWorkers();
+	StartWorkers();
+	if (!m_bAffinity) {
+		return true;
+	}
+
+	bool bPinned = true;
+	for (std::size_t k = 0; k < m_Workers.size(); ++k) {
+		bPinned = PinThread(m_Workers[k], (int)k + 1) && bPinned;
+	}
+	return bPinned;
+}
+
+
+CTaskScheduler::SSchedulerStats CTaskScheduler::GetStats() const
+{
+	SSchedulerStats stats;
+	stats.loops = m_nLoops;
+	stats.inlineLoops = m_nInlineLoops;
+	stats.chunks = m_nChunks;
+	stats.steals = m_nSteals;
+	return stats;
+}
+
+
+void CTaskScheduler::ResetStats()
+{
+	m_nLoops = 0;
+	m_nInlineLoops = 0;
+	m_nChunks = 0;
+	m_nSteals = 0;
+}
+
+
+void CTaskScheduler::Run(
+	std::size_t count, std::size_t grain, chunkFunc_t func, const void* ctx)
+{
+	if (count == 0) {
+		return;
+	}
+
+	// the chunks are counted by 32 bits
+	grain = std::max<std::size_t>(grain, 1);
+	grain = std::max<std::size_t>(grain, count / 0x7FFFFFFF + 1);
+	const std::size_t nChunks = (count + grain - 1) / grain;
+
+	std::unique_lock<std::mutex> loop(m_LoopMutex, std::defer_lock);
+	if (nChunks == 1 || m_nThreads == 1 || g_bInLoop || !loop.try_lock())
+	{
+		++m_nInlineLoops;
+		func(ctx, 0, count);
+		return;
+	}
+
+	m_Func = func;
+	m_Ctx = ctx;
+	m_nCount = count;
+	m_nGrain = grain;
+	m_iTraceFrame = CFrameTrace::Get().GetThreadFrame();
+	for (int k = 0; k < m_nThreads; ++k)
+	{
+		m_Slots[k].chunks = PackChunks(
+			(std::uint32_t)(nChunks * k / m_nThreads),
+			(std::uint32_t)(nChunks * (k + 1) / m_nThreads));
+	}
+	++m_nLoops;
+
+	{
+		std::lock_guard<std::mutex> lock(m_WakeMutex);
+		++m_nGeneration;
+		m_nBusy = (int)m_Workers.size();
+	}
+	m_Wake.notify_all();
+
+	g_bInLoop = true;
+	Work(0);
+	g_bInLoop = false;
+
+	std::unique_lock<std::mutex> lock(m_WakeMutex);
+	m_Done.wait(lock, [this]() { return m_nBusy == 0; });
+}
+
+
+void CTaskScheduler::Work(int slot)
+{
+	std::size_t nChunks = 0;
+	std::atomic<std::uint64_t>& own = m_Slots[slot].chunks;
+	for (;;)
+	{
+		std::uint32_t chunk;
+		std::uint64_t chunks = own.load();
+		if (ChunksBegin(chunks) < ChunksEnd(chunks))
+		{
+			// the front chunk, unless a thief took it meanwhile
+			chunk = ChunksBegin(chunks);
+			if (!own.compare_exchange_weak(
+				chunks, PackChunks(chunk + 1, ChunksEnd(chunks))))
+			{
+				continue;
+			}
+		}
+		else if (!Steal(slot, chunk)) {
+			break;
+		}
+
+		RunChunk(chunk);
+		++nChunks;
+	}
+	m_nChunks += nChunks;
+}
+
+
+bool CTaskScheduler::Steal(int slot, std::uint32_t& chunk)
+{
+	// the own slot is empty, nobody else writes it
+	for (int k = 1; k < m_nThreads; ++k)
+	{
+		std::atomic<std::uint64_t>& victim = m_Slots[(slot + k) % m_nThreads].chunks;
+		std::uint64_t chunks = victim.load();
+		while (ChunksBegin(chunks) < ChunksEnd(chunks))
+		{
+			// the back half, the owner keeps going from the front
+			const std::uint32_t begin = ChunksBegin(chunks);
+			const std::uint32_t end = ChunksEnd(chunks);
+			const std::uint32_t middle = begin + (end - begin) / 2;
+			if (victim.compare_exchange_weak(chunks, PackChunks(begin, middle)))
+			{
+				chunk = middle;
+				m_Slots[slot].chunks = PackChunks(middle + 1, end);
+				++m_nSteals;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+void CTaskScheduler::RunChunk(std::uint32_t chunk) const
+{
+	const std::size_t begin = chunk * m_nGrain;
+	m_Func(m_Ctx, begin, std::min(begin + m_nGrain, m_nCount));
+}
+
+
+void CTaskScheduler::WorkerThread(int slot, unsigned int generation)
+{
+	TRACE_THREAD_NAME(("worker " + std::to_string(slot)).c_str());
+	g_bInLoop = true;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_WakeMutex);
+			m_Wake.wait(lock, [&]() { return m_bStop || m_nGeneration != generation; });
+			if (m_bStop) {
+				return;
+			}
+			generation = m_nGeneration;
+		}
+
+		CFrameTrace::Get().SetThreadFrame(m_iTraceFrame);
+		Work(slot);
+
+		bool bLast;
+		{
+			std::lock_guard<std::mutex> lock(m_WakeMutex);
+			bLast = (--m_nBusy == 0);
+		}
+		if (bLast) {
+			m_Done.notify_one();
+		}
+	}
+}
+
+
+void CTaskScheduler::StartWorkers()
+{
+	m_bStop = false;
+	const unsigned int generation = m_nGeneration;
+	for (int k = 1; k < m_nThreads; ++k) {
+		m_Workers.emplace_back(&CTaskScheduler::WorkerThread, this, k, generation);
+	}
+}
+
+
+void CTaskScheduler::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_WakeMutex);
+		m_bStop = true;
+	}
+	m_Wake.notify_all();
+	for (std::thread& worker : m_Workers) {
+		worker.join();
+	}
+	m_Workers.clear();
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//! \brief Persistent pool of worker threads for the parallel loops of
+//!        the renderer, instead of std::execution::par.
+//! A loop is split into chunks of `grain` indices. Every thread of the
+//! pool, the caller included, starts with an even share of the chunks
+//! and takes them one by one from the front. A thread out of chunks
+//! steals the back half of the share of another one, so uneven chunks,
+//! e.g. tiles of a dense corner of the frame, are spread on the fly.
+//!
+//! A loop started inside a loop of the pool runs on its thread, one
+//! by one. A loop of another thread while the pool is busy, e.g. the
+//! stages of CFramePipeline, runs on that thread alone too. So there
+//! are never more busy threads than GetThreadCount() plus the callers.
+class CTaskScheduler
+{
+public:
+	//! Bits per pass of ParallelRadixSort(), the counts of a part fit L1.
+	static constexpr int RADIX_BITS = 8;
+
+	//! Counters since the last ResetStats().
+	struct SSchedulerStats
+	{
+		//! Loops run by the pool.
+		std::size_t loops;
+		//! Loops run on the calling thread alone.
+		std::size_t inlineLoops;
+		std::size_t chunks;
+		std::size_t steals;
+	};
+
+
+public:
+	//! \param nThreads The caller and the workers, 0 is one per core.
+	explicit CTaskScheduler(int nThreads = 0);
+	~CTaskScheduler();
+
+	CTaskScheduler(const CTaskScheduler&) = delete;
+	CTaskScheduler& operator=(const CTaskScheduler&) = delete;
+
+	//! The pool of the renderer.
+	static CTaskScheduler& Get();
+
+	//! \brief Restarts the workers.
+	//! \param nThreads The caller and the workers, 0 is one per core.
+	//! \warning Not while a loop runs.
+	void SetThreadCount(int nThreads);
+	int GetThreadCount() const { return m_nThreads; }
+
+	//! \brief Pins the worker k to the core k, the caller is not pinned.
+	//! \return false when the OS refuses.
+	//! \warning Not while a loop runs.
+	bool SetAffinity(bool bPin);
+	bool IsAffinityEnabled() const { return m_bAffinity; }
+
+	//! \brief Calls f(i) for i in [0..count[ on the pool, returns when
+	//!        all the calls are done.
+	//! \param grain Indices per chunk, the unit of the load balance.
+	template <class F>
+	void ParallelFor(std::size_t count, std::size_t grain, const F& f)
+	{
+		ParallelForRange(count, grain, [&f](std::size_t begin, std::size_t end) {
+			for (std::size_t i = begin; i < end; ++i) {
+				f(i);
+			}
+		});
+	}
+
+	//! \brief As ParallelFor() but f(begin, end) gets a whole chunk.
+	template <class F>
+	void ParallelForRange(std::size_t count, std::size_t grain, const F& f)
+	{
+		Run(count, grain, [](const void* ctx, std::size_t begin, std::size_t end) {
+			(*static_cast<const F*>(ctx))(begin, end);
+		}, &f);
+	}
+
+	//! \brief std::sort of the parts on the pool, then merges of pairs
+	//!        of the parts. The same result as std::sort for a strict
+	//!        total order.
+	template <class T, class Less>
+	void ParallelSort(T* first, T* last, Less less);
+
+	//! \brief Stable LSD radix sort by key(x), an unsigned key of nBits
+	//!        bits, RADIX_BITS per pass. A pass counts the digits of the
+	//!        parts on the pool, then every part scatters to its offsets.
+	//!        A pass of one digit only is skipped.
+	//! \param temp As many elements as [first..last[.
+	template <class T, class Key>
+	void ParallelRadixSort(T* first, T* last, T* temp, Key key, int nBits = 32);
+
+	SSchedulerStats GetStats() const;
+	void ResetStats();
+
+
+private:
+	typedef void (*chunkFunc_t)(const void* ctx, std::size_t begin, std::size_t end);
+
+	//! Chunks [begin..end[ of a thread, packed for a CAS:
+	//! begin in the high half, end in the low one.
+	struct alignas(64) SSlot
+	{
+		std::atomic<std::uint64_t> chunks;
+	};
+
+	void Run(std::size_t count, std::size_t grain, chunkFunc_t func, const void* ctx);
+
+	//! Runs the chunks of the slot and steals until none is left.
+	void Work(int slot);
+	bool Steal(int slot, std::uint32_t& chunk);
+	void RunChunk(std::uint32_t chunk) const;
+
+	//! Waits for the loops after the generation.
+	void WorkerThread(int slot, unsigned int generation);
+	void StartWorkers();
+	void StopWorkers();
+
+
+private:
+	//! m_Slots[0] is the caller of the loop.
+	std::unique_ptr<SSlot[]> m_Slots;
+	int m_nThreads;
+	std::vector<std::thread> m_Workers;
+	bool m_bAffinity;
+
+	//! One loop at a time, the other callers run theirs alone.
+	std::mutex m_LoopMutex;
+
+	//! The loop of the workers.
+	chunkFunc_t m_Func;
+	const void* m_Ctx;
+	std::size_t m_nCount;
+	std::size_t m_nGrain;
+	//! Of the caller, for the zones of the workers.
+	unsigned int m_iTraceFrame;
+
+	//! A loop starts with the next generation, ends when no worker is busy.
+	std::mutex m_WakeMutex;
+	std::condition_variable m_Wake;
+	std::condition_variable m_Done;
+	unsigned int m_nGeneration;
+	int m_nBusy;
+	bool m_bStop;
+
+	std::atomic<std::size_t> m_nLoops;
+	std::atomic<std::size_t> m_nInlineLoops;
+	std::atomic<std::size_t> m_nChunks;
+	std::atomic<std::size_t> m_nSteals;
+};
+
+
+
+
+//////////////////////////////////////////////////////////////////////////
+template <class T, class Less>
+void CTaskScheduler::ParallelSort(T* first, T* last, Less less)
+{
+	const std::size_t n = last - first;
+	// parts of at least 64K keys, a power of two for the merges
+	std::size_t nParts = 1;
+	while (nParts < (std::size_t)GetThreadCount() * 2 && n / (nParts * 2) >= (1 << 16)) {
+		nParts *= 2;
+	}
+	const auto Bound = [first, n, nParts](std::size_t part) {
+		return first + n * part / nParts;
+	};
+
+	ParallelFor(nParts, 1, [&](std::size_t part) {
+		std::sort(Bound(part), Bound(part + 1), less);
+	});
+	for (std::size_t width = 1; width < nParts; width *= 2)
+	{
+		ParallelFor(nParts / (width * 2), 1, [&](std::size_t pair) {
+			const std::size_t part = pair * width * 2;
+			std::inplace_merge(
+				Bound(part), Bound(part + width), Bound(part + width * 2), less);
+		});
+	}
+}
+
+
+template <class T, class Key>
+void CTaskScheduler::ParallelRadixSort(T* first, T* last, T* temp, Key key, int nBits)
+{
+	constexpr std::size_t DIGITS = std::size_t(1) << RADIX_BITS;
+	const std::size_t n = last - first;
+	// parts of at least 64K keys
+	std::size_t nParts = 1;
+	while (nParts < (std::size_t)GetThreadCount() * 2 && n / (nParts * 2) >= (1 << 16)) {
+		++nParts;
+	}
+	const auto Bound = [n, nParts](std::size_t part) {
+		return n * part / nParts;
+	};
+
+	std::vector<std::size_t> offsets(nParts * DIGITS);
+	T* from = first;
+	T* to = temp;
+	for (int shift = 0; shift < nBits; shift += RADIX_BITS)
+	{
+		ParallelFor(nParts, 1, [&](std::size_t part) {
+			std::size_t* count = std::data(offsets) + part * DIGITS;
+			std::fill(count, count + DIGITS, 0);
+			const T* it = from + Bound(part);
+			const T* end = from + Bound(part + 1);
+			for (; it != end; ++it) {
+				++count[(key(*it) >> shift) & (DIGITS - 1)];
+			}
+		});
+
+		// digit by digit, part by part in a digit: the order stays stable
+		std::size_t offset = 0;
+		bool bSingle = false;
+		for (std::size_t d = 0; d < DIGITS; ++d)
+		{
+			std::size_t total = 0;
+			for (std::size_t part = 0; part < nParts; ++part)
+			{
+				const std::size_t count = offsets[part * DIGITS + d];
+				offsets[part * DIGITS + d] = offset + total;
+				total += count;
+			}
+			bSingle = bSingle || (total == n);
+			offset += total;
+		}
+		if (bSingle) {
+			continue;
+		}
+
+		ParallelFor(nParts, 1, [&](std::size_t part) {
+			std::size_t* next = std::data(offsets) + part * DIGITS;
+			const T* it = from + Bound(part);
+			const T* end = from + Bound(part + 1);
+			for (; it != end; ++it) {
+				to[next[(key(*it) >> shift) & (DIGITS - 1)]++] = *it;
+			}
+		});
+		std::swap(from, to);
+	}
+
+	if (from != first)
+	{
+		ParallelForRange(n, 1 << 16, [first, from](std::size_t begin, std::size_t end) {
+			std::copy(from + begin, from + end, first + begin);
+		});
+	}
+}
@@ -0,0 +1,163 @@
+#include "Upscale.h"
+#include "FrameTrace.h"
+#include "TaskScheduler.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <smmintrin.h>
+
+
+namespace {
+
+typedef CFrameBuffer::color_t color_t;
+
+//! Rows per chunk on the scheduler.
+static constexpr std::size_t ROW_GRAIN = 16;
+//! Weights are of 8 bits, 256 is the whole source pixel.
+static constexpr int WEIGHT_ONE = 256;
+
+
+//! Weights of the left and the right pixel, 4 channels each.
+struct alignas(16) SWeights
+{
+	short w[8];
+};
+
+
+//! Source pixel left or above the center of an output one and its weight.
+struct SSample
+{
+	int index;
+	int weight;
+};
+
+
+SSample GetSample(int i, int srcSize, int dstSize)
+{
+	const float s = std::max((i + 0.5f) * srcSize / dstSize - 0.5f, 0.f);
+	const int index = std::min((int)s, srcSize - 1);
+	return { index, (index + 1 < srcSize) ? (int)((s - index) * WEIGHT_ONE + 0.5f) : 0 };
+}
+
+
+//! (a * (256 - w) + b * w) / 256 of the channels of 4 pixels.
+__m128i Lerp4(__m128i a, __m128i b, __m128i wa, __m128i wb)
+{
+	const __m128i half = _mm_set1_epi16(WEIGHT_ONE / 2);
+	const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+		_mm_mullo_epi16(_mm_cvtepu8_epi16(a), wa),
+		_mm_mullo_epi16(_mm_cvtepu8_epi16(b), wb)), half), 8);
+	const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+		_mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(a, 8)), wa),
+		_mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(b, 8)), wb)), half), 8);
+	return _mm_packus_epi16(lo, hi);
+}
+
+
+//! The row of src between rows a and b, plus a copy of the last pixel.
+void LerpRow(const color_t* a, const color_t* b, int w, int n, color_t* row)
+{
+	if (w == 0) {
+		memcpy(row, a, n * sizeof(color_t));
+	}
+	else
+	{
+		const __m128i wa = _mm_set1_epi16((short)(WEIGHT_ONE - w));
+		const __m128i wb = _mm_set1_epi16((short)w);
+		int x = 0;
+		for (; x + 4 <= n; x += 4)
+		{
+			_mm_storeu_si128((__m128i*)(row + x), Lerp4(
+				_mm_loadu_si128((const __m128i*)(a + x)),
+				_mm_loadu_si128((const __m128i*)(b + x)), wa, wb));
+		}
+		for (; x < n; ++x)
+		{
+			const __m128i p = Lerp4(
+				_mm_cvtsi32_si128((int)a[x]), _mm_cvtsi32_si128((int)b[x]), wa, wb);
+			row[x] = (color_t)_mm_cvtsi128_si32(p);
+		}
+	}
+	row[n] = row[n - 1];
+}
+
+} // namespace
+
+
+void UpscaleFrame(
+	const color_t* src, int srcWidth, int srcHeight, int y0, int y1,
+	color_t* dst, int dstWidth, int dstHeight, int& dstY0, int& dstY1)
+{
+	TRACE_ZONE("upscale");
+
+	// the output rows which samples touch the drawn ones
+	std::vector<SSample> rows(dstHeight);
+	dstY0 = dstY1 = 0;
+	for (int y = 0; y < dstHeight; ++y)
+	{
+		rows[y] = GetSample(y, srcHeight, dstHeight);
+		const int last = rows[y].index + (rows[y].weight > 0);
+		if (last >= y0 && rows[y].index < y1)
+		{
+			dstY0 = (dstY1 == 0) ? y : dstY0;
+			dstY1 = y + 1;
+		}
+	}
+	std::fill(dst, dst + (std::size_t)dstY0 * dstWidth, CFrameBuffer::UNDEFINED_COLOR);
+	std::fill(dst + (std::size_t)dstY1 * dstWidth, dst + (std::size_t)dstHeight * dstWidth,
+		CFrameBuffer::UNDEFINED_COLOR);
+
+	std::vector<int> columns(dstWidth);
+	std::vector<SWeights> weights(dstWidth);
+	for (int x = 0; x < dstWidth; ++x)
+	{
+		const SSample sample = GetSample(x, srcWidth, dstWidth);
+		columns[x] = sample.index;
+		const short w = (short)sample.weight;
+		const short v = (short)(WEIGHT_ONE - sample.weight);
+		weights[x] = { { v, v, v, v, w, w, w, w } };
+	}
+
+	CTaskScheduler::Get().ParallelForRange(
+		dstY1 - dstY0,
+		ROW_GRAIN,
+		[&](std::size_t begin, std::size_t end) {
+			std::vector<color_t> row(srcWidth + 1);
+			const __m128i half = _mm_set1_epi16(WEIGHT_ONE / 2);
+			for (std::size_t k = begin; k < end; ++k)
+			{
+				const int y = dstY0 + (int)k;
+				const SSample& sample = rows[y];
+				const color_t* a = src + (std::size_t)sample.index * srcWidth;
+				const color_t* b = sample.weight ? a + srcWidth : a;
+				LerpRow(a, b, sample.weight, srcWidth, std::data(row));
+
+				// two output pixels: the left and the right source pixel of
+				// each weighted, the halves added
+				color_t* out = dst + (std::size_t)y * dstWidth;
+				int x = 0;
+				for (; x + 2 <= dstWidth; x += 2)
+				{
+					const __m128i p0 = _mm_mullo_epi16(_mm_cvtepu8_epi16(
+						_mm_loadl_epi64((const __m128i*)(std::data(row) + columns[x]))),
+						_mm_load_si128((const __m128i*)weights[x].w));
+					const __m128i p1 = _mm_mullo_epi16(_mm_cvtepu8_epi16(
+						_mm_loadl_epi64((const __m128i*)(std::data(row) + columns[x + 1]))),
+						_mm_load_si128((const __m128i*)weights[x + 1].w));
+					const __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+						_mm_unpacklo_epi64(p0, p1), _mm_unpackhi_epi64(p0, p1)), half), 8);
+					_mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(sum, sum));
+				}
+				for (; x < dstWidth; ++x)
+				{
+					const __m128i p = _mm_mullo_epi16(_mm_cvtepu8_epi16(
+						_mm_loadl_epi64((const __m128i*)(std::data(row) + columns[x]))),
+						_mm_load_si128((const __m128i*)weights[x].w));
+					const __m128i sum = _mm_srli_epi16(
+						_mm_add_epi16(_mm_add_epi16(p, _mm_srli_si128(p, 8)), half), 8);
+					out[x] = (color_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+				}
+			}
+		});
+}
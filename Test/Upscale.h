@@ -0,0 +1,15 @@
+#pragma once
+
+#include "FrameBuffer.h"
+
+
+//! \brief Bilinear scale of a frame drawn below the output size, rows on
+//!        the scheduler, two pixels of four 16-bit channels per SSE op.
+//! Pixel centers map to pixel centers, the edges are clamped.
+//! \param y0, y1 Drawn rows of src as CFrameBuffer::GetDrawnRows(), the
+//!        other ones are UNDEFINED_COLOR.
+//! \param dstY0, dstY1 Drawn rows of dst, it's UNDEFINED_COLOR out of them.
+//! \see CQualityController
+void UpscaleFrame(
+	const CFrameBuffer::color_t* src, int srcWidth, int srcHeight, int y0, int y1,
+	CFrameBuffer::color_t* dst, int dstWidth, int dstHeight, int& dstY0, int& dstY1);
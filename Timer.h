@@ -1,14 +1,20 @@
 #pragma once
 
+#ifdef _WIN32
 // Exclude rarely-used stuff from Windows headers
 #define WIN32_LEAN_AND_MEAN
 
 #include <windows.h>
+#else
+#include <chrono>
+#endif
 
 
 struct Timer
 {
-	static __int64 g_nTicksPerSecond;
+	typedef long long ticks_t;
+
+	static ticks_t g_nTicksPerSecond;
 	static double g_fSecondsPerTick;
 	static double g_fMilliSecondsPerTick;
 	static unsigned int g_nCPUHerz;
@@ -16,7 +22,12 @@ struct Timer
 	//! \warning Called once.
 	static void Init()
 	{
+#ifdef _WIN32
 		QueryPerformanceFrequency((LARGE_INTEGER*)& g_nTicksPerSecond);
+#else
+		g_nTicksPerSecond = std::chrono::steady_clock::period::den /
+			std::chrono::steady_clock::period::num;
+#endif
 
 		g_fSecondsPerTick = 1.0 / (double)g_nTicksPerSecond;
 		g_fMilliSecondsPerTick = 1000.0 / (double)g_nTicksPerSecond;
@@ -25,7 +36,7 @@ struct Timer
 	//////////////////////////////////////////////////////////////////////////
 	static int GetMillis()
 	{
-		__int64 ticks;
+		ticks_t ticks;
 		GetTicks(&ticks);
 		return (int)(TicksToMilliseconds(ticks));
 	}
@@ -33,27 +44,31 @@ struct Timer
 	//////////////////////////////////////////////////////////////////////////
 	static double GetMillisFloat()
 	{
-		__int64 ticks;
+		ticks_t ticks;
 		GetTicks(&ticks);
 		return g_fMilliSecondsPerTick * ticks;
 	}
 
 	//////////////////////////////////////////////////////////////////////////
-	static void GetTicks(__int64* pnTime)
+	static void GetTicks(ticks_t* pnTime)
 	{
+#ifdef _WIN32
 		LARGE_INTEGER nTick;
 		QueryPerformanceCounter((LARGE_INTEGER*)& nTick);
 		*pnTime = nTick.QuadPart;
+#else
+		*pnTime = std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
 	}
 
 	//////////////////////////////////////////////////////////////////////////
-	static float TicksToSeconds(__int64 nTime)
+	static float TicksToSeconds(ticks_t nTime)
 	{
 		return float(g_fSecondsPerTick * nTime);
 	}
 
 	//////////////////////////////////////////////////////////////////////////
-	static float TicksToMilliseconds(__int64 nTime)
+	static float TicksToMilliseconds(ticks_t nTime)
 	{
 		return float(g_fMilliSecondsPerTick * nTime);
 	}